@@ -1,15 +1,30 @@
 #pragma once
 
+#include <algorithm>
 #include <cstddef>
 #include <memory>
+#include <type_traits>
 #include <utility>
+#include <vector>
 
+// Bump allocator for AST nodes. Memory comes in blocks of `max_num_bytes`;
+// when one is full a new block is chained on, so large sources never run out.
+// Objects made with emplace() are destroyed when the arena goes away or when
+// a release() takes back the memory they live in.
 class ArenaAllocator {
 public:
+    // a point to release() back to
+    struct Mark {
+        size_t blocks;
+        std::byte* offset;
+        size_t dtors;
+    };
+
     explicit ArenaAllocator(const size_t max_num_bytes) :
         m_size{max_num_bytes} ,
         m_buffer{new std::byte[max_num_bytes]},
-        m_offset { m_buffer}
+        m_offset { m_buffer},
+        m_end { m_buffer + max_num_bytes }
     {};
 
     ArenaAllocator(const ArenaAllocator&) = delete;
@@ -19,24 +34,36 @@ public:
         : m_size{std::exchange(other.m_size, 0)}
         , m_buffer{ std::exchange(other.m_buffer, nullptr)}
         , m_offset{ std:: exchange(other.m_offset, nullptr)}
+        , m_end{ std::exchange(other.m_end, nullptr)}
+        , m_full_blocks{ std::move(other.m_full_blocks)}
+        , m_dtors{ std::move(other.m_dtors)}
     {}
 
     ArenaAllocator& operator = ( ArenaAllocator&& other) noexcept {
         std::swap(m_size, other.m_size);
         std::swap(m_buffer, other.m_buffer);
         std::swap(m_offset, other.m_offset);
+        std::swap(m_end, other.m_end);
+        std::swap(m_full_blocks, other.m_full_blocks);
+        std::swap(m_dtors, other.m_dtors);
 
         return *this;
     }
 
 
     template <typename T> [[nodiscard]] T* alloc() {
-        size_t remaining_num_bytes = m_size - static_cast<size_t> (m_offset - m_buffer);
+        size_t remaining_num_bytes = static_cast<size_t> (m_end - m_offset);
         auto pointer = static_cast<void*>(m_offset);
 
-        const auto aligned_address = std::align(alignof(T), sizeof(T), pointer, remaining_num_bytes);
+        auto aligned_address = std::align(alignof(T), sizeof(T), pointer, remaining_num_bytes);
         if (aligned_address == nullptr) {
-           throw std::bad_alloc {};
+            grow(sizeof(T) + alignof(T));
+            remaining_num_bytes = static_cast<size_t> (m_end - m_offset);
+            pointer = static_cast<void*>(m_offset);
+            aligned_address = std::align(alignof(T), sizeof(T), pointer, remaining_num_bytes);
+            if (aligned_address == nullptr) {
+                throw std::bad_alloc {};
+            }
         }
 
         m_offset = static_cast<std::byte*> (aligned_address) + sizeof(T);
@@ -45,15 +72,69 @@ public:
 
     template <typename T, typename... Args> [[nodiscard]] T* emplace(Args&&... args) {
         const auto allocated_memory = alloc<T>();
-        return new (allocated_memory) T {std::forward<Args>(args)... };
+        T* object = new (allocated_memory) T {std::forward<Args>(args)... };
+        if constexpr (!std::is_trivially_destructible_v<T>) {
+            m_dtors.push_back({ object, [](void* p) { static_cast<T*>(p)->~T(); } });
+        }
+        return object;
+    }
+
+    [[nodiscard]] Mark mark() const {
+        return { .blocks = m_full_blocks.size(), .offset = m_offset, .dtors = m_dtors.size() };
+    }
+
+    // Destroys everything emplaced since `mark` and hands its memory out again;
+    // blocks chained on since then are freed.
+    void release(const Mark& mark) {
+        destroy(mark.dtors);
+        while (m_full_blocks.size() > mark.blocks) {
+            delete[] m_buffer;
+            m_buffer = m_full_blocks.back().begin;
+            m_end = m_full_blocks.back().end;
+            m_full_blocks.pop_back();
+        }
+        m_offset = mark.offset;
     }
 
     ~ArenaAllocator() {
+        destroy(0);
         delete[] m_buffer;
+        for (const Block& block : m_full_blocks) {
+            delete[] block.begin;
+        }
     }
 
 private:
+    struct Block {
+        std::byte* begin;
+        std::byte* end;
+    };
+
+    struct Dtor {
+        void* object;
+        void (*destroy)(void*);
+    };
+
+    void destroy(const size_t keep) {
+        while (m_dtors.size() > keep) {
+            m_dtors.back().destroy(m_dtors.back().object);
+            m_dtors.pop_back();
+        }
+    }
+
+    void grow(const size_t min_num_bytes) {
+        const size_t block_size = std::max(m_size, min_num_bytes);
+        auto block = new std::byte[block_size];
+        m_full_blocks.push_back({ .begin = m_buffer, .end = m_end });
+        m_buffer = block;
+        m_offset = block;
+        m_end = block + block_size;
+    }
+
     size_t m_size;
     std::byte* m_buffer;
     std::byte* m_offset;
+    std::byte* m_end;
+    std::vector<Block> m_full_blocks{};
+    std::vector<Dtor> m_dtors{};       // of emplaced objects, in construction order
 };
\ No newline at end of file
@@ -0,0 +1,702 @@
+#pragma once
+
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "parser.hpp"
+
+// On-disk form of a parsed NodeProg, keyed by a hash of the source text.
+//
+//   header | node records | token records | lists | string table
+//
+// Every reference is an index into one of the sections instead of a pointer, so
+// the file is position independent and can be mmap'd and walked in place
+// through AstCacheView. Lists are stored as [count, item, item, ...] and are
+// referenced by the index of their count. Bump `version` whenever the layout or
+// the set of node kinds changes; stale files are then ignored.
+struct AstCacheFormat {
+    static constexpr char magic[8] = { 'H', 'Y', 'A', 'S', 'T', 0, 0, 0 };
+    static constexpr uint32_t version = 7;
+    static constexpr uint32_t none = UINT32_MAX;
+
+    enum class Kind : uint32_t {
+        ExprInt,      // a: token
+        ExprIdent,    // a: token
+        ExprParen,    // a: expr
+        ExprCall,     // a: token, b: list of exprs
+        ExprAdd,      // a: lhs, b: rhs
+        ExprSub,
+        ExprMulti,
+        ExprDiv,
+        ExprEqual,
+        StmtInt,      // a: token, b: expr or none, c: IntType
+        StmtScope,    // a: list of stmts
+        StmtIf,       // a: expr, b: scope, c: pred or none
+        PredElif,     // a: expr, b: scope, c: pred or none
+        PredElse,     // a: scope
+        StmtAssign,   // a: token, b: expr
+        StmtReturn,   // a: expr
+        StmtCall,     // a: call expr
+        StmtFunc,     // a: token, b: list of the return IntType, then token and IntType of each param, c: scope
+        StmtSwitch,   // a: expr, b: list of cases, c: default scope or none
+        SwitchCase,   // a: label token, b: scope
+        StmtPrint,    // a: expr
+        ExprAlloc,    // a: expr
+        ExprIndex,    // a: token, b: expr
+        StmtStore,    // a: token, b: index expr, c: value expr
+        StmtReset,    // a: token
+        StmtParallelFor, // a: list of the loop token and the reduce token if any, b: list of lo and hi exprs, c: scope
+    };
+
+    struct Node {
+        Kind kind;
+        uint32_t a;
+        uint32_t b;
+        uint32_t c;
+        int32_t line; // source line of statements, 0 otherwise
+    };
+
+    struct Tok {
+        uint32_t type;
+        int32_t line;
+        int32_t column;
+        uint32_t has_value;
+        uint32_t str_offset;
+        uint32_t str_len;
+    };
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t root_list;
+        uint64_t source_hash;
+        uint64_t source_size;
+        uint64_t nodes_offset;
+        uint64_t num_nodes;
+        uint64_t tokens_offset;
+        uint64_t num_tokens;
+        uint64_t lists_offset;
+        uint64_t num_lists;
+        uint64_t strings_offset;
+        uint64_t strings_size;
+    };
+
+    // FNV-1a, cheap next to lexing and good enough to key a cache
+    static uint64_t hash(const std::string_view src) {
+        uint64_t h = 0xcbf29ce484222325ull;
+        for (const char c : src) {
+            h = (h ^ static_cast<unsigned char>(c)) * 0x100000001b3ull;
+        }
+        return h;
+    }
+};
+
+class AstCacheWriter {
+public:
+    using Format = AstCacheFormat;
+
+    [[nodiscard]] std::string serialize(const NodeProg& prog, const uint64_t source_hash, const uint64_t source_size) {
+        std::vector<uint32_t> roots;
+        for (const NodeStmt* stmt : prog.stmts) {
+            roots.push_back(this->stmt(stmt));
+        }
+        const uint32_t root_list = list(roots);
+
+        Format::Header header {};
+        std::memcpy(header.magic, Format::magic, sizeof(header.magic));
+        header.version = Format::version;
+        header.root_list = root_list;
+        header.source_hash = source_hash;
+        header.source_size = source_size;
+        header.nodes_offset = align(sizeof(header));
+        header.num_nodes = m_nodes.size();
+        header.tokens_offset = align(header.nodes_offset + m_nodes.size() * sizeof(Format::Node));
+        header.num_tokens = m_tokens.size();
+        header.lists_offset = align(header.tokens_offset + m_tokens.size() * sizeof(Format::Tok));
+        header.num_lists = m_lists.size();
+        header.strings_offset = align(header.lists_offset + m_lists.size() * sizeof(uint32_t));
+        header.strings_size = m_strings.size();
+
+        std::string out(header.strings_offset + m_strings.size(), '\0');
+        std::memcpy(out.data(), &header, sizeof(header));
+        std::memcpy(out.data() + header.nodes_offset, m_nodes.data(), m_nodes.size() * sizeof(Format::Node));
+        std::memcpy(out.data() + header.tokens_offset, m_tokens.data(), m_tokens.size() * sizeof(Format::Tok));
+        std::memcpy(out.data() + header.lists_offset, m_lists.data(), m_lists.size() * sizeof(uint32_t));
+        std::memcpy(out.data() + header.strings_offset, m_strings.data(), m_strings.size());
+        return out;
+    }
+
+private:
+    static uint64_t align(const uint64_t offset) {
+        return (offset + 15) & ~uint64_t { 15 };
+    }
+
+    uint32_t node(const Format::Kind kind, const uint32_t a = Format::none, const uint32_t b = Format::none, const uint32_t c = Format::none) {
+        m_nodes.push_back({ kind, a, b, c, 0 });
+        return static_cast<uint32_t>(m_nodes.size() - 1);
+    }
+
+    uint32_t list(const std::vector<uint32_t>& items) {
+        m_lists.push_back(static_cast<uint32_t>(items.size()));
+        m_lists.insert(m_lists.end(), items.begin(), items.end());
+        return static_cast<uint32_t>(m_lists.size() - items.size() - 1);
+    }
+
+    uint32_t token(const Token& tok) {
+        Format::Tok out { .type = static_cast<uint32_t>(tok.type), .line = tok.line, .column = tok.column,
+                          .has_value = tok.value.has_value(), .str_offset = 0, .str_len = 0 };
+        if (tok.value.has_value()) {
+            // identifiers repeat a lot, store each spelling once
+            const auto [it, inserted] = m_interned.try_emplace(tok.value.value(), static_cast<uint32_t>(m_strings.size()));
+            if (inserted) {
+                m_strings += tok.value.value();
+            }
+            out.str_offset = it->second;
+            out.str_len = static_cast<uint32_t>(tok.value->size());
+        }
+        m_tokens.push_back(out);
+        return static_cast<uint32_t>(m_tokens.size() - 1);
+    }
+
+    static Format::Kind bin_kind(const NodeBinExpr* bin) {
+        struct BinVisitor {
+            Format::Kind operator()(const NodeBinExprAdd*) const { return Format::Kind::ExprAdd; }
+            Format::Kind operator()(const NodeBinExprSub*) const { return Format::Kind::ExprSub; }
+            Format::Kind operator()(const NodeBinExprMulti*) const { return Format::Kind::ExprMulti; }
+            Format::Kind operator()(const NodeBinExprDiv*) const { return Format::Kind::ExprDiv; }
+            Format::Kind operator()(const NodeBinExprEqual*) const { return Format::Kind::ExprEqual; }
+        };
+        return std::visit(BinVisitor {}, bin->var);
+    }
+
+    // children first, their indices wait on m_operands until the parent is written
+    uint32_t expr(const NodeExpr* root) {
+        walk_expr(root, [&](const NodeExpr* expr, const size_t done, const size_t count) {
+            if (const auto bin = std::get_if<NodeBinExpr*>(&expr->var)) {
+                if (done == count) {
+                    const uint32_t r = pop_operand();
+                    const uint32_t l = pop_operand();
+                    m_operands.push_back(node(bin_kind(*bin), l, r));
+                }
+                return;
+            }
+            const NodeTerm* term = std::get<NodeTerm*>(expr->var);
+            if (const auto term_index = std::get_if<NodeTermIndex*>(&term->var); term_index != nullptr && done == 0) {
+                m_operands.push_back(token((*term_index)->ident));
+            }
+            if (done < count) {
+                return;
+            }
+            struct TermVisitor {
+                AstCacheWriter& w;
+                uint32_t operator()(const NodeTermInt* term_int) const { return w.node(Format::Kind::ExprInt, w.token(term_int->int_lit)); }
+                uint32_t operator()(const NodeTermIdent* term_ident) const { return w.node(Format::Kind::ExprIdent, w.token(term_ident->ident)); }
+                uint32_t operator()(const NodeTermParen*) const { return w.node(Format::Kind::ExprParen, w.pop_operand()); }
+                uint32_t operator()(const NodeTermCall* term_call) const {
+                    std::vector<uint32_t> args(w.m_operands.end() - static_cast<std::ptrdiff_t>(term_call->args.size()), w.m_operands.end());
+                    w.m_operands.resize(w.m_operands.size() - args.size());
+                    return w.call_node(term_call, args);
+                }
+                uint32_t operator()(const NodeTermAlloc*) const { return w.node(Format::Kind::ExprAlloc, w.pop_operand()); }
+                uint32_t operator()(const NodeTermIndex*) const {
+                    const uint32_t index = w.pop_operand();
+                    const uint32_t ident = w.pop_operand();
+                    return w.node(Format::Kind::ExprIndex, ident, index);
+                }
+            };
+            m_operands.push_back(std::visit(TermVisitor { .w = *this }, term->var));
+        });
+        return pop_operand();
+    }
+
+    uint32_t pop_operand() {
+        const uint32_t index = m_operands.back();
+        m_operands.pop_back();
+        return index;
+    }
+
+    uint32_t call_node(const NodeTermCall* call, const std::vector<uint32_t>& args) {
+        return node(Format::Kind::ExprCall, token(call->ident), list(args));
+    }
+
+    uint32_t call(const NodeTermCall* call) {
+        std::vector<uint32_t> args;
+        for (const NodeExpr* arg : call->args) {
+            args.push_back(expr(arg));
+        }
+        return call_node(call, args);
+    }
+
+    uint32_t scope(const NodeScope* scope) {
+        std::vector<uint32_t> stmts;
+        for (const NodeStmt* stmt : scope->stmts) {
+            stmts.push_back(this->stmt(stmt));
+        }
+        return node(Format::Kind::StmtScope, list(stmts));
+    }
+
+    uint32_t if_pred(const std::optional<NodeIfPred*>& pred) {
+        if (!pred.has_value()) {
+            return Format::none;
+        }
+        if (const auto elif = std::get_if<NodeIfPredElif*>(&pred.value()->var)) {
+            const uint32_t cond = expr((*elif)->expr);
+            const uint32_t body = scope((*elif)->scope);
+            return node(Format::Kind::PredElif, cond, body, if_pred((*elif)->pred));
+        }
+        return node(Format::Kind::PredElse, scope(std::get<NodeIfPredElse*>(pred.value()->var)->scope));
+    }
+
+    uint32_t stmt(const NodeStmt* stmt) {
+        struct StmtVisitor {
+            AstCacheWriter& w;
+            uint32_t operator()(const NodeStmtInt* stmt_int) const {
+                const uint32_t ident = w.token(stmt_int->ident);
+                const uint32_t init = stmt_int->expr != nullptr ? w.expr(stmt_int->expr) : Format::none;
+                return w.node(Format::Kind::StmtInt, ident, init, static_cast<uint32_t>(stmt_int->type));
+            }
+            uint32_t operator()(const NodeScope* scope) const { return w.scope(scope); }
+            uint32_t operator()(const NodeStmtIf* stmt_if) const {
+                const uint32_t cond = w.expr(stmt_if->expr);
+                const uint32_t body = w.scope(stmt_if->scope);
+                return w.node(Format::Kind::StmtIf, cond, body, w.if_pred(stmt_if->pred));
+            }
+            uint32_t operator()(const NodeStmtAssign* stmt_assign) const {
+                const uint32_t ident = w.token(stmt_assign->ident);
+                return w.node(Format::Kind::StmtAssign, ident, w.expr(stmt_assign->expr));
+            }
+            uint32_t operator()(const NodeStmtReturn* stmt_return) const { return w.node(Format::Kind::StmtReturn, w.expr(stmt_return->expr)); }
+            uint32_t operator()(const NodeStmtCall* stmt_call) const { return w.node(Format::Kind::StmtCall, w.call(stmt_call->call)); }
+            uint32_t operator()(const NodeStmtStore* stmt_store) const {
+                const uint32_t ident = w.token(stmt_store->ident);
+                const uint32_t index = w.expr(stmt_store->index);
+                return w.node(Format::Kind::StmtStore, ident, index, w.expr(stmt_store->expr));
+            }
+            uint32_t operator()(const NodeStmtReset* stmt_reset) const { return w.node(Format::Kind::StmtReset, w.token(stmt_reset->reset)); }
+            uint32_t operator()(const NodeStmtPrint* stmt_print) const { return w.node(Format::Kind::StmtPrint, w.expr(stmt_print->expr)); }
+            uint32_t operator()(const NodeStmtFunc* func) const {
+                const uint32_t ident = w.token(func->ident);
+                std::vector<uint32_t> params { static_cast<uint32_t>(func->ret) };
+                for (size_t i = 0; i < func->params.size(); i++) {
+                    params.push_back(w.token(func->params[i]));
+                    params.push_back(static_cast<uint32_t>(func->param_types[i]));
+                }
+                const uint32_t param_list = w.list(params);
+                return w.node(Format::Kind::StmtFunc, ident, param_list, w.scope(func->body));
+            }
+            uint32_t operator()(const NodeStmtParallelFor* loop) const {
+                std::vector<uint32_t> tokens { w.token(loop->ident) };
+                if (loop->reduce.has_value()) {
+                    tokens.push_back(w.token(loop->reduce.value()));
+                }
+                const uint32_t token_list = w.list(tokens);
+                const uint32_t lo = w.expr(loop->lo);
+                const uint32_t range = w.list({ lo, w.expr(loop->hi) });
+                return w.node(Format::Kind::StmtParallelFor, token_list, range, w.scope(loop->body));
+            }
+            uint32_t operator()(const NodeStmtSwitch* stmt_switch) const {
+                const uint32_t cond = w.expr(stmt_switch->expr);
+                std::vector<uint32_t> cases;
+                for (const NodeSwitchCase& c : stmt_switch->cases) {
+                    const uint32_t label = w.token(c.label);
+                    cases.push_back(w.node(Format::Kind::SwitchCase, label, w.scope(c.scope)));
+                }
+                const uint32_t case_list = w.list(cases);
+                const uint32_t default_scope = stmt_switch->default_scope != nullptr ? w.scope(stmt_switch->default_scope) : Format::none;
+                return w.node(Format::Kind::StmtSwitch, cond, case_list, default_scope);
+            }
+        };
+        const uint32_t index = std::visit(StmtVisitor { .w = *this }, stmt->var);
+        m_nodes[index].line = stmt->line;
+        return index;
+    }
+
+    std::vector<Format::Node> m_nodes{};
+    std::vector<Format::Tok> m_tokens{};
+    std::vector<uint32_t> m_lists{};
+    std::string m_strings{};
+    std::unordered_map<std::string, uint32_t> m_interned{};
+    std::vector<uint32_t> m_operands{}; // written, not yet linked to a parent
+};
+
+// Read-only view of a cache file mapped into memory. Nothing is copied or
+// decoded on open beyond validating the header and section bounds; accessors
+// read the records in place and throw on out-of-range references.
+class AstCacheView {
+public:
+    using Format = AstCacheFormat;
+
+    // empty when the file is missing, stale or malformed
+    static std::optional<AstCacheView> open(const std::string& path, const uint64_t source_hash, const uint64_t source_size) {
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return {};
+        }
+        struct stat st {};
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(Format::Header)) {
+            close(fd);
+            return {};
+        }
+        const size_t size = static_cast<size_t>(st.st_size);
+        void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) {
+            return {};
+        }
+        AstCacheView view(static_cast<const std::byte*>(map), size);
+        if (!view.valid(source_hash, source_size)) {
+            return {};
+        }
+        return view;
+    }
+
+    AstCacheView(const AstCacheView&) = delete;
+    AstCacheView& operator=(const AstCacheView&) = delete;
+
+    AstCacheView(AstCacheView&& other) noexcept
+        : m_base(std::exchange(other.m_base, nullptr)), m_size(std::exchange(other.m_size, 0)) {}
+
+    AstCacheView& operator=(AstCacheView&& other) noexcept {
+        std::swap(m_base, other.m_base);
+        std::swap(m_size, other.m_size);
+        return *this;
+    }
+
+    ~AstCacheView() {
+        if (m_base != nullptr) {
+            munmap(const_cast<std::byte*>(m_base), m_size);
+        }
+    }
+
+    [[nodiscard]] const Format::Header& header() const {
+        return *reinterpret_cast<const Format::Header*>(m_base);
+    }
+
+    [[nodiscard]] std::span<const uint32_t> roots() const {
+        return list(header().root_list);
+    }
+
+    [[nodiscard]] const Format::Node& node(const uint32_t index) const {
+        check(index < header().num_nodes);
+        return reinterpret_cast<const Format::Node*>(m_base + header().nodes_offset)[index];
+    }
+
+    [[nodiscard]] std::span<const uint32_t> list(const uint32_t index) const {
+        const auto lists = reinterpret_cast<const uint32_t*>(m_base + header().lists_offset);
+        check(index < header().num_lists && lists[index] <= header().num_lists - index - 1);
+        return { lists + index + 1, lists[index] };
+    }
+
+    [[nodiscard]] const Format::Tok& token_record(const uint32_t index) const {
+        check(index < header().num_tokens);
+        return reinterpret_cast<const Format::Tok*>(m_base + header().tokens_offset)[index];
+    }
+
+    [[nodiscard]] std::string_view text(const Format::Tok& tok) const {
+        check(tok.str_offset <= header().strings_size && tok.str_len <= header().strings_size - tok.str_offset);
+        return { reinterpret_cast<const char*>(m_base + header().strings_offset) + tok.str_offset, tok.str_len };
+    }
+
+    [[nodiscard]] Token token(const uint32_t index) const {
+        const Format::Tok& tok = token_record(index);
+        Token out { static_cast<TokenType>(tok.type), tok.line, tok.column };
+        if (tok.has_value) {
+            out.value = std::string(text(tok));
+        }
+        return out;
+    }
+
+private:
+    AstCacheView(const std::byte* base, const size_t size) : m_base(base), m_size(size) {}
+
+    static void check(const bool ok) {
+        if (!ok) {
+            throw std::runtime_error("corrupt AST cache");
+        }
+    }
+
+    [[nodiscard]] bool valid(const uint64_t source_hash, const uint64_t source_size) const {
+        const Format::Header& h = header();
+        const auto fits = [&](const uint64_t offset, const uint64_t count, const uint64_t elem) {
+            return offset <= m_size && count <= (m_size - offset) / elem && offset % 4 == 0;
+        };
+        return std::memcmp(h.magic, Format::magic, sizeof(h.magic)) == 0
+            && h.version == Format::version
+            && h.source_hash == source_hash && h.source_size == source_size
+            && fits(h.nodes_offset, h.num_nodes, sizeof(Format::Node))
+            && fits(h.tokens_offset, h.num_tokens, sizeof(Format::Tok))
+            && fits(h.lists_offset, h.num_lists, sizeof(uint32_t))
+            && fits(h.strings_offset, h.strings_size, 1)
+            && h.root_list < h.num_lists;
+    }
+
+    const std::byte* m_base;
+    size_t m_size;
+};
+
+// Rebuilds the pointer based NodeProg the generators walk from a mapped cache;
+// the passes rewrite that tree, so it cannot be the read-only mapping itself.
+// The writer emits every node after its children, so this is one forward sweep
+// over the records with no recursion: each node links up children built before
+// it. A child has to come before its parent and belong to no other node, which
+// rules out cycles and sharing in a corrupt or hostile file; anything else
+// throws and the entry reads as a miss. The loader owns the node arena, so it
+// must outlive the returned program.
+class AstCacheLoader {
+public:
+    using Format = AstCacheFormat;
+
+    AstCacheLoader() : m_allocator(1024 * 1024 * 4) {}
+
+    [[nodiscard]] NodeProg materialize(const AstCacheView& view) {
+        const uint64_t count = view.header().num_nodes;
+        m_built.assign(count, {});
+        m_taken.assign(count, false);
+        for (uint32_t index = 0; index < count; index++) {
+            m_built[index] = build(view, index);
+        }
+        NodeProg prog;
+        for (const uint32_t root : view.roots()) {
+            prog.stmts.push_back(take<NodeStmt*>(root, count));
+        }
+        m_built = {};
+        m_taken = {};
+        return prog;
+    }
+
+private:
+    using Built = std::variant<std::monostate, NodeExpr*, NodeStmt*, NodeIfPred*, NodeSwitchCase*>;
+
+    static void check(const bool ok) {
+        if (!ok) {
+            throw std::runtime_error("corrupt AST cache");
+        }
+    }
+
+    static IntType int_type(const uint32_t value) {
+        check(value <= static_cast<uint32_t>(IntType::U64));
+        return static_cast<IntType>(value);
+    }
+
+    // claims an earlier node for `parent`
+    template <typename T> T take(const uint32_t child, const uint64_t parent) {
+        check(child < parent && !m_taken[child]);
+        m_taken[child] = true;
+        const T* built = std::get_if<T>(&m_built[child]);
+        check(built != nullptr);
+        return *built;
+    }
+
+    NodeScope* take_scope(const uint32_t child, const uint32_t parent) {
+        const auto scope = std::get_if<NodeScope*>(&take<NodeStmt*>(child, parent)->var);
+        check(scope != nullptr);
+        return *scope;
+    }
+
+    std::optional<NodeIfPred*> take_pred(const uint32_t child, const uint32_t parent) {
+        if (child == Format::none) {
+            return {};
+        }
+        return take<NodeIfPred*>(child, parent);
+    }
+
+    template <typename T> NodeExpr* term_expr(T* term) {
+        return m_allocator.emplace<NodeExpr>(m_allocator.emplace<NodeTerm>(term));
+    }
+
+    template <typename T> NodeExpr* bin_expr(const Format::Node& n, const uint32_t index) {
+        const auto lhs = take<NodeExpr*>(n.a, index);
+        const auto bin = m_allocator.emplace<T>(lhs, take<NodeExpr*>(n.b, index));
+        return m_allocator.emplace<NodeExpr>(m_allocator.emplace<NodeBinExpr>(bin));
+    }
+
+    template <typename T> NodeStmt* stmt(T* stmt, const Format::Node& n) {
+        return m_allocator.emplace<NodeStmt>(stmt, n.line);
+    }
+
+    Built build(const AstCacheView& view, const uint32_t index) {
+        const Format::Node& n = view.node(index);
+        switch (n.kind) {
+            case Format::Kind::ExprInt:
+                return term_expr(m_allocator.emplace<NodeTermInt>(view.token(n.a)));
+            case Format::Kind::ExprIdent:
+                return term_expr(m_allocator.emplace<NodeTermIdent>(view.token(n.a)));
+            case Format::Kind::ExprParen:
+                return term_expr(m_allocator.emplace<NodeTermParen>(take<NodeExpr*>(n.a, index)));
+            case Format::Kind::ExprCall: {
+                auto call = m_allocator.emplace<NodeTermCall>();
+                call->ident = view.token(n.a);
+                for (const uint32_t arg : view.list(n.b)) {
+                    call->args.push_back(take<NodeExpr*>(arg, index));
+                }
+                return term_expr(call);
+            }
+            case Format::Kind::ExprAlloc:
+                return term_expr(m_allocator.emplace<NodeTermAlloc>(take<NodeExpr*>(n.a, index)));
+            case Format::Kind::ExprIndex:
+                return term_expr(m_allocator.emplace<NodeTermIndex>(view.token(n.a), take<NodeExpr*>(n.b, index)));
+            case Format::Kind::ExprAdd: return bin_expr<NodeBinExprAdd>(n, index);
+            case Format::Kind::ExprSub: return bin_expr<NodeBinExprSub>(n, index);
+            case Format::Kind::ExprMulti: return bin_expr<NodeBinExprMulti>(n, index);
+            case Format::Kind::ExprDiv: return bin_expr<NodeBinExprDiv>(n, index);
+            case Format::Kind::ExprEqual: return bin_expr<NodeBinExprEqual>(n, index);
+            case Format::Kind::StmtInt: {
+                auto stmt_int = m_allocator.emplace<NodeStmtInt>(view.token(n.a));
+                if (n.b != Format::none) {
+                    stmt_int->expr = take<NodeExpr*>(n.b, index);
+                }
+                stmt_int->type = int_type(n.c);
+                return stmt(stmt_int, n);
+            }
+            case Format::Kind::StmtScope: {
+                auto scope = m_allocator.emplace<NodeScope>();
+                for (const uint32_t child : view.list(n.a)) {
+                    scope->stmts.push_back(take<NodeStmt*>(child, index));
+                }
+                return stmt(scope, n);
+            }
+            case Format::Kind::StmtIf: {
+                const auto cond = take<NodeExpr*>(n.a, index);
+                const auto body = take_scope(n.b, index);
+                return stmt(m_allocator.emplace<NodeStmtIf>(cond, body, take_pred(n.c, index)), n);
+            }
+            case Format::Kind::PredElif: {
+                const auto cond = take<NodeExpr*>(n.a, index);
+                const auto body = take_scope(n.b, index);
+                return m_allocator.emplace<NodeIfPred>(m_allocator.emplace<NodeIfPredElif>(cond, body, take_pred(n.c, index)));
+            }
+            case Format::Kind::PredElse:
+                return m_allocator.emplace<NodeIfPred>(m_allocator.emplace<NodeIfPredElse>(take_scope(n.a, index)));
+            case Format::Kind::StmtAssign:
+                return stmt(m_allocator.emplace<NodeStmtAssign>(view.token(n.a), take<NodeExpr*>(n.b, index)), n);
+            case Format::Kind::StmtReturn:
+                return stmt(m_allocator.emplace<NodeStmtReturn>(take<NodeExpr*>(n.a, index)), n);
+            case Format::Kind::StmtStore: {
+                const auto at = take<NodeExpr*>(n.b, index);
+                return stmt(m_allocator.emplace<NodeStmtStore>(view.token(n.a), at, take<NodeExpr*>(n.c, index)), n);
+            }
+            case Format::Kind::StmtReset:
+                return stmt(m_allocator.emplace<NodeStmtReset>(view.token(n.a)), n);
+            case Format::Kind::StmtPrint:
+                return stmt(m_allocator.emplace<NodeStmtPrint>(take<NodeExpr*>(n.a, index)), n);
+            case Format::Kind::StmtCall: {
+                check(n.a < index && view.node(n.a).kind == Format::Kind::ExprCall);
+                const NodeTerm* term = std::get<NodeTerm*>(take<NodeExpr*>(n.a, index)->var);
+                return stmt(m_allocator.emplace<NodeStmtCall>(std::get<NodeTermCall*>(term->var)), n);
+            }
+            case Format::Kind::StmtFunc: {
+                auto func = m_allocator.emplace<NodeStmtFunc>();
+                func->ident = view.token(n.a);
+                const auto params = view.list(n.b);
+                check(params.size() % 2 == 1);
+                func->ret = int_type(params[0]);
+                for (size_t i = 1; i < params.size(); i += 2) {
+                    func->params.push_back(view.token(params[i]));
+                    func->param_types.push_back(int_type(params[i + 1]));
+                }
+                func->body = take_scope(n.c, index);
+                return stmt(func, n);
+            }
+            case Format::Kind::SwitchCase: {
+                NodeSwitchCase switch_case { .label = view.token(n.a), .value = 0, .scope = take_scope(n.b, index) };
+                const std::string& text = switch_case.label.value.value();
+                check(std::from_chars(text.data(), text.data() + text.size(), switch_case.value).ec == std::errc {});
+                return m_allocator.emplace<NodeSwitchCase>(std::move(switch_case));
+            }
+            case Format::Kind::StmtSwitch: {
+                auto stmt_switch = m_allocator.emplace<NodeStmtSwitch>();
+                stmt_switch->expr = take<NodeExpr*>(n.a, index);
+                for (const uint32_t case_index : view.list(n.b)) {
+                    stmt_switch->cases.push_back(std::move(*take<NodeSwitchCase*>(case_index, index)));
+                }
+                if (n.c != Format::none) {
+                    stmt_switch->default_scope = take_scope(n.c, index);
+                }
+                return stmt(stmt_switch, n);
+            }
+            case Format::Kind::StmtParallelFor: {
+                const auto tokens = view.list(n.a);
+                const auto range = view.list(n.b);
+                check(!tokens.empty() && tokens.size() <= 2 && range.size() == 2);
+                auto loop = m_allocator.emplace<NodeStmtParallelFor>();
+                loop->ident = view.token(tokens[0]);
+                if (tokens.size() == 2) {
+                    loop->reduce = view.token(tokens[1]);
+                }
+                loop->lo = take<NodeExpr*>(range[0], index);
+                loop->hi = take<NodeExpr*>(range[1], index);
+                loop->body = take_scope(n.c, index);
+                return stmt(loop, n);
+            }
+        }
+        throw std::runtime_error("corrupt AST cache");
+    }
+
+    ArenaAllocator m_allocator;
+    std::vector<Built> m_built{};  // by node index, empty until swept
+    std::vector<bool> m_taken{};   // claimed by a parent already
+};
+
+// One source file's entry in the cache directory, named after the source hash.
+class AstCache {
+public:
+    AstCache(const std::filesystem::path& dir, const std::string_view src)
+        : m_dir(dir), m_hash(AstCacheFormat::hash(src)), m_size(src.size()) {}
+
+    [[nodiscard]] std::string path() const {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.hyast", static_cast<unsigned long long>(m_hash));
+        return (m_dir / name).string();
+    }
+
+    // the program on a hit, empty on a miss; `loader` owns the nodes
+    std::optional<NodeProg> load(AstCacheLoader& loader) const {
+        try {
+            const auto view = AstCacheView::open(path(), m_hash, m_size);
+            if (!view.has_value()) {
+                return {};
+            }
+            return loader.materialize(view.value());
+        } catch (const std::exception&) {
+            return {}; // corrupt entry, overwritten by the next store
+        }
+    }
+
+    // best effort, a failed write only costs the next run a parse
+    void store(const NodeProg& prog) const {
+        std::error_code ec;
+        std::filesystem::create_directories(m_dir, ec);
+        const std::string target = path();
+        const std::string tmp = target + ".tmp";
+        {
+            std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+            if (!out.is_open()) {
+                return;
+            }
+            const std::string bytes = AstCacheWriter().serialize(prog, m_hash, m_size);
+            out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+        }
+        std::filesystem::rename(tmp, target, ec); // readers never see a partial file
+    }
+
+private:
+    std::filesystem::path m_dir;
+    uint64_t m_hash;
+    uint64_t m_size;
+};
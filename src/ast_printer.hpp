@@ -0,0 +1,235 @@
+#pragma once
+
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <variant>
+#include "parser.hpp"
+
+// Writes a program back out as Hy source, for --print-after. Operators get
+// parentheses only where the tree needs them, so the output parses back into
+// the same tree.
+class AstPrinter {
+public:
+    explicit AstPrinter(std::ostream& out) : m_out(out) {}
+
+    void program(const NodeProg& prog) {
+        for (const NodeStmt* stmt : prog.stmts) {
+            this->stmt(stmt);
+        }
+    }
+
+private:
+    // `==` binds loosest, then `+ -`, then `* /`
+    static int precedence(const NodeExpr* expr) {
+        const auto bin = std::get_if<NodeBinExpr*>(&expr->var);
+        if (bin == nullptr) {
+            return 4;
+        }
+        return std::visit([](const auto* op) {
+            using Op = std::remove_cvref_t<decltype(*op)>;
+            if constexpr (std::is_same_v<Op, NodeBinExprEqual>) {
+                return 1;
+            }else if constexpr (std::is_same_v<Op, NodeBinExprAdd> || std::is_same_v<Op, NodeBinExprSub>) {
+                return 2;
+            }else {
+                return 3;
+            }
+        }, (*bin)->var);
+    }
+
+    static const char* op_text(const NodeBinExpr* bin) {
+        return std::visit([](const auto* op) {
+            using Op = std::remove_cvref_t<decltype(*op)>;
+            if constexpr (std::is_same_v<Op, NodeBinExprAdd>) { return " + "; }
+            else if constexpr (std::is_same_v<Op, NodeBinExprSub>) { return " - "; }
+            else if constexpr (std::is_same_v<Op, NodeBinExprMulti>) { return " * "; }
+            else if constexpr (std::is_same_v<Op, NodeBinExprDiv>) { return " / "; }
+            else { return " == "; }
+        }, bin->var);
+    }
+
+    // operators are left associative, so a right operand as loose as its parent needs parentheses
+    static bool needs_parens(const NodeExpr* operand, const int min_precedence) {
+        return precedence(operand) < min_precedence;
+    }
+
+    void args(const NodeTermCall* call) {
+        m_out << call->ident.value.value() << "(";
+        for (size_t i = 0; i < call->args.size(); i++) {
+            m_out << (i == 0 ? "" : ", ");
+            expr(call->args[i]);
+        }
+        m_out << ")";
+    }
+
+    // the text around each operand is written as the walk passes it
+    void expr(const NodeExpr* root) {
+        walk_expr(root, [&](const NodeExpr* expr, const size_t done, const size_t count) {
+            if (const auto bin = std::get_if<NodeBinExpr*>(&expr->var)) {
+                const int prec = precedence(expr);
+                const bool lhs_parens = needs_parens(expr_child(expr, 0), prec);
+                const bool rhs_parens = needs_parens(expr_child(expr, 1), prec + 1);
+                if (done == 0) {
+                    m_out << (lhs_parens ? "(" : "");
+                }else if (done == 1) {
+                    m_out << (lhs_parens ? ")" : "") << op_text(*bin) << (rhs_parens ? "(" : "");
+                }else {
+                    m_out << (rhs_parens ? ")" : "");
+                }
+                return;
+            }
+            struct TermVisitor {
+                AstPrinter& p;
+                size_t done;
+                size_t count;
+                void operator()(const NodeTermInt* term) const { p.m_out << term->int_lit.value.value(); }
+                void operator()(const NodeTermIdent* term) const { p.m_out << term->ident.value.value(); }
+                void operator()(const NodeTermParen*) const { p.m_out << (done == 0 ? "(" : ")"); }
+                void operator()(const NodeTermCall* term) const {
+                    if (done == 0) {
+                        p.m_out << term->ident.value.value() << "(";
+                    }
+                    p.m_out << (done == count ? ")" : done > 0 ? ", " : "");
+                }
+                void operator()(const NodeTermAlloc*) const { p.m_out << (done == 0 ? "alloc(" : ")"); }
+                void operator()(const NodeTermIndex* term) const {
+                    if (done == 0) {
+                        p.m_out << term->ident.value.value() << "[";
+                    }else {
+                        p.m_out << "]";
+                    }
+                }
+            };
+            std::visit(TermVisitor { .p = *this, .done = done, .count = count }, std::get<NodeTerm*>(expr->var)->var);
+        });
+    }
+
+    void indent() {
+        m_out << std::string(m_depth * 4, ' ');
+    }
+
+    // the braces of a scope, on the current line
+    void scope(const NodeScope* scope) {
+        m_out << "{\n";
+        m_depth++;
+        for (const NodeStmt* stmt : scope->stmts) {
+            this->stmt(stmt);
+        }
+        m_depth--;
+        indent();
+        m_out << "}";
+    }
+
+    void if_pred(const NodeIfPred* pred) {
+        if (const auto elif = std::get_if<NodeIfPredElif*>(&pred->var)) {
+            m_out << " elif (";
+            expr((*elif)->expr);
+            m_out << ") ";
+            scope((*elif)->scope);
+            if ((*elif)->pred.has_value()) {
+                if_pred((*elif)->pred.value());
+            }
+            return;
+        }
+        m_out << " else ";
+        scope(std::get<NodeIfPredElse*>(pred->var)->scope);
+    }
+
+    void stmt(const NodeStmt* stmt) {
+        struct StmtVisitor {
+            AstPrinter& p;
+            void operator()(const NodeStmtInt* stmt_int) const {
+                p.m_out << int_type_name(stmt_int->type) << " " << stmt_int->ident.value.value();
+                if (stmt_int->expr != nullptr) {
+                    p.m_out << " = ";
+                    p.expr(stmt_int->expr);
+                }
+                p.m_out << ";";
+            }
+            void operator()(const NodeScope* scope) const { p.scope(scope); }
+            void operator()(const NodeStmtIf* stmt_if) const {
+                p.m_out << "if (";
+                p.expr(stmt_if->expr);
+                p.m_out << ") ";
+                p.scope(stmt_if->scope);
+                if (stmt_if->pred.has_value()) {
+                    p.if_pred(stmt_if->pred.value());
+                }
+            }
+            void operator()(const NodeStmtAssign* stmt_assign) const {
+                p.m_out << stmt_assign->ident.value.value() << " = ";
+                p.expr(stmt_assign->expr);
+                p.m_out << ";";
+            }
+            void operator()(const NodeStmtReturn* stmt_return) const {
+                p.m_out << "return (";
+                p.expr(stmt_return->expr);
+                p.m_out << ");";
+            }
+            void operator()(const NodeStmtCall* stmt_call) const {
+                p.args(stmt_call->call);
+                p.m_out << ";";
+            }
+            void operator()(const NodeStmtFunc* func) const {
+                p.m_out << int_type_name(func->ret) << " " << func->ident.value.value() << "(";
+                for (size_t i = 0; i < func->params.size(); i++) {
+                    p.m_out << (i == 0 ? "" : ", ") << int_type_name(func->param_types[i]) << " " << func->params[i].value.value();
+                }
+                p.m_out << ") ";
+                p.scope(func->body);
+            }
+            void operator()(const NodeStmtSwitch* stmt_switch) const {
+                p.m_out << "switch (";
+                p.expr(stmt_switch->expr);
+                p.m_out << ") {\n";
+                p.m_depth++;
+                for (const NodeSwitchCase& c : stmt_switch->cases) {
+                    p.indent();
+                    p.m_out << "case " << c.label.value.value() << ": ";
+                    p.scope(c.scope);
+                    p.m_out << "\n";
+                }
+                if (stmt_switch->default_scope != nullptr) {
+                    p.indent();
+                    p.m_out << "default: ";
+                    p.scope(stmt_switch->default_scope);
+                    p.m_out << "\n";
+                }
+                p.m_depth--;
+                p.indent();
+                p.m_out << "}";
+            }
+            void operator()(const NodeStmtPrint* stmt_print) const {
+                p.m_out << "print(";
+                p.expr(stmt_print->expr);
+                p.m_out << ");";
+            }
+            void operator()(const NodeStmtStore* stmt_store) const {
+                p.m_out << stmt_store->ident.value.value() << "[";
+                p.expr(stmt_store->index);
+                p.m_out << "] = ";
+                p.expr(stmt_store->expr);
+                p.m_out << ";";
+            }
+            void operator()(const NodeStmtReset*) const { p.m_out << "reset();"; }
+            void operator()(const NodeStmtParallelFor* loop) const {
+                p.m_out << "parallel for (" << loop->ident.value.value() << " = ";
+                p.expr(loop->lo);
+                p.m_out << ", ";
+                p.expr(loop->hi);
+                p.m_out << ") ";
+                if (loop->reduce.has_value()) {
+                    p.m_out << "reduce (" << loop->reduce->value.value() << ") ";
+                }
+                p.scope(loop->body);
+            }
+        };
+        indent();
+        std::visit(StmtVisitor { .p = *this }, stmt->var);
+        m_out << "\n";
+    }
+
+    std::ostream& m_out;
+    size_t m_depth = 0;
+};
@@ -0,0 +1,472 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// CFG pass over the assembly the Generator emits for _start and the function
+// bodies. Each region (`_start:` or `fn_name:` up to the next one) is split into
+// basic blocks, then:
+//   - jumps to blocks that hold no instructions, or only a `jmp`, go straight
+//     to the final destination,
+//   - blocks that became unreachable are dropped,
+//   - a block ending in `jmp L` is placed right before L when nothing else
+//     falls into L, so the jump disappears,
+//   - `jcc A; jmp B; A:` becomes `jncc B; A:`,
+//   - targets of CFG back edges (loop headers, including a function that tail
+//     calls itself) are aligned to 16 bytes.
+// Labels from create_label (`label_N`) are local to their region; labels that
+// show up in `data` (jump tables) are address-taken and always kept. A moved
+// block gets the `%line` directive that was in effect where it came from.
+class BlockLayout {
+public:
+    BlockLayout(std::string_view text, std::string_view data)
+        : m_text(text), m_data(data)
+    {
+    }
+
+    [[nodiscard]] std::string run() {
+        std::vector<std::string_view> lines = split_lines(m_text);
+        std::vector<Region> regions;
+        std::string out;
+        size_t i = 0;
+        for (; i < lines.size() && !is_region_head(lines[i]); i++) {
+            out.append(lines[i]).push_back('\n');
+        }
+        for (; i < lines.size(); i++) {
+            if (is_region_head(lines[i])) {
+                regions.emplace_back();
+            }
+            regions.back().lines.push_back(lines[i]);
+        }
+        find_external_labels(regions);
+        for (Region& region : regions) {
+            parse(region);
+            thread_jumps(region);
+            out += layout(region);
+        }
+        return out;
+    }
+
+private:
+    enum class Exit {
+        FallThrough,
+        Jump,    // jmp target
+        Branch,  // jcc target, else falls through
+        Leave,   // ret, indirect jmp or a jump out of the region, kept in lines
+    };
+
+    struct Block {
+        std::vector<std::string> labels{};
+        std::vector<std::string> lines{};
+        bool has_code = false;   // anything but the final jump
+        Exit exit = Exit::FallThrough;
+        std::string op{};
+        std::string target{};
+        std::string line_directive{}; // `%line` in effect at the block's start
+    };
+
+    struct Region {
+        std::vector<std::string_view> lines{};
+        std::vector<Block> blocks{};
+        std::unordered_map<std::string, size_t> block_of{}; // label -> block
+    };
+
+    static std::vector<std::string_view> split_lines(std::string_view text) {
+        std::vector<std::string_view> lines;
+        while (!text.empty()) {
+            const size_t end = text.find('\n');
+            lines.push_back(text.substr(0, end));
+            if (end == std::string_view::npos) {
+                break;
+            }
+            text.remove_prefix(end + 1);
+        }
+        return lines;
+    }
+
+    static std::string_view trim(std::string_view s) {
+        while (!s.empty() && std::isspace(static_cast<unsigned char>(s.front()))) {
+            s.remove_prefix(1);
+        }
+        while (!s.empty() && std::isspace(static_cast<unsigned char>(s.back()))) {
+            s.remove_suffix(1);
+        }
+        return s;
+    }
+
+    static bool is_ident_char(const char c) {
+        return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '.';
+    }
+
+    static bool is_ident(const std::string_view s) {
+        return !s.empty() && !std::isdigit(static_cast<unsigned char>(s.front())) &&
+            std::ranges::all_of(s, is_ident_char);
+    }
+
+    // "name:" on a line of its own
+    static std::optional<std::string_view> label_of(const std::string_view line) {
+        const std::string_view s = trim(line);
+        if (s.size() < 2 || s.back() != ':' || !is_ident(s.substr(0, s.size() - 1))) {
+            return {};
+        }
+        return s.substr(0, s.size() - 1);
+    }
+
+    static bool is_region_head(const std::string_view line) {
+        const auto label = label_of(line);
+        return label.has_value() && !label->starts_with("label_");
+    }
+
+    static bool is_comment(const std::string_view line) {
+        const std::string_view s = trim(line);
+        return s.empty() || s.front() == ';' || s.front() == '%';
+    }
+
+    static bool is_line_directive(const std::string_view line) {
+        return trim(line).starts_with("%line");
+    }
+
+    // splits "   jz label_3" into mnemonic and operand
+    static std::pair<std::string_view, std::string_view> split_instr(const std::string_view line) {
+        const std::string_view s = trim(line.substr(0, line.find(';')));
+        const size_t space = s.find_first_of(" \t");
+        if (space == std::string_view::npos) {
+            return { s, {} };
+        }
+        return { s.substr(0, space), trim(s.substr(space)) };
+    }
+
+    static std::vector<std::string_view> idents(const std::string_view line) {
+        std::vector<std::string_view> result;
+        const std::string_view s = line.substr(0, line.find(';'));
+        size_t i = 0;
+        while (i < s.size()) {
+            if (!is_ident_char(s[i])) {
+                i++;
+                continue;
+            }
+            const size_t begin = i;
+            while (i < s.size() && is_ident_char(s[i])) {
+                i++;
+            }
+            result.push_back(s.substr(begin, i - begin));
+        }
+        return result;
+    }
+
+    // labels used outside the region that defines them can't be renamed or dropped
+    void find_external_labels(const std::vector<Region>& regions) {
+        std::unordered_map<std::string_view, size_t> defined_in;
+        for (size_t r = 0; r < regions.size(); r++) {
+            for (const std::string_view line : regions[r].lines) {
+                if (const auto label = label_of(line)) {
+                    defined_in.emplace(label.value(), r);
+                }
+            }
+        }
+        for (size_t r = 0; r < regions.size(); r++) {
+            for (const std::string_view line : regions[r].lines) {
+                if (is_comment(line) || label_of(line).has_value()) {
+                    continue;
+                }
+                for (const std::string_view ident : idents(line)) {
+                    const auto it = defined_in.find(ident);
+                    if (it != defined_in.end() && it->second != r) {
+                        m_external.emplace(ident);
+                    }
+                }
+            }
+        }
+        for (const std::string_view line : split_lines(m_data)) {
+            for (const std::string_view ident : idents(line)) {
+                if (defined_in.contains(ident)) {
+                    m_external.emplace(ident);
+                }
+            }
+        }
+    }
+
+    void parse(Region& region) {
+        std::vector<Block>& blocks = region.blocks;
+        const auto new_block = [&] {
+            blocks.emplace_back();
+            blocks.back().line_directive = m_line_directive;
+        };
+        new_block();
+        for (const std::string_view line : region.lines) {
+            if (const auto label = label_of(line)) {
+                if (blocks.back().has_code || blocks.back().exit != Exit::FallThrough) {
+                    new_block();
+                }
+                blocks.back().labels.emplace_back(label.value());
+                region.block_of.emplace(label.value(), blocks.size() - 1);
+                continue;
+            }
+            if (blocks.back().exit != Exit::FallThrough) {
+                new_block();
+            }
+            Block& block = blocks.back();
+            if (is_comment(line)) {
+                if (is_line_directive(line)) {
+                    m_line_directive = line;
+                }
+                block.lines.emplace_back(line);
+                continue;
+            }
+            const auto [op, operand] = split_instr(line);
+            if (op.starts_with('j') && is_ident(operand)) {
+                block.exit = op == "jmp" ? Exit::Jump : Exit::Branch;
+                block.op = op;
+                block.target = operand;
+                continue;
+            }
+            block.lines.emplace_back(line);
+            block.has_code = true;
+            if (op == "ret" || op == "jmp") {
+                block.exit = Exit::Leave;
+            }
+        }
+        // jumps out of the region (hy_exit, other functions) stay as written
+        for (Block& block : blocks) {
+            if ((block.exit == Exit::Jump || block.exit == Exit::Branch) && !region.block_of.contains(block.target)) {
+                block.lines.push_back("   " + block.op + " " + block.target);
+                block.has_code = true;
+                block.exit = block.exit == Exit::Jump ? Exit::Leave : Exit::FallThrough;
+            }
+        }
+        if (blocks.back().exit == Exit::Branch) {
+            new_block(); // the fall-through edge needs a block
+        }
+    }
+
+    // where control really ends up when jumping to `label`
+    static std::string resolve(const Region& region, std::string label) {
+        std::unordered_set<std::string> seen;
+        while (seen.insert(label).second) {
+            const size_t index = region.block_of.at(label);
+            const Block& block = region.blocks[index];
+            if (block.has_code) {
+                break;
+            }
+            if (block.exit == Exit::Jump) {
+                label = block.target;
+            }else if (block.exit == Exit::FallThrough && index + 1 < region.blocks.size() &&
+                    !region.blocks[index + 1].labels.empty()) {
+                label = region.blocks[index + 1].labels.front();
+            }else {
+                break;
+            }
+        }
+        return label;
+    }
+
+    static void thread_jumps(Region& region) {
+        for (Block& block : region.blocks) {
+            if (block.exit == Exit::Jump || block.exit == Exit::Branch) {
+                block.target = resolve(region, block.target);
+            }
+        }
+    }
+
+    bool is_external(const Block& block) const {
+        return std::ranges::any_of(block.labels, [&](const std::string& label) {
+            return m_external.contains(label);
+        });
+    }
+
+    static std::string inverted(const std::string_view op) {
+        static const std::unordered_map<std::string_view, std::string_view> inverse {
+            { "je", "jne" }, { "jne", "je" }, { "jz", "jnz" }, { "jnz", "jz" },
+            { "jl", "jge" }, { "jge", "jl" }, { "jg", "jle" }, { "jle", "jg" },
+            { "jb", "jae" }, { "jae", "jb" }, { "ja", "jbe" }, { "jbe", "ja" },
+        };
+        const auto it = inverse.find(op);
+        return it == inverse.end() ? std::string{} : std::string(it->second);
+    }
+
+    std::string layout(Region& region) const {
+        std::vector<Block>& blocks = region.blocks;
+        const size_t n = blocks.size();
+        const auto target_of = [&](const Block& block) {
+            return region.block_of.at(block.target);
+        };
+
+        // reachability from the entry and from labels used elsewhere
+        std::vector<bool> reachable(n, false);
+        std::vector<size_t> work { 0 };
+        for (size_t i = 0; i < n; i++) {
+            if (is_external(blocks[i])) {
+                work.push_back(i);
+            }
+        }
+        while (!work.empty()) {
+            const size_t i = work.back();
+            work.pop_back();
+            if (reachable[i]) {
+                continue;
+            }
+            reachable[i] = true;
+            const Block& block = blocks[i];
+            if ((block.exit == Exit::FallThrough || block.exit == Exit::Branch) && i + 1 < n) {
+                work.push_back(i + 1);
+            }
+            if (block.exit == Exit::Jump || block.exit == Exit::Branch) {
+                work.push_back(target_of(block));
+            }
+        }
+
+        // loop headers are the targets of back edges, edges to a block still on
+        // the stack of a depth-first walk from the entry and the labels used
+        // elsewhere; a forward jump that layout happens to place backwards
+        // (a switch case to the end label) is not one
+        std::vector<bool> loop_header(n, false);
+        std::vector<int> state(n, 0); // 0 unseen, 1 on the stack, 2 done
+        const auto successors = [&](const size_t i) {
+            std::vector<size_t> result;
+            const Block& block = blocks[i];
+            if ((block.exit == Exit::FallThrough || block.exit == Exit::Branch) && i + 1 < n) {
+                result.push_back(i + 1);
+            }
+            if (block.exit == Exit::Jump || block.exit == Exit::Branch) {
+                result.push_back(target_of(block));
+            }
+            return result;
+        };
+        for (size_t root = 0; root < n; root++) {
+            if (state[root] != 0 || (root != 0 && !is_external(blocks[root]))) {
+                continue;
+            }
+            std::vector<std::pair<size_t, size_t>> stack { { root, 0 } }; // block, next successor
+            state[root] = 1;
+            while (!stack.empty()) {
+                auto& [i, next_succ] = stack.back();
+                const std::vector<size_t> succ = successors(i);
+                if (next_succ == succ.size()) {
+                    state[i] = 2;
+                    stack.pop_back();
+                    continue;
+                }
+                const size_t t = succ[next_succ++];
+                if (state[t] == 1) {
+                    loop_header[t] = true;
+                }else if (state[t] == 0) {
+                    state[t] = 1;
+                    stack.emplace_back(t, 0);
+                }
+            }
+        }
+
+        // chains: fall-through edges are fixed, an unconditional jump pulls
+        // its target up behind it when nothing else falls into the target
+        std::vector<size_t> next(n, n);
+        std::vector<bool> has_pred(n, false);
+        for (size_t i = 0; i + 1 < n; i++) {
+            if (reachable[i] && (blocks[i].exit == Exit::FallThrough || blocks[i].exit == Exit::Branch)) {
+                next[i] = i + 1;
+                has_pred[i + 1] = true;
+            }
+        }
+        for (size_t i = 0; i < n; i++) {
+            if (!reachable[i] || blocks[i].exit != Exit::Jump || next[i] != n) {
+                continue;
+            }
+            const size_t t = target_of(blocks[i]);
+            if (t == 0 || has_pred[t]) {
+                continue;
+            }
+            size_t k = t;
+            while (k != n && k != i) {
+                k = next[k];
+            }
+            if (k == i) {
+                continue; // would close a cycle
+            }
+            next[i] = t;
+            has_pred[t] = true;
+        }
+        std::vector<size_t> order;
+        for (size_t head = 0; head < n; head++) {
+            if (reachable[head] && !has_pred[head]) {
+                for (size_t k = head; k != n; k = next[k]) {
+                    order.push_back(k);
+                }
+            }
+        }
+
+        std::unordered_map<std::string, size_t> refs;
+        for (const size_t i : order) {
+            if (blocks[i].exit == Exit::Jump || blocks[i].exit == Exit::Branch) {
+                refs[blocks[i].target]++;
+            }
+        }
+        const auto referenced = [&](const Block& block) {
+            return is_external(block) || std::ranges::any_of(block.labels, [&](const std::string& label) {
+                return refs.contains(label);
+            });
+        };
+
+        // jcc A; jmp B; A:  ->  jncc B; A:
+        std::vector<size_t> kept;
+        for (size_t k = 0; k < order.size(); k++) {
+            Block& a = blocks[order[k]];
+            if (a.exit == Exit::Branch && k + 2 < order.size()) {
+                Block& b = blocks[order[k + 1]];
+                const std::string op = inverted(a.op);
+                if (!op.empty() && b.exit == Exit::Jump && !b.has_code && !referenced(b) &&
+                        target_of(a) == order[k + 2]) {
+                    refs[a.target]--;
+                    a.op = op;
+                    a.target = b.target;
+                    kept.push_back(order[k]);
+                    k++;
+                    continue;
+                }
+            }
+            kept.push_back(order[k]);
+        }
+
+        std::string out;
+        std::string line_directive;
+        for (size_t k = 0; k < kept.size(); k++) {
+            const Block& block = blocks[kept[k]];
+            const size_t following = k + 1 < kept.size() ? kept[k + 1] : n;
+            if (loop_header[kept[k]]) {
+                out += "align 16\n";
+            }
+            for (const std::string& label : block.labels) {
+                if (kept[k] == 0 || m_external.contains(label) || refs[label] > 0) {
+                    out += label + ":\n";
+                }
+            }
+            const auto first_line = std::ranges::find_if(block.lines, [](const std::string& line) {
+                return !is_comment(line) || is_line_directive(line);
+            });
+            const bool sets_line = first_line != block.lines.end() && is_line_directive(*first_line);
+            if (block.line_directive != line_directive && !block.line_directive.empty() && !sets_line) {
+                out += block.line_directive + "\n";
+                line_directive = block.line_directive;
+            }
+            for (const std::string& line : block.lines) {
+                out += line + "\n";
+                if (is_line_directive(line)) {
+                    line_directive = line;
+                }
+            }
+            if ((block.exit == Exit::Jump || block.exit == Exit::Branch) && target_of(block) != following) {
+                out += "   " + block.op + " " + block.target + "\n";
+            }
+        }
+        return out;
+    }
+
+    std::string_view m_text;
+    std::string_view m_data;
+    std::unordered_set<std::string> m_external{};
+    std::string m_line_directive{};
+};
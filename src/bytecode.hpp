@@ -0,0 +1,726 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "parser.hpp"
+#include "callgraph.hpp"
+#include "switch_lowering.hpp"
+#include "type_check.hpp"
+
+// Register based bytecode lowered straight from NodeProg. Every variable owns a
+// register for its whole lifetime, temporaries live above the variables of the
+// innermost scope and are released as soon as the expression is done.
+enum class OpCode : uint8_t {
+    LoadImm,            // r[a] = imm
+    Move,               // r[a] = r[b]
+    Narrow,             // r[a] = r[b] converted to IntType(imm)
+    Add,                // r[a] = r[b] + r[c]
+    Sub,                // r[a] = r[b] - r[c]
+    Mul,                // r[a] = r[b] * r[c]
+    Div,                // r[a] = r[b] / r[c]
+    DivU,               // r[a] = r[b] / r[c] as u64
+    Equal,              // r[a] = r[b] == r[c]
+    AddImm,             // r[a] = r[b] + imm   (load-add-store)
+    SubImm,             // r[a] = r[b] - imm
+    MulImm,             // r[a] = r[b] * imm
+    EqualImm,           // r[a] = r[b] == imm
+    Jump,               // pc = imm
+    JumpIfZero,         // if (r[a] == 0) pc = imm
+    JumpIfNotEqual,     // if (r[a] != r[b]) pc = imm   (compare-and-branch)
+    JumpIfNotEqualImm,  // if (r[a] != c) pc = imm, c is an index into the constant pool
+    JumpIfNotLess,      // if (r[a] >= r[b]) pc = imm
+    Exit,               // exit(r[a])
+    Call,               // r[a] = functions[imm](r[b], ..., r[b + c - 1])
+    TailCall,           // replace the current frame with functions[imm](r[b], ..., r[b + c - 1])
+    Ret,                // return r[a] to the caller
+    Switch,             // pc = switch_tables[imm].target(r[a])
+    Print,              // print(r[a]), as a u64 when b != 0
+    Alloc,              // r[a] = alloc(r[b])
+    Reset,              // release every alloc
+    Load,               // r[a] = qword at r[b] + r[c] * 8
+    Store,              // qword at r[a] + r[b] * 8 = r[c]
+    Count
+};
+
+inline const char* opcodeToString(const OpCode op) {
+    switch (op) {
+        case OpCode::LoadImm: return "load_imm";
+        case OpCode::Move: return "move";
+        case OpCode::Narrow: return "narrow";
+        case OpCode::Add: return "add";
+        case OpCode::Sub: return "sub";
+        case OpCode::Mul: return "mul";
+        case OpCode::Div: return "div";
+        case OpCode::DivU: return "div_u";
+        case OpCode::Equal: return "equal";
+        case OpCode::AddImm: return "add_imm";
+        case OpCode::SubImm: return "sub_imm";
+        case OpCode::MulImm: return "mul_imm";
+        case OpCode::EqualImm: return "equal_imm";
+        case OpCode::Jump: return "jump";
+        case OpCode::JumpIfZero: return "jump_if_zero";
+        case OpCode::JumpIfNotEqual: return "jump_if_not_equal";
+        case OpCode::JumpIfNotEqualImm: return "jump_if_not_equal_imm";
+        case OpCode::JumpIfNotLess: return "jump_if_not_less";
+        case OpCode::Exit: return "exit";
+        case OpCode::Call: return "call";
+        case OpCode::TailCall: return "tail_call";
+        case OpCode::Ret: return "ret";
+        case OpCode::Switch: return "switch";
+        case OpCode::Print: return "print";
+        case OpCode::Alloc: return "alloc";
+        case OpCode::Reset: return "reset";
+        case OpCode::Load: return "load";
+        case OpCode::Store: return "store";
+        default: return "?";
+    }
+}
+
+struct Instr {
+    OpCode op;
+    uint16_t a = 0;
+    uint16_t b = 0;
+    uint16_t c = 0;
+    int64_t imm = 0;
+};
+
+// parameters arrive in registers 0 .. num_params - 1 of a fresh frame
+struct BytecodeFunction {
+    std::string name;
+    size_t entry = 0;
+    size_t num_regs = 0;
+    size_t num_params = 0;
+};
+
+// Dispatch data of one switch, laid out the way plan_switch chose for the
+// native code: either a dense table indexed by value - min, or sorted keys
+// searched by bisection.
+struct SwitchTable {
+    int64_t min = 0;
+    std::vector<size_t> dense{};
+    std::vector<int64_t> keys{};
+    std::vector<size_t> targets{};
+    size_t default_target = 0;
+
+    [[nodiscard]] size_t target(const int64_t value) const {
+        if (!dense.empty()) {
+            const uint64_t index = static_cast<uint64_t>(value) - static_cast<uint64_t>(min);
+            return index < dense.size() ? dense[index] : default_target;
+        }
+        const auto it = std::ranges::lower_bound(keys, value);
+        return it != keys.end() && *it == value ? targets[static_cast<size_t>(it - keys.begin())] : default_target;
+    }
+};
+
+struct BytecodeProgram {
+    std::vector<Instr> code;
+    std::vector<int64_t> constants;
+    std::vector<SwitchTable> switch_tables;
+    std::vector<BytecodeFunction> functions;
+    size_t num_regs = 0;
+};
+
+class BytecodeCompiler {
+public:
+    explicit BytecodeCompiler(const NodeProg& prog) : m_prog(prog), m_call_graph(prog) {}
+
+    [[nodiscard]] BytecodeProgram compile() {
+        TypeChecker().check_program(m_prog);
+        for (const std::string& name : m_call_graph.order()) {
+            m_func_index.emplace(name, m_program.functions.size());
+            m_program.functions.push_back({ .name = name });
+        }
+
+        for (const NodeStmt* stmt : m_prog.stmts) {
+            compile_stmt(stmt);
+        }
+        const uint16_t zero = alloc_temp();
+        emit({ .op = OpCode::LoadImm, .a = zero, .imm = 0 });
+        emit({ .op = OpCode::Exit, .a = zero });
+        free_temp(zero);
+        m_program.num_regs = m_max_regs;
+
+        for (BytecodeFunction& function : m_program.functions) {
+            compile_func(m_call_graph.find(function.name)->func, function);
+        }
+        return std::move(m_program);
+    }
+
+private:
+    struct Var {
+        std::string name;
+        uint16_t reg;
+        IntType type = IntType::I64;
+    };
+
+    static constexpr size_t max_regs = UINT16_MAX;
+
+    size_t emit(const Instr& instr) {
+        m_program.code.push_back(instr);
+        return m_program.code.size() - 1;
+    }
+
+    [[nodiscard]] size_t here() const {
+        return m_program.code.size();
+    }
+
+    void patch(const size_t at, const size_t target) {
+        m_program.code[at].imm = static_cast<int64_t>(target);
+    }
+
+    uint16_t alloc_temp() {
+        if (m_next_reg >= max_regs) {
+            std::cerr << "Too many live values for the interpreter" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        const auto reg = static_cast<uint16_t>(m_next_reg++);
+        m_max_regs = std::max(m_max_regs, m_next_reg);
+        return reg;
+    }
+
+    void free_temp(const uint16_t reg) {
+        // temporaries are released in stack order, variables are never freed here
+        if (is_temp(reg) && reg + 1u == m_next_reg) {
+            m_next_reg--;
+        }
+    }
+
+    const Var& var_of(const Token& ident) const {
+        const auto it = std::ranges::find_if(m_vars, [&](const Var& var) {
+            return var.name == ident.value;
+        });
+        if (it == m_vars.cend()) {
+            std::cerr << "Undeclared identifier: " << ident.value.value() << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        return *it;
+    }
+
+    uint16_t lookup(const Token& ident) const {
+        return var_of(ident).reg;
+    }
+
+    // the expression inside any parentheses around `expr`
+    static const NodeExpr* strip_parens(const NodeExpr* expr) {
+        while (const auto term = std::get_if<NodeTerm*>(&expr->var)) {
+            const auto paren = std::get_if<NodeTermParen*>(&(*term)->var);
+            if (paren == nullptr) {
+                break;
+            }
+            expr = (*paren)->expr;
+        }
+        return expr;
+    }
+
+    static std::optional<int64_t> as_int_lit(const NodeExpr* expr) {
+        if (const auto term = std::get_if<NodeTerm*>(&strip_parens(expr)->var)) {
+            if (const auto lit = std::get_if<NodeTermInt*>(&(*term)->var)) {
+                try {
+                    return static_cast<int64_t>(std::stoull((*lit)->int_lit.value.value()));
+                } catch (const std::out_of_range&) {
+                    std::cerr << "Integer literal out of range: " << (*lit)->int_lit.value.value() << std::endl;
+                    exit(EXIT_FAILURE);
+                }
+            }
+        }
+        return {};
+    }
+
+    static std::optional<const NodeTermIdent*> as_ident(const NodeExpr* expr) {
+        if (const auto term = std::get_if<NodeTerm*>(&strip_parens(expr)->var)) {
+            if (const auto ident = std::get_if<NodeTermIdent*>(&(*term)->var)) {
+                return *ident;
+            }
+        }
+        return {};
+    }
+
+    // An expression being compiled. compile_expr keeps these on a stack instead
+    // of recursing, so nesting depth costs heap and not native stack.
+    struct ExprFrame {
+        const NodeExpr* expr;
+        std::optional<uint16_t> dst;
+        size_t stage = 0;               // operands started so far
+        OpCode op{};
+        IntType type{};
+        bool narrow_operands = false;   // of a 32-bit division or `==`
+        std::optional<int64_t> imm{};   // the literal operand of an immediate form
+        const NodeExpr* other{};        // the operand beside it
+        uint16_t reg = 0;               // the left operand, the first argument or the base of a subscript
+    };
+
+    // the operand a frame waits for
+    struct ExprOperand {
+        const NodeExpr* expr;
+        std::optional<uint16_t> dst;
+    };
+
+    // Evaluates `expr` and returns the register holding the result. Variables are
+    // returned in place; everything else lands in `dst` when one is given.
+    uint16_t compile_expr(const NodeExpr* expr, const std::optional<uint16_t> dst = {}) {
+        std::vector<ExprFrame> stack { { .expr = expr, .dst = dst } };
+        uint16_t result = 0; // of the frame finished last
+        while (!stack.empty()) {
+            if (const std::optional<ExprOperand> operand = step(stack.back(), result)) {
+                stack.push_back({ .expr = operand->expr, .dst = operand->dst });
+            }else {
+                stack.pop_back();
+            }
+        }
+        return result;
+    }
+
+    // Runs `frame` up to its next operand and returns it, or finishes the frame
+    // and leaves its register in `result`, which holds the operand's register
+    // when the frame resumes.
+    std::optional<ExprOperand> step(ExprFrame& frame, uint16_t& result) {
+        if (frame.stage == 0) {
+            frame.expr = strip_parens(frame.expr);
+            if (const auto ident = as_ident(frame.expr)) {
+                result = lookup(ident.value()->ident);
+                if (frame.dst.has_value() && frame.dst.value() != result) {
+                    emit({ .op = OpCode::Move, .a = frame.dst.value(), .b = result });
+                    result = frame.dst.value();
+                }
+                return {};
+            }
+            if (const auto lit = as_int_lit(frame.expr)) {
+                result = frame.dst.has_value() ? frame.dst.value() : alloc_temp();
+                emit({ .op = OpCode::LoadImm, .a = result, .imm = lit.value() });
+                return {};
+            }
+        }
+        if (const auto bin = std::get_if<NodeBinExpr*>(&frame.expr->var)) {
+            return step_bin(frame, *bin, result);
+        }
+        const NodeTerm* term = std::get<NodeTerm*>(frame.expr->var);
+        if (const auto alloc = std::get_if<NodeTermAlloc*>(&term->var)) {
+            if (frame.stage++ == 0) {
+                return ExprOperand { (*alloc)->count, {} };
+            }
+            const uint16_t count = result;
+            result = result_reg(frame.dst, count, {});
+            emit({ .op = OpCode::Alloc, .a = result, .b = count });
+            return {};
+        }
+        if (const auto index = std::get_if<NodeTermIndex*>(&term->var)) {
+            if (frame.stage++ == 0) {
+                frame.reg = lookup((*index)->ident);
+                return ExprOperand { (*index)->index, {} };
+            }
+            const uint16_t offset = result;
+            result = result_reg(frame.dst, offset, {});
+            emit({ .op = OpCode::Load, .a = result, .b = frame.reg, .c = offset });
+            return {};
+        }
+        // arguments right to left into consecutive registers, as compile_args
+        const NodeTermCall* call = std::get<NodeTermCall*>(term->var);
+        if (frame.stage == 0) {
+            frame.reg = static_cast<uint16_t>(m_next_reg);
+            for (size_t i = 0; i < call->args.size(); i++) {
+                alloc_temp();
+            }
+        }
+        if (frame.stage < call->args.size()) {
+            const size_t i = call->args.size() - ++frame.stage;
+            return ExprOperand { call->args[i], static_cast<uint16_t>(frame.reg + i) };
+        }
+        result = emit_call(call, frame.reg, frame.dst);
+        return {};
+    }
+
+    // Operations are done in 64 bits on the extended values. In i32 and u32
+    // the result is narrowed again and division and `==` narrow their operands
+    // first, which is what the 32-bit instructions of the native code do.
+    std::optional<ExprOperand> step_bin(ExprFrame& frame, const NodeBinExpr* bin, uint16_t& result) {
+        const auto [lhs, rhs] = std::visit([](const auto* op) { return std::pair(op->lhs, op->rhs); }, bin->var);
+        if (frame.stage == 0) {
+            frame.op = std::visit([](const auto* op) { return op_of(op); }, bin->var);
+            frame.type = common_type(lhs->type, rhs->type);
+            if (frame.op == OpCode::Div && !int_type_signed(frame.type)) {
+                frame.op = OpCode::DivU;
+            }
+            if (int_type_bytes(frame.type) == 4) {
+                frame.narrow_operands = frame.op == OpCode::Div || frame.op == OpCode::DivU || frame.op == OpCode::Equal;
+            }else if (imm_form(frame.op).has_value()) {
+                frame.imm = as_int_lit(rhs);
+                frame.other = lhs;
+                if (!frame.imm.has_value() && commutative(frame.op)) {
+                    frame.imm = as_int_lit(lhs);
+                    frame.other = rhs;
+                }
+            }
+            frame.stage++;
+            return ExprOperand { frame.imm.has_value() ? frame.other : lhs, {} };
+        }
+        if (frame.imm.has_value()) {
+            const uint16_t src = result;
+            result = result_reg(frame.dst, src, {});
+            emit({ .op = imm_form(frame.op).value(), .a = result, .b = src, .imm = frame.imm.value() });
+            return {};
+        }
+        if (frame.stage == 1) {
+            frame.reg = frame.narrow_operands ? narrow_operand(result, lhs, frame.type) : result;
+            frame.stage++;
+            return ExprOperand { rhs, {} };
+        }
+        const uint16_t l = frame.reg;
+        const uint16_t r = frame.narrow_operands ? narrow_operand(result, rhs, frame.type) : result;
+        result = result_reg(frame.dst, l, r);
+        emit({ .op = frame.op, .a = result, .b = l, .c = r });
+        if (int_type_bytes(frame.type) == 4 && frame.op != OpCode::Equal && frame.op != OpCode::DivU) {
+            narrow(result, result, IntType::I64, frame.type);
+        }
+        return {};
+    }
+
+    // Arguments are evaluated right to left into consecutive registers, the same
+    // order the native code uses.
+    uint16_t compile_args(const NodeTermCall* call) {
+        const auto first = static_cast<uint16_t>(m_next_reg);
+        for (size_t i = 0; i < call->args.size(); i++) {
+            alloc_temp();
+        }
+        for (size_t i = call->args.size(); i-- > 0;) {
+            compile_expr(call->args[i], static_cast<uint16_t>(first + i));
+        }
+        return first;
+    }
+
+    uint16_t compile_call(const NodeTermCall* call, const std::optional<uint16_t> dst) {
+        return emit_call(call, compile_args(call), dst);
+    }
+
+    // the arguments are in the registers from `first` on
+    uint16_t emit_call(const NodeTermCall* call, const uint16_t first, const std::optional<uint16_t> dst) {
+        m_next_reg = first; // the arguments are consumed by the call
+        const uint16_t reg = dst.has_value() ? dst.value() : alloc_temp();
+        emit({ .op = OpCode::Call, .a = reg, .b = first, .c = static_cast<uint16_t>(call->args.size()),
+               .imm = static_cast<int64_t>(m_func_index.at(call->ident.value.value())) });
+        return reg;
+    }
+
+    void compile_func(const NodeStmtFunc* func, BytecodeFunction& function) {
+        function.entry = here();
+        function.num_params = func->params.size();
+        m_vars.clear();
+        m_next_reg = 0;
+        m_max_regs = 0;
+        for (size_t i = 0; i < func->params.size(); i++) {
+            declare(func->params[i]);
+            const uint16_t reg = alloc_temp();
+            m_vars.push_back({ .name = func->params[i].value.value(), .reg = reg, .type = func->param_types[i] });
+            // the caller passes whole registers
+            narrow(reg, reg, IntType::I64, func->param_types[i]);
+        }
+        m_ret = func->ret;
+        m_in_func = true;
+        compile_scope(func->body);
+        m_in_func = false;
+
+        const uint16_t zero = alloc_temp();
+        emit({ .op = OpCode::LoadImm, .a = zero, .imm = 0 });
+        emit({ .op = OpCode::Ret, .a = zero });
+        function.num_regs = m_max_regs;
+    }
+
+    void declare(const Token& ident) const {
+        if (std::ranges::find_if(m_vars, [&](const Var& var) {
+                return var.name == ident.value; }) != m_vars.cend()) {
+            std::cerr << "Identifier already used: " << ident.value.value() << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // r[dst] = r[src] stored as a `to`, nothing when `from` always fits
+    void narrow(const uint16_t dst, const uint16_t src, const IntType from, const IntType to) {
+        if (needs_narrowing(from, to)) {
+            emit({ .op = OpCode::Narrow, .a = dst, .b = src, .imm = static_cast<int64_t>(to) });
+        }else if (dst != src) {
+            emit({ .op = OpCode::Move, .a = dst, .b = src });
+        }
+    }
+
+    // `reg` holds `expr` as an operand of an operation in `type`: narrowed in
+    // place when it is a temporary, else into a fresh one
+    uint16_t narrow_operand(const uint16_t reg, const NodeExpr* expr, const IntType type) {
+        if (!needs_narrowing(expr->type, type)) {
+            return reg;
+        }
+        const uint16_t dst = is_temp(reg) ? reg : alloc_temp();
+        narrow(dst, reg, expr->type, type);
+        return dst;
+    }
+
+    static OpCode op_of(const NodeBinExprAdd*) { return OpCode::Add; }
+    static OpCode op_of(const NodeBinExprSub*) { return OpCode::Sub; }
+    static OpCode op_of(const NodeBinExprMulti*) { return OpCode::Mul; }
+    static OpCode op_of(const NodeBinExprDiv*) { return OpCode::Div; }
+    static OpCode op_of(const NodeBinExprEqual*) { return OpCode::Equal; }
+
+    static std::optional<OpCode> imm_form(const OpCode op) {
+        switch (op) {
+            case OpCode::Add: return OpCode::AddImm;
+            case OpCode::Sub: return OpCode::SubImm;
+            case OpCode::Mul: return OpCode::MulImm;
+            case OpCode::Equal: return OpCode::EqualImm;
+            default: return {};
+        }
+    }
+
+    static bool commutative(const OpCode op) {
+        return op == OpCode::Add || op == OpCode::Mul || op == OpCode::Equal;
+    }
+
+    [[nodiscard]] bool is_temp(const uint16_t reg) const {
+        return reg >= m_vars.size();
+    }
+
+    // Picks the result register of an operation: the requested destination, else
+    // the lowest operand temporary (operands are read before the result is
+    // written), else a fresh temporary. Operand temporaries above it are freed.
+    uint16_t result_reg(const std::optional<uint16_t> dst, const uint16_t l, const std::optional<uint16_t> r) {
+        std::optional<uint16_t> reg = dst;
+        if (!reg.has_value() && is_temp(l)) {
+            reg = l;
+        }else if (!reg.has_value() && r.has_value() && is_temp(r.value())) {
+            reg = r;
+        }
+        if (r.has_value() && r != reg) {
+            free_temp(r.value());
+        }
+        if (l != reg) {
+            free_temp(l);
+        }
+        return reg.has_value() ? reg.value() : alloc_temp();
+    }
+
+    // Emits a conditional jump taken when `cond` is false and returns its index.
+    size_t compile_branch_if_false(const NodeExpr* cond) {
+        if (const auto bin = std::get_if<NodeBinExpr*>(&cond->var)) {
+            const auto eq = std::get_if<NodeBinExprEqual*>(&(*bin)->var);
+            if (eq != nullptr && int_type_bytes(common_type((*eq)->lhs->type, (*eq)->rhs->type)) == 8) {
+                std::optional<int64_t> imm = as_int_lit((*eq)->rhs);
+                const NodeExpr* other = (*eq)->lhs;
+                if (!imm.has_value()) {
+                    imm = as_int_lit((*eq)->lhs);
+                    other = (*eq)->rhs;
+                }
+                if (imm.has_value() && m_program.constants.size() < max_regs) {
+                    const uint16_t src = compile_expr(other);
+                    m_program.constants.push_back(imm.value());
+                    const auto index = static_cast<uint16_t>(m_program.constants.size() - 1);
+                    const size_t at = emit({ .op = OpCode::JumpIfNotEqualImm, .a = src, .c = index });
+                    free_temp(src);
+                    return at;
+                }
+                const uint16_t l = compile_expr((*eq)->lhs);
+                const uint16_t r = compile_expr((*eq)->rhs);
+                const size_t at = emit({ .op = OpCode::JumpIfNotEqual, .a = l, .b = r });
+                free_temp(r);
+                free_temp(l);
+                return at;
+            }
+        }
+        const uint16_t reg = compile_expr(cond);
+        const size_t at = emit({ .op = OpCode::JumpIfZero, .a = reg });
+        free_temp(reg);
+        return at;
+    }
+
+    void compile_scope(const NodeScope* scope) {
+        const size_t var_count = m_vars.size();
+        for (const NodeStmt* stmt : scope->stmts) {
+            compile_stmt(stmt);
+        }
+        m_vars.resize(var_count);
+        m_next_reg = var_count;
+    }
+
+    void compile_if_pred(const NodeIfPred* pred, std::vector<size_t>& end_jumps) {
+        if (const auto elif = std::get_if<NodeIfPredElif*>(&pred->var)) {
+            const size_t skip = compile_branch_if_false((*elif)->expr);
+            compile_scope((*elif)->scope);
+            if ((*elif)->pred.has_value()) {
+                end_jumps.push_back(emit({ .op = OpCode::Jump }));
+                patch(skip, here());
+                compile_if_pred((*elif)->pred.value(), end_jumps);
+            }else {
+                patch(skip, here());
+            }
+            return;
+        }
+        compile_scope(std::get<NodeIfPredElse*>(pred->var)->scope);
+    }
+
+    void compile_stmt(const NodeStmt* stmt) {
+        struct StmtVisitor {
+            BytecodeCompiler& comp;
+
+            void operator()(const NodeStmtReturn* stmt_return) const {
+                if (comp.m_in_func && !needs_narrowing(stmt_return->expr->type, comp.m_ret)) {
+                    if (const auto term = std::get_if<NodeTerm*>(&stmt_return->expr->var)) {
+                        if (const auto call = std::get_if<NodeTermCall*>(&(*term)->var)) {
+                            const uint16_t first = comp.compile_args(*call);
+                            comp.emit({ .op = OpCode::TailCall, .b = first, .c = static_cast<uint16_t>((*call)->args.size()),
+                                        .imm = static_cast<int64_t>(comp.m_func_index.at((*call)->ident.value.value())) });
+                            comp.m_next_reg = first;
+                            return;
+                        }
+                    }
+                }
+                uint16_t reg = comp.compile_expr(stmt_return->expr);
+                if (comp.m_in_func && needs_narrowing(stmt_return->expr->type, comp.m_ret)) {
+                    const uint16_t src = reg;
+                    reg = comp.is_temp(src) ? src : comp.alloc_temp();
+                    comp.narrow(reg, src, stmt_return->expr->type, comp.m_ret);
+                }
+                comp.emit({ .op = comp.m_in_func ? OpCode::Ret : OpCode::Exit, .a = reg });
+                comp.free_temp(reg);
+            }
+
+            void operator()(const NodeStmtStore* stmt_store) const {
+                const uint16_t base = comp.lookup(stmt_store->ident);
+                const uint16_t offset = comp.compile_expr(stmt_store->index);
+                const uint16_t value = comp.compile_expr(stmt_store->expr);
+                comp.emit({ .op = OpCode::Store, .a = base, .b = offset, .c = value });
+                comp.free_temp(value);
+                comp.free_temp(offset);
+            }
+
+            void operator()(const NodeStmtReset*) const {
+                comp.emit({ .op = OpCode::Reset });
+            }
+
+            void operator()(const NodeStmtPrint* stmt_print) const {
+                const uint16_t reg = comp.compile_expr(stmt_print->expr);
+                comp.emit({ .op = OpCode::Print, .a = reg, .b = stmt_print->expr->type == IntType::U64 });
+                comp.free_temp(reg);
+            }
+
+            void operator()(const NodeStmtCall* stmt_call) const {
+                const uint16_t reg = comp.compile_call(stmt_call->call, {});
+                comp.free_temp(reg);
+            }
+
+            void operator()(const NodeStmtFunc*) const {
+                // compiled separately after the top-level code
+            }
+
+            void operator()(const NodeStmtInt* stmt_int) const {
+                comp.declare(stmt_int->ident);
+                const uint16_t reg = comp.alloc_temp();
+                if (stmt_int->expr != nullptr) {
+                    comp.compile_expr(stmt_int->expr, reg);
+                    comp.narrow(reg, reg, stmt_int->expr->type, stmt_int->type);
+                }else {
+                    comp.emit({ .op = OpCode::LoadImm, .a = reg, .imm = 0 });
+                }
+                comp.m_vars.push_back({ .name = stmt_int->ident.value.value(), .reg = reg, .type = stmt_int->type });
+            }
+
+            void operator()(const NodeStmtAssign* stmt_assign) const {
+                const Var& var = comp.var_of(stmt_assign->ident);
+                comp.compile_expr(stmt_assign->expr, var.reg);
+                comp.narrow(var.reg, var.reg, stmt_assign->expr->type, var.type);
+            }
+
+            void operator()(const NodeScope* scope) const {
+                comp.compile_scope(scope);
+            }
+
+            // The interpreter runs the iterations in order. That matches the
+            // threaded native loop unless iterations store to memory another
+            // one reads or stores, where the native result is unspecified.
+            void operator()(const NodeStmtParallelFor* loop) const {
+                comp.declare(loop->ident);
+                const size_t var_count = comp.m_vars.size();
+                const uint16_t index = comp.alloc_temp();
+                comp.compile_expr(loop->lo, index);
+                const uint16_t end = comp.alloc_temp();
+                comp.compile_expr(loop->hi, end);
+                comp.m_vars.push_back({ .name = loop->ident.value.value(), .reg = index });
+                comp.m_vars.push_back({ .name = "", .reg = end }); // keeps the bound out of the temporaries
+
+                const size_t head = comp.here();
+                const size_t done = comp.emit({ .op = OpCode::JumpIfNotLess, .a = index, .b = end });
+                comp.compile_scope(loop->body);
+                comp.emit({ .op = OpCode::AddImm, .a = index, .b = index, .imm = 1 });
+                comp.emit({ .op = OpCode::Jump, .imm = static_cast<int64_t>(head) });
+                comp.patch(done, comp.here());
+                comp.m_vars.resize(var_count);
+                comp.m_next_reg = var_count;
+            }
+
+            void operator()(const NodeStmtSwitch* stmt_switch) const {
+                const SwitchPlan plan = plan_switch(stmt_switch);
+                const uint16_t reg = comp.compile_expr(stmt_switch->expr);
+                const size_t index = comp.m_program.switch_tables.size();
+                comp.m_program.switch_tables.emplace_back();
+                comp.emit({ .op = OpCode::Switch, .a = reg, .imm = static_cast<int64_t>(index) });
+                comp.free_temp(reg);
+
+                std::unordered_map<const NodeSwitchCase*, size_t> targets;
+                std::vector<size_t> end_jumps;
+                for (const NodeSwitchCase& c : stmt_switch->cases) {
+                    targets.emplace(&c, comp.here());
+                    comp.compile_scope(c.scope);
+                    end_jumps.push_back(comp.emit({ .op = OpCode::Jump }));
+                }
+                SwitchTable table { .default_target = comp.here() };
+                if (stmt_switch->default_scope != nullptr) {
+                    comp.compile_scope(stmt_switch->default_scope);
+                }
+                for (const size_t at : end_jumps) {
+                    comp.patch(at, comp.here());
+                }
+
+                if (plan.table) {
+                    table.min = plan.min;
+                    table.dense.assign(plan.entries, table.default_target);
+                    for (const NodeSwitchCase* c : plan.cases) {
+                        table.dense[static_cast<uint64_t>(c->value) - static_cast<uint64_t>(plan.min)] = targets.at(c);
+                    }
+                }else {
+                    for (const NodeSwitchCase* c : plan.cases) {
+                        table.keys.push_back(c->value);
+                        table.targets.push_back(targets.at(c));
+                    }
+                }
+                comp.m_program.switch_tables[index] = std::move(table);
+            }
+
+            void operator()(const NodeStmtIf* stmt_if) const {
+                const size_t skip = comp.compile_branch_if_false(stmt_if->expr);
+                comp.compile_scope(stmt_if->scope);
+                if (!stmt_if->pred.has_value()) {
+                    comp.patch(skip, comp.here());
+                    return;
+                }
+                std::vector<size_t> end_jumps { comp.emit({ .op = OpCode::Jump }) };
+                comp.patch(skip, comp.here());
+                comp.compile_if_pred(stmt_if->pred.value(), end_jumps);
+                for (const size_t at : end_jumps) {
+                    comp.patch(at, comp.here());
+                }
+            }
+        };
+        StmtVisitor visitor { .comp = *this };
+        std::visit(visitor, stmt->var);
+    }
+
+    const NodeProg& m_prog;
+    const CallGraph m_call_graph;
+    std::unordered_map<std::string, size_t> m_func_index{};
+    bool m_in_func = false;
+    IntType m_ret = IntType::I64;   // of the function being compiled
+    BytecodeProgram m_program;
+    std::vector<Var> m_vars{};
+    size_t m_next_reg = 0;
+    size_t m_max_regs = 0;
+};
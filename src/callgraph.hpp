@@ -0,0 +1,303 @@
+#pragma once
+
+#include <iostream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "parser.hpp"
+
+struct FuncInfo {
+    const NodeStmtFunc* func;
+    std::vector<std::string> callees{};  // one entry per call site in the body
+    size_t call_sites = 0;               // call sites anywhere in the program
+    size_t size = 0;                     // AST nodes in the body, a proxy for emitted code
+    bool recursive = false;              // reaches itself through the call graph
+    std::string_view single_threaded{};  // first print, alloc, reset or parallel for in the body
+};
+
+// Static call graph of a NodeProg. Top-level statements act as the root caller.
+// The runtime behind print, alloc, reset and parallel for is single threaded:
+// ParallelForCheck keeps them out of a parallel for body, and the graph rejects
+// a body that reaches a function using one of them.
+class CallGraph {
+public:
+    explicit CallGraph(const NodeProg& prog) {
+        for (const NodeStmt* stmt : prog.stmts) {
+            if (const auto func = std::get_if<NodeStmtFunc*>(&stmt->var)) {
+                define(*func);
+            }
+        }
+        for (const NodeStmt* stmt : prog.stmts) {
+            walk(stmt);
+        }
+        for (const std::string& name : m_order) {
+            std::unordered_set<std::string> seen;
+            m_funcs.at(name).recursive = reaches(name, name, seen);
+        }
+        check_parallel_loops();
+    }
+
+    // Streamed form for callers that hand over one top-level statement at a
+    // time: a call may name a function defined later, so calls are not checked
+    // here (Generator::finish_prog does) and no AST pointer is kept. Call
+    // check_parallel_loops once every statement is in.
+    CallGraph() : m_streamed(true) {}
+
+    void add(const NodeStmt* stmt) {
+        if (const auto func = std::get_if<NodeStmtFunc*>(&stmt->var)) {
+            define(*func);
+        }
+        walk(stmt);
+    }
+
+    void check_parallel_loops() const {
+        for (const ParallelLoop& loop : m_loops) {
+            std::unordered_set<std::string> seen;
+            for (const std::string& callee : loop.callees) {
+                if (const std::string* name = single_threaded_from(callee, seen)) {
+                    std::cerr << "Function " << *name << " reached from the parallel for on line " << loop.line
+                              << " uses " << m_funcs.at(*name).single_threaded << std::endl;
+                    exit(EXIT_FAILURE);
+                }
+            }
+        }
+    }
+
+    [[nodiscard]] const FuncInfo* find(const std::string& name) const {
+        const auto it = m_funcs.find(name);
+        return it == m_funcs.end() ? nullptr : &it->second;
+    }
+
+    // function names in definition order
+    [[nodiscard]] const std::vector<std::string>& order() const {
+        return m_order;
+    }
+
+private:
+    struct ParallelLoop {
+        int line;
+        std::vector<std::string> callees{}; // one entry per call site in the body
+    };
+
+    struct Walker {
+        CallGraph& graph;
+        FuncInfo* info;                  // of the function walked, null at top level
+        std::optional<size_t> loop{};    // into m_loops while in a parallel for body
+        int line = 0;
+        size_t size = 0;
+
+        void use(const std::string_view op) const {
+            if (info != nullptr && info->single_threaded.empty()) {
+                info->single_threaded = op;
+            }
+        }
+
+        void expr(const NodeExpr* root) {
+            walk_expr(root, [&](const NodeExpr* expr, const size_t done, size_t) {
+                if (done != 0) {
+                    return;
+                }
+                size++;
+                if (const auto term = std::get_if<NodeTerm*>(&expr->var)) {
+                    if (const auto call = std::get_if<NodeTermCall*>(&(*term)->var)) {
+                        call_site(*call);
+                    }else if (std::holds_alternative<NodeTermAlloc*>((*term)->var)) {
+                        use("alloc");
+                        size++;
+                    }
+                }
+            });
+        }
+
+        // the call itself, not its arguments
+        void call_site(const NodeTermCall* call) {
+            const std::string& name = call->ident.value.value();
+            if (!graph.m_streamed) {
+                const auto it = graph.m_funcs.find(name);
+                if (it == graph.m_funcs.end()) {
+                    std::cerr << "Undefined function: " << name << std::endl;
+                    exit(EXIT_FAILURE);
+                }
+                if (it->second.func->params.size() != call->args.size()) {
+                    std::cerr << "Function " << name << " expects " << it->second.func->params.size()
+                              << " arguments, got " << call->args.size() << std::endl;
+                    exit(EXIT_FAILURE);
+                }
+                it->second.call_sites++;
+            }
+            if (info != nullptr) {
+                info->callees.push_back(name);
+            }
+            if (loop.has_value()) {
+                graph.m_loops[loop.value()].callees.push_back(name);
+            }
+            size += 2; // argument setup and the call itself
+        }
+
+        void call(const NodeTermCall* call) {
+            call_site(call);
+            for (const NodeExpr* arg : call->args) {
+                expr(arg);
+            }
+        }
+
+        void scope(const NodeScope* scope) {
+            for (const NodeStmt* stmt : scope->stmts) {
+                this->stmt(stmt);
+            }
+        }
+
+        void if_pred(const NodeIfPred* pred) {
+            if (const auto elif = std::get_if<NodeIfPredElif*>(&pred->var)) {
+                expr((*elif)->expr);
+                scope((*elif)->scope);
+                if ((*elif)->pred.has_value()) {
+                    if_pred((*elif)->pred.value());
+                }
+                return;
+            }
+            scope(std::get<NodeIfPredElse*>(pred->var)->scope);
+        }
+
+        void stmt(const NodeStmt* stmt) {
+            size++;
+            line = stmt->line;
+            struct StmtVisitor {
+                Walker& walker;
+                void operator()(const NodeStmtInt* stmt_int) const {
+                    if (stmt_int->expr != nullptr) {
+                        walker.expr(stmt_int->expr);
+                    }
+                }
+                void operator()(const NodeScope* scope) const { walker.scope(scope); }
+                void operator()(const NodeStmtIf* stmt_if) const {
+                    walker.expr(stmt_if->expr);
+                    walker.scope(stmt_if->scope);
+                    if (stmt_if->pred.has_value()) {
+                        walker.if_pred(stmt_if->pred.value());
+                    }
+                }
+                void operator()(const NodeStmtAssign* stmt_assign) const { walker.expr(stmt_assign->expr); }
+                void operator()(const NodeStmtReturn* stmt_return) const { walker.expr(stmt_return->expr); }
+                void operator()(const NodeStmtCall* stmt_call) const { walker.call(stmt_call->call); }
+                void operator()(const NodeStmtStore* stmt_store) const {
+                    walker.expr(stmt_store->index);
+                    walker.expr(stmt_store->expr);
+                }
+                void operator()(const NodeStmtReset*) const { walker.use("reset"); }
+                void operator()(const NodeStmtPrint* stmt_print) const {
+                    walker.use("print");
+                    walker.size++; // the runtime call
+                    walker.expr(stmt_print->expr);
+                }
+                void operator()(const NodeStmtFunc* func) const { walker.scope(func->body); }
+                void operator()(const NodeStmtParallelFor* loop) const {
+                    walker.use("parallel for");
+                    walker.size += 4; // the runtime call and the loop control
+                    walker.expr(loop->lo);
+                    walker.expr(loop->hi);
+                    walker.graph.m_loops.push_back({ .line = walker.line });
+                    walker.loop = walker.graph.m_loops.size() - 1;
+                    walker.scope(loop->body);
+                    walker.loop.reset();
+                }
+                void operator()(const NodeStmtSwitch* stmt_switch) const {
+                    walker.expr(stmt_switch->expr);
+                    for (const NodeSwitchCase& c : stmt_switch->cases) {
+                        walker.size++; // one compare or table entry
+                        walker.scope(c.scope);
+                    }
+                    if (stmt_switch->default_scope != nullptr) {
+                        walker.scope(stmt_switch->default_scope);
+                    }
+                }
+            };
+            std::visit(StmtVisitor { .walker = *this }, stmt->var);
+        }
+    };
+
+    void define(const NodeStmtFunc* func) {
+        const std::string& name = func->ident.value.value();
+        if (m_funcs.contains(name)) {
+            std::cerr << "Function already defined: " << name << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        m_funcs.emplace(name, FuncInfo { .func = m_streamed ? nullptr : func });
+        m_order.push_back(name);
+    }
+
+    void walk(const NodeStmt* stmt) {
+        if (const auto func = std::get_if<NodeStmtFunc*>(&stmt->var)) {
+            FuncInfo& info = m_funcs.at((*func)->ident.value.value());
+            Walker walker { .graph = *this, .info = &info };
+            walker.stmt(stmt);
+            info.size = walker.size;
+        }else {
+            Walker walker { .graph = *this, .info = nullptr };
+            walker.stmt(stmt);
+        }
+    }
+
+    // the first function reachable from `name` whose body is single threaded
+    const std::string* single_threaded_from(const std::string& name, std::unordered_set<std::string>& seen) const {
+        const auto it = m_funcs.find(name);
+        if (it == m_funcs.end() || !seen.insert(name).second) {
+            return nullptr; // undefined ones are reported elsewhere
+        }
+        if (!it->second.single_threaded.empty()) {
+            return &it->first;
+        }
+        for (const std::string& callee : it->second.callees) {
+            if (const std::string* found = single_threaded_from(callee, seen)) {
+                return found;
+            }
+        }
+        return nullptr;
+    }
+
+    bool reaches(const std::string& from, const std::string& target, std::unordered_set<std::string>& seen) const {
+        for (const std::string& callee : m_funcs.at(from).callees) {
+            if (callee == target) {
+                return true;
+            }
+            if (seen.insert(callee).second && reaches(callee, target, seen)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::unordered_map<std::string, FuncInfo> m_funcs{};
+    std::vector<std::string> m_order{};
+    std::vector<ParallelLoop> m_loops{};
+    bool m_streamed = false;
+};
+
+// Size/benefit knobs for the inliner. A call costs roughly one instruction per
+// argument plus the call, frame setup and teardown, so helpers that are about
+// as big as that sequence always win; a function with a single call site never
+// grows the program, so it may be much larger.
+struct InlineHeuristic {
+    size_t always_inline_size = 24;
+    size_t single_site_size = 400;
+};
+
+// Functions whose every call site is expanded in place. Recursive functions are
+// never inlined, which also bounds the expansion depth.
+inline std::unordered_set<std::string> plan_inlining(const CallGraph& graph, const InlineHeuristic& heuristic = {}) {
+    std::unordered_set<std::string> inlined;
+    for (const std::string& name : graph.order()) {
+        const FuncInfo& info = *graph.find(name);
+        if (info.recursive || info.call_sites == 0) {
+            continue;
+        }
+        if (info.size <= heuristic.always_inline_size ||
+                (info.call_sites == 1 && info.size <= heuristic.single_site_size)) {
+            inlined.insert(name);
+        }
+    }
+    return inlined;
+}
@@ -1,12 +1,25 @@
 #pragma once
 
 #include <algorithm>
+#include <bit>
 #include <cassert>
+#include <cstdint>
 #include <vector>
 #include <sstream>
 #include <iostream>
+#include <memory>
 #include <ranges>
+#include <set>
+#include <span>
+#include <unordered_map>
+#include <unordered_set>
 #include "parser.hpp"
+#include "callgraph.hpp"
+#include "switch_lowering.hpp"
+#include "runtime.hpp"
+#include "block_layout.hpp"
+#include "type_check.hpp"
+#include "isel.hpp"
 
 class Generator {
 public:
@@ -15,84 +28,113 @@ public:
     {
     }
 
-    void gen_term(const NodeTerm* term)
+    // pushes a literal or a variable
+    void gen_leaf(const NodeTerm* term)
     {
-        struct TermVisitor {
-            Generator& gen;
-
-            void operator()(const NodeTermInt* term_int_lit) const{
-                gen.m_output << "   mov rax, " << term_int_lit->int_lit.value.value() << "\n";
-                gen.push("rax");
-            }
-
-            // Handles a variable identifier like 'x'
-            void operator()(const NodeTermIdent* term_ident) const{
-                const auto it = std::ranges::find_if(std::as_const(gen.m_vars), [&](const Var& var) {
-                    return var.name == term_ident->ident.value;
-                });
-
-                if (it == gen.m_vars.cend()) {
-                    std::cerr << "Undeclared identifier: " << term_ident->ident.value.value() << std::endl;
-                    exit(EXIT_FAILURE);
-                }
-                std::stringstream offset;
-                offset << "QWORD [rsp + " << (gen.m_stack_size - it->stack_loc - 1) * 8 << "]";
-                gen.push((offset.str()));
+        if (const auto term_int_lit = std::get_if<NodeTermInt*>(&term->var)) {
+            const uint64_t value = TypeChecker::literal_value((*term_int_lit)->int_lit);
+            if (value > INT64_MAX) { // a u64, spelled as the i64 with the same bits
+                m_output << "   mov rax, " << static_cast<int64_t>(value) << "\n";
+            }else {
+                m_output << "   mov rax, " << (*term_int_lit)->int_lit.value.value() << "\n";
             }
+            push("rax");
+            return;
+        }
+        // Handles a variable identifier like 'x'
+        const Token& ident = std::get<NodeTermIdent*>(term->var)->ident;
+        const auto it = find_var(ident);
 
-            void operator()(const NodeTermParen* term_paren) const{
-                gen.gen_expr(term_paren->expr);
-            }
-        };
-        TermVisitor visitor{ .gen = *this };
-        std::visit(visitor, term->var);
+        if (it == m_vars.cend()) {
+            std::cerr << "Undeclared identifier: " << ident.value.value() << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        if (int_type_bytes(it->type) == 8) {
+            push(slot_of(*it));
+        }else {
+            load("rax", it->type, slot_of(*it));
+            push("rax");
+        }
     }
 
-    // Handles binary expressions like `a + b`
+    // Handles binary expressions like `a + b` once both operands are pushed. The
+    // operation is carried out in the common type of the operands: i32 and u32
+    // use the 32-bit forms, whose results are already in range, and i32 sign
+    // extends its result again.
     void gen_bin_expr(const NodeBinExpr* bin_expr){
         struct BinExprVisitor {
             Generator& gen;
 
             void operator()(const NodeBinExprSub* sub) const{
-                gen.gen_expr(sub->lhs);
-                gen.gen_expr(sub->rhs); // sub : perform A = A - B
-                gen.pop("rax"); // LHS is on top
-                gen.pop("rbx"); // RHS is next
-                gen.m_output << "    sub rax, rbx\n"; // A = A - B
+                const IntType type = common_type(sub->lhs->type, sub->rhs->type);
+                gen.pop("rbx"); // RHS is on top
+                gen.pop("rax"); // LHS is next
+                if (int_type_bytes(type) == 4) {
+                    gen.m_output << "   sub eax, ebx\n";
+                }else {
+                    gen.m_output << "    sub rax, rbx\n"; // A = A - B
+                }
+                gen.extend_rax(type);
                 gen.push("rax");
             }
 
             void operator()(const NodeBinExprAdd* add) const{
-                gen.gen_expr(add->lhs); // sub : perform A = A + B
-                gen.gen_expr(add->rhs);
+                const IntType type = common_type(add->lhs->type, add->rhs->type);
                 gen.pop("rax"); // LHS is on top
                 gen.pop("rbx"); // RHS is next
-                gen.m_output << "   add rax, rbx\n"; // A = A + B
+                if (int_type_bytes(type) == 4) {
+                    gen.m_output << "   add eax, ebx\n";
+                }else {
+                    gen.m_output << "   add rax, rbx\n"; // A = A + B
+                }
+                gen.extend_rax(type);
                 gen.push("rax");
             }
 
             void operator()(const NodeBinExprMulti* multi) const{
-                gen.gen_expr(multi->lhs); // sub : perform A = A + B
-                gen.gen_expr(multi->rhs);
+                const IntType type = common_type(multi->lhs->type, multi->rhs->type);
                 gen.pop("rax"); // LHS is on top
                 gen.pop("rbx"); // RHS is next
-                gen.m_output << "   mul rbx\n";
+                if (int_type_bytes(type) == 4) {
+                    gen.m_output << "   imul eax, ebx\n";
+                }else {
+                    gen.m_output << "   mul rbx\n";
+                }
+                gen.extend_rax(type);
                 gen.push("rax");
             }
             void operator()(const NodeBinExprDiv* div) const{
-                gen.gen_expr(div->lhs);
-                gen.gen_expr(div->rhs);
-                gen.pop("rax"); // LHS is on top
-                gen.pop("rbx"); // RHS is next
-                gen.m_output << "   div rbx\n";
+                const IntType type = common_type(div->lhs->type, div->rhs->type);
+                gen.pop("rbx"); // RHS is on top
+                gen.pop("rax"); // LHS is next
+                switch (type) {
+                    case IntType::U32:
+                        gen.m_output << "   xor edx, edx\n";
+                        gen.m_output << "   div ebx\n";
+                        break;
+                    case IntType::U64:
+                        gen.m_output << "   xor edx, edx\n";
+                        gen.m_output << "   div rbx\n";
+                        break;
+                    default:
+                        // i32 operands are sign extended, so the 64-bit form
+                        // cannot trap on INT32_MIN / -1
+                        gen.m_output << "   cqo\n"; // sign-extend rax into rdx:rax
+                        gen.m_output << "   idiv rbx\n";
+                        gen.extend_rax(type);
+                        break;
+                }
                 gen.push("rax");
             }
             void operator()(const NodeBinExprEqual* equal) const{
-                gen.gen_expr(equal->lhs);
-                gen.gen_expr(equal->rhs);
+                const IntType type = common_type(equal->lhs->type, equal->rhs->type);
                 gen.pop("rbx"); // LHS is on top
                 gen.pop("rax"); // RHS is next
-                gen.m_output << "   cmp rax, rbx\n";  // compare lhs and rhs
+                if (int_type_bytes(type) == 4) {
+                    gen.m_output << "   cmp eax, ebx\n";
+                }else {
+                    gen.m_output << "   cmp rax, rbx\n";  // compare lhs and rhs
+                }
                 gen.m_output << "   sete al\n";   // set AL if equal
                 gen.m_output << "   movzx rax, al\n";// zero-extend to full register
                 gen.push("rax");  // push result (0 or 1)
@@ -102,20 +144,20 @@ public:
         std::visit(visitor, bin_expr->var);
     }
 
-    // Generic expression generation
+    // Generic expression generation, leaves the value on the stack
     void gen_expr(const NodeExpr* expr)
     {
-        struct ExprVisitor {
-            Generator& gen;
-            void operator()(const NodeTerm* term) const {
-                gen.gen_term(term);
-            }
-            void operator()(const NodeBinExpr* bin_expr) const {
-                gen.gen_bin_expr(bin_expr);
-            }
-        };
-        ExprVisitor visitor{ .gen = *this };
-        std::visit(visitor, expr->var);
+        gen_expr_to(expr, {});
+    }
+
+    // the value of `expr` in `reg` instead of on the stack
+    void gen_value(const NodeExpr* expr, const std::string& reg) {
+        gen_expr_to(expr, { .kind = ExprDest::Kind::Reg, .target = reg });
+    }
+
+    // jumps to `label` when `expr` is 0, straight off the flags for a covered `==`
+    void gen_branch_if_false(const NodeExpr* expr, const std::string& label) {
+        gen_expr_to(expr, { .kind = ExprDest::Kind::Branch, .target = label });
     }
 
     void gen_scope(const NodeScope* scope){
@@ -133,16 +175,14 @@ public:
 
             void operator() (const NodeIfPredElif* elif) const {
                 gen.m_output << "   ;; elif\n";
-                gen.gen_expr(elif->expr);
-                gen.pop("rax");
                 const std::string label = gen.create_label();
-                gen.m_output << "   test rax, rax\n";
-                gen.m_output << "   jz " << label << '\n';
+                gen.gen_branch_if_false(elif->expr, label);
                 gen.gen_scope(elif->scope);
                 gen.m_output << "   jmp " << end_label << "\n";
-                if (elif->pred.has_value()){}
                 gen.m_output << label << ":\n";
-                gen.gen_if_pred(elif->pred.value(), end_label);
+                if (elif->pred.has_value()) {
+                    gen.gen_if_pred(elif->pred.value(), end_label);
+                }
             }
 
             void operator() (const NodeIfPredElse* else_) const {
@@ -156,46 +196,105 @@ public:
     }
 
     void gen_stmt(const NodeStmt* stmt){
+        mark_line(stmt->line);
         struct StmtVisitor {
             Generator& gen;
 
             void operator()(const NodeStmtReturn* stmt_return) const {
+                const ReturnCtx ctx = gen.m_return_ctx.back(); // a copy, inlined calls in the value push more
+                if (ctx.kind == ReturnCtx::Func) {
+                    gen.m_output << "   ;; return\n";
+                    if (const auto call = gen.tail_call_of(stmt_return->expr)) {
+                        gen.gen_tail_call(call.value());
+                        return;
+                    }
+                    gen.gen_value(stmt_return->expr, "rax");
+                    gen.convert_rax(stmt_return->expr->type, ctx.type);
+                    gen.func_epilogue();
+                    gen.m_output << "   ret\n";
+                    return;
+                }
+                if (ctx.kind == ReturnCtx::Inline) {
+                    gen.m_output << "   ;; inline return\n";
+                    gen.gen_value(stmt_return->expr, "rax");
+                    gen.convert_rax(stmt_return->expr->type, ctx.type);
+                    if (gen.m_stack_size > ctx.base) {
+                        gen.m_output << "   add rsp, " << (gen.m_stack_size - ctx.base) * 8 << "\n";
+                    }
+                    gen.m_output << "   jmp " << ctx.label << "\n";
+                    return;
+                }
                 gen.m_output << "   ;; exit\n";
-                gen.gen_expr(stmt_return->expr);
-                gen.m_output << "   mov rax, 60\n";
-                gen.pop("rdi");
-                gen.m_output << "   syscall\n";
+                gen.gen_value(stmt_return->expr, "rdi");
+                gen.m_output << "   jmp hy_exit\n"; // flushes buffered output
                 gen.m_output << "    ;; /exit\n";
             }
 
+            void operator()(const NodeStmtStore* stmt_store) const {
+                gen.m_output << "   ; store " << stmt_store->ident.value.value() << "[]\n";
+                gen.gen_expr(stmt_store->index);
+                gen.gen_value(stmt_store->expr, "rax");
+                gen.pop("rcx");
+                const Var& base = gen.var_of(stmt_store->ident);
+                gen.load("rbx", base.type, gen.slot_of(base));
+                gen.m_output << "   mov [rbx + rcx * 8], rax\n";
+            }
+
+            void operator()(const NodeStmtReset*) const {
+                gen.call_runtime("hy_reset");
+            }
+
+            void operator()(const NodeStmtPrint* stmt_print) const {
+                gen.m_output << "   ; print\n";
+                gen.gen_value(stmt_print->expr, "rdi");
+                gen.call_runtime(stmt_print->expr->type == IntType::U64 ? "hy_print_u" : "hy_print");
+            }
+
+            void operator()(const NodeStmtCall* stmt_call) const {
+                gen.m_output << "   ; call " << stmt_call->call->ident.value.value() << "\n";
+                gen.gen_call_expr(stmt_call->call);
+                gen.pop("rax"); // discard the result
+            }
+
+            void operator()(const NodeStmtFunc* func) const {
+                // bodies are collected separately and placed after _start
+                gen.m_output << "   ; fn " << func->ident.value.value() << "\n";
+                gen.m_defined_funcs.emplace(func->ident.value.value(), func->params.size());
+                if (!gen.m_inline.contains(func->ident.value.value())) {
+                    gen.gen_func(func);
+                }
+            }
+
             void operator()(const NodeStmtInt* stmt_int) const{
                 gen.m_output << "   ; INT\n";
-                if (std::ranges::find_if(
-                        std::as_const(gen.m_vars),
-                        [&](const Var& var) {
-                            return var.name == stmt_int->ident.value;})
-                    != gen.m_vars.cend()){
+                if (gen.find_var(stmt_int->ident) != gen.m_vars.cend()){
                     std::cerr << "Identifier already used: " << stmt_int->ident.value.value() << std::endl;
                     exit(EXIT_FAILURE);
                 }
 
-                gen.m_vars.push_back({ .name = stmt_int->ident.value.value(), .stack_loc = gen.m_stack_size });
-                gen.push("0");
+                if (int_type_bytes(stmt_int->type) < 8) {
+                    gen.declare_narrow(stmt_int);
+                    return;
+                }
+                const size_t stack_loc = gen.m_stack_size;
+                if (stmt_int->expr != nullptr) {
+                    gen.gen_expr(stmt_int->expr); // the value left on the stack becomes the variable slot
+                }else {
+                    gen.push("0");
+                }
+                gen.m_vars.push_back({ .name = stmt_int->ident.value.value(), .stack_loc = stack_loc, .type = stmt_int->type });
             }
 
             void operator()(const NodeStmtAssign* stmt_assign) const{
                 gen.m_output << " ; assign " << stmt_assign->ident.value.value() << "\n";
-                const auto it = std::ranges::find_if(gen.m_vars, [&](const Var& var) {
-                    return var.name == stmt_assign->ident.value;
-                });
-                if (it == gen.m_vars.end()) {
+                const auto it = gen.find_var(stmt_assign->ident);
+                if (it == gen.m_vars.cend()) {
                     std::cerr << "Undeclared identifier: " << stmt_assign->ident.value.value() << std::endl;
                     exit(EXIT_FAILURE);
                 }
-                gen.gen_expr(stmt_assign->expr);
-                gen.pop("rax");
+                gen.gen_value(stmt_assign->expr, "rax");
 
-                gen.m_output << "   mov [rsp + " << (gen.m_stack_size - it->stack_loc - 1) * 8 <<  "], rax\n";
+                gen.m_output << "   mov " << gen.slot_of(*it) << ", " << rax_of(it->type) << "\n";
             }
 
             void operator()(const NodeScope* scope) const{
@@ -204,19 +303,30 @@ public:
                 gen.m_output << "   ; /scope\n";
             }
 
-            void operator()(const NodeStmtIf* stmt_if) const {
-                gen.m_output << "  ;if statement\n";
-                gen.gen_expr(stmt_if->expr);
+            void operator()(const NodeStmtSwitch* stmt_switch) const {
+                gen.gen_switch(stmt_switch);
+            }
 
-                gen.pop("rax");
-                gen.m_output << "   test rax, rax\n";
+            void operator()(const NodeStmtParallelFor* loop) const {
+                gen.gen_parallel_for(loop);
+            }
 
-                const std::string end_label = gen.create_label();
-                gen.m_output << "    jz " << end_label << "\n";
+            void operator()(const NodeStmtIf* stmt_if) const {
+                gen.m_output << "  ;if statement\n";
+                const std::string label = gen.create_label();
+                gen.gen_branch_if_false(stmt_if->expr, label);
 
                 gen.gen_scope(stmt_if->scope);
 
-                gen.m_output << end_label <<  ":\n";
+                if (stmt_if->pred.has_value()) {
+                    const std::string end_label = gen.create_label();
+                    gen.m_output << "   jmp " << end_label << "\n";
+                    gen.m_output << label << ":\n";
+                    gen.gen_if_pred(stmt_if->pred.value(), end_label);
+                    gen.m_output << end_label << ":\n";
+                }else {
+                    gen.m_output << label << ":\n";
+                }
                 gen.m_output << "    ; /if\n";
                 gen.m_output << "\n" ;
             }
@@ -225,16 +335,460 @@ public:
         std::visit(visitor, stmt->var);
     }
 
+    // Dense case sets jump through a table in .rodata after one bounds check,
+    // sparse ones search a balanced compare tree. The value stays in rax while
+    // dispatching, so the stack layout is the same in every case body.
+    void gen_switch(const NodeStmtSwitch* stmt_switch) {
+        m_output << "   ; switch\n";
+        gen_value(stmt_switch->expr, "rax");
+
+        const SwitchPlan plan = plan_switch(stmt_switch);
+        std::unordered_map<const NodeSwitchCase*, std::string> labels;
+        for (const NodeSwitchCase* c : plan.cases) {
+            labels.emplace(c, create_label());
+        }
+        const std::string default_label = create_label();
+        const std::string end_label = create_label();
+
+        if (plan.table) {
+            const std::string table_label = create_label();
+            if (plan.min != 0) {
+                sub_rax(plan.min);
+            }
+            m_output << "   cmp rax, " << plan.entries - 1 << "\n";
+            m_output << "   ja " << default_label << "\n";
+            m_output << "   lea rbx, [rel " << table_label << "]\n";
+            m_output << "   jmp QWORD [rbx + rax * 8]\n";
+
+            m_rodata << "align 8\n" << table_label << ":\n";
+            auto it = plan.cases.begin();
+            for (uint64_t i = 0; i < plan.entries; i++) {
+                const bool hit = it != plan.cases.end() &&
+                    static_cast<uint64_t>((*it)->value) - static_cast<uint64_t>(plan.min) == i;
+                m_rodata << "   dq " << (hit ? labels.at(*it++) : default_label) << "\n";
+            }
+        }else {
+            gen_switch_tree(plan.cases, labels, default_label);
+        }
+
+        for (const NodeSwitchCase& c : stmt_switch->cases) {
+            m_output << labels.at(&c) << ":\n";
+            m_output << "   ; case " << c.value << "\n";
+            gen_scope(c.scope);
+            m_output << "   jmp " << end_label << "\n";
+        }
+        m_output << default_label << ":\n";
+        if (stmt_switch->default_scope != nullptr) {
+            m_output << "   ; default\n";
+            gen_scope(stmt_switch->default_scope);
+        }
+        m_output << end_label << ":\n";
+        m_output << "   ; /switch\n";
+    }
+
+    // binary search over the sorted cases, a short linear run at the leaves
+    void gen_switch_tree(const std::span<const NodeSwitchCase* const> cases,
+            const std::unordered_map<const NodeSwitchCase*, std::string>& labels, const std::string& default_label) {
+        if (cases.size() <= 3) {
+            for (const NodeSwitchCase* c : cases) {
+                cmp_rax(c->value);
+                m_output << "   je " << labels.at(c) << "\n";
+            }
+            m_output << "   jmp " << default_label << "\n";
+            return;
+        }
+        const size_t mid = cases.size() / 2;
+        const std::string lower = create_label();
+        cmp_rax(cases[mid]->value);
+        m_output << "   je " << labels.at(cases[mid]) << "\n";
+        m_output << "   jl " << lower << "\n";
+        gen_switch_tree(cases.subspan(mid + 1), labels, default_label);
+        m_output << lower << ":\n";
+        gen_switch_tree(cases.first(mid), labels, default_label);
+    }
+
+    // Calls follow the SysV ABI: the first six arguments go in registers, the
+    // rest on the stack, and rsp is 16 byte aligned at the call. Arguments are
+    // evaluated right to left so that stack arguments end up in ABI order.
+    void gen_call(const NodeTermCall* call) {
+        const bool pad = gen_call_begin(call);
+        for (size_t i = call->args.size(); i-- > 0;) {
+            gen_expr(call->args[i]);
+        }
+        gen_call_end(call, pad);
+    }
+
+    // the alignment before the arguments, returns whether rsp was padded
+    bool gen_call_begin(const NodeTermCall* call) {
+        const size_t num_args = call->args.size();
+        const size_t stack_args = num_args > arg_regs.size() ? num_args - arg_regs.size() : 0;
+        const bool pad = (m_frame_base + m_stack_size + stack_args) % 2 != 0;
+        if (pad) {
+            m_output << "   sub rsp, 8\n";
+            m_stack_size++;
+        }
+        return pad;
+    }
+
+    // the arguments are pushed
+    void gen_call_end(const NodeTermCall* call, const bool pad) {
+        const size_t num_args = call->args.size();
+        const size_t stack_args = num_args > arg_regs.size() ? num_args - arg_regs.size() : 0;
+        for (size_t i = 0; i < std::min(num_args, arg_regs.size()); i++) {
+            pop(arg_regs[i]);
+        }
+        m_output << "   call fn_" << call->ident.value.value() << "\n";
+        if (m_call_graph.find(call->ident.value.value()) == nullptr) {
+            // streamed input, the definition may come later
+            m_unresolved_calls.emplace(call->ident.value.value(), num_args);
+        }
+        const size_t cleanup = stack_args + (pad ? 1 : 0);
+        if (cleanup > 0) {
+            m_output << "   add rsp, " << cleanup * 8 << "\n";
+            m_stack_size -= cleanup;
+        }
+        push("rax");
+    }
+
+    // arguments are already in registers, so only the alignment is left
+    void call_runtime(const std::string_view fn) {
+        const bool pad = (m_frame_base + m_stack_size) % 2 != 0;
+        if (pad) {
+            m_output << "   sub rsp, 8\n";
+        }
+        m_output << "   call " << fn << "\n";
+        if (pad) {
+            m_output << "   add rsp, 8\n";
+        }
+    }
+
+    // Expands the callee in place: arguments become the parameter slots and every
+    // `return` jumps to a label after the body instead of leaving a frame.
+    void gen_inline_call(const NodeTermCall* call) {
+        const size_t base = gen_inline_call_begin(call);
+        for (size_t i = call->args.size(); i-- > 0;) {
+            gen_expr(call->args[i]);
+        }
+        gen_inline_call_end(call, base);
+    }
+
+    // returns the stack size the parameter slots start at
+    size_t gen_inline_call_begin(const NodeTermCall* call) {
+        m_output << "   ; inline " << call->ident.value.value() << "\n";
+        return m_stack_size;
+    }
+
+    // the arguments are pushed from `base` on
+    void gen_inline_call_end(const NodeTermCall* call, const size_t base) {
+        const NodeStmtFunc* func = m_call_graph.find(call->ident.value.value())->func;
+        const size_t num_args = call->args.size();
+        const size_t saved_floor = m_var_floor;
+        const size_t saved_vars = m_vars.size();
+        m_var_floor = m_vars.size();
+        for (size_t i = 0; i < num_args; i++) {
+            m_vars.push_back({ .name = func->params[i].value.value(), .stack_loc = base + num_args - 1 - i, .type = func->param_types[i] });
+        }
+
+        const std::string end_label = create_label();
+        const int saved_line = m_line;
+        m_return_ctx.push_back({ .kind = ReturnCtx::Inline, .label = end_label, .base = base, .type = func->ret });
+        gen_scope(func->body);
+        m_return_ctx.pop_back();
+        mark_line(saved_line); // the rest belongs to the caller's statement
+
+        m_output << "   xor eax, eax\n"; // falling off the end returns 0
+        if (m_stack_size > base) {
+            m_output << "   add rsp, " << (m_stack_size - base) * 8 << "\n";
+        }
+        m_output << end_label << ":\n";
+        m_stack_size = base;
+        m_vars.resize(saved_vars);
+        m_var_floor = saved_floor;
+        push("rax");
+        m_output << "   ; /inline\n";
+    }
+
+    // `return (f(...))` in a function reuses the caller's frame and jumps to f,
+    // unless f's result has to be narrowed to the caller's return type
+    std::optional<const NodeTermCall*> tail_call_of(const NodeExpr* expr) const {
+        const auto term = std::get_if<NodeTerm*>(&expr->var);
+        if (term == nullptr || needs_narrowing(expr->type, m_return_ctx.back().type)) {
+            return {};
+        }
+        const auto call = std::get_if<NodeTermCall*>(&(*term)->var);
+        if (call == nullptr || m_inline.contains((*call)->ident.value.value()) ||
+                (*call)->args.size() > arg_regs.size()) {
+            return {};
+        }
+        return *call;
+    }
+
+    void gen_tail_call(const NodeTermCall* call) {
+        m_output << "   ; tail call " << call->ident.value.value() << "\n";
+        for (size_t i = call->args.size(); i-- > 0;) {
+            gen_expr(call->args[i]);
+        }
+        for (size_t i = 0; i < call->args.size(); i++) {
+            pop(arg_regs[i]);
+        }
+        func_epilogue();
+        m_output << "   jmp fn_" << call->ident.value.value() << "\n";
+    }
+
+    // Emits a function body into the function section. The state of the code
+    // being generated around the definition is saved and restored.
+    void gen_func(const NodeStmtFunc* func) {
+        SavedFrame saved = save_frame();
+        std::swap(m_output, m_func_output);
+
+        m_output << "\nfn_" << func->ident.value.value() << ":\n";
+        m_func_symbols.push_back("fn_" + func->ident.value.value());
+        m_line = 0;
+        mark_line(func->ident.line);
+        m_output << "   push rbp\n";
+        m_output << "   mov rbp, rsp\n";
+        for (const std::string& reg : callee_saved) {
+            m_output << "   push " << reg << "\n";
+        }
+        m_frame_base = 2 + callee_saved.size(); // return address, rbp
+        m_stack_size = 0;
+        m_vars.clear();
+        m_var_floor = 0;
+
+        for (size_t i = 0; i < func->params.size(); i++) {
+            const Token& param = func->params[i];
+            if (find_var(param) != m_vars.cend()) {
+                std::cerr << "Identifier already used: " << param.value.value() << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            // a whole qword each, read at the width of its type
+            m_vars.push_back({ .name = param.value.value(), .stack_loc = m_stack_size, .type = func->param_types[i] });
+            if (i < arg_regs.size()) {
+                push(arg_regs[i]);
+            }else {
+                std::stringstream arg;
+                arg << "QWORD [rbp + " << 16 + (i - arg_regs.size()) * 8 << "]";
+                push(arg.str());
+            }
+        }
+
+        m_return_ctx.push_back({ .kind = ReturnCtx::Func, .type = func->ret });
+        gen_scope(func->body);
+        m_return_ctx.pop_back();
+
+        m_output << "   xor eax, eax\n";
+        func_epilogue();
+        m_output << "   ret\n";
+
+        std::swap(m_output, m_func_output);
+        restore_frame(std::move(saved));
+    }
+
+    // The body of a `parallel for` becomes a worker function
+    // par_N(ctx, begin, end) that runs the iterations [begin, end) and returns
+    // its share of the reduce variable; hy_parallel_for hands the chunks to the
+    // threads. ctx is the caller's rsp: the worker starts by copying every
+    // visible variable out of the caller's frame into its own, and
+    // ParallelForCheck keeps the copies read-only. The caller waits inside
+    // hy_parallel_for, so its frame stays put meanwhile.
+    void gen_parallel_for(const NodeStmtParallelFor* loop) {
+        m_output << "   ; parallel for " << loop->ident.value.value() << "\n";
+        if (find_var(loop->ident) != m_vars.cend()) {
+            std::cerr << "Identifier already used: " << loop->ident.value.value() << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        std::optional<std::string> reduce;
+        if (loop->reduce.has_value()) {
+            var_of(loop->reduce.value()); // must be declared
+            reduce = loop->reduce->value.value();
+        }
+        gen_expr(loop->lo);
+        gen_expr(loop->hi);
+        pop("rcx");
+        pop("rdx");
+        const std::string worker = "par_" + std::to_string(m_worker_count++);
+        m_output << "   lea rdi, [rel " << worker << "]\n";
+        m_output << "   mov rsi, rsp\n";
+        call_runtime("hy_parallel_for");
+        if (reduce.has_value()) {
+            m_output << "   add " << var_slot(loop->reduce.value()) << ", " << rax_of(var_of(loop->reduce.value()).type) << "\n";
+        }
+        gen_parallel_worker(loop, worker, reduce);
+        m_output << "   ; /parallel for\n";
+    }
+
+    void gen_parallel_worker(const NodeStmtParallelFor* loop, const std::string& name, const std::optional<std::string>& reduce) {
+        const std::vector<Var> outer(m_vars.cbegin() + static_cast<std::ptrdiff_t>(m_var_floor), m_vars.cend());
+        const size_t ctx_size = m_stack_size;
+        SavedFrame saved = save_frame();
+        std::swap(m_output, m_worker_output);
+
+        m_output << "\n" << name << ":\n";
+        m_func_symbols.push_back(name);
+        m_line = 0;
+        mark_line(saved.line);
+        m_output << "   push rbp\n";
+        m_output << "   mov rbp, rsp\n";
+        for (const std::string& reg : callee_saved) {
+            m_output << "   push " << reg << "\n";
+        }
+        m_frame_base = 2 + callee_saved.size(); // return address, rbp
+        m_stack_size = 0;
+        m_vars.clear();
+        m_var_floor = 0;
+        for (const Var& var : outer) {
+            // packed variables get a qword of their own here
+            const std::string mem = std::string(size_of(var.type)) + " [rdi + " + std::to_string((ctx_size - var.stack_loc - 1) * 8 + var.byte) + "]";
+            m_vars.push_back({ .name = var.name, .stack_loc = m_stack_size, .type = var.type });
+            if (var.name == reduce) {
+                push("0"); // this chunk's share
+            }else if (int_type_bytes(var.type) == 8) {
+                push(mem);
+            }else {
+                load("rax", var.type, mem);
+                push("rax");
+            }
+        }
+        m_vars.push_back({ .name = loop->ident.value.value(), .stack_loc = m_stack_size });
+        push("rsi");
+        const size_t end_loc = m_stack_size;
+        push("rdx");
+
+        const std::string head = create_label();
+        const std::string done = create_label();
+        m_output << head << ":\n";
+        m_output << "   mov rax, " << var_slot(loop->ident) << "\n";
+        m_output << "   cmp rax, QWORD [rsp + " << (m_stack_size - end_loc - 1) * 8 << "]\n";
+        m_output << "   jge " << done << "\n";
+        gen_scope(loop->body);
+        m_output << "   add " << var_slot(loop->ident) << ", 1\n";
+        m_output << "   jmp " << head << "\n";
+        m_output << done << ":\n";
+        if (reduce.has_value()) {
+            const Var& sum = var_of(loop->reduce.value());
+            load("rax", sum.type, slot_of(sum));
+        }else {
+            m_output << "   xor eax, eax\n";
+        }
+        func_epilogue();
+        m_output << "   ret\n";
+
+        std::swap(m_output, m_worker_output);
+        restore_frame(std::move(saved));
+    }
+
     [[nodiscard]] std::string gen_prog()
     {
-        m_output << "global _start\n_start:\n";
+        if (m_inline_enabled) {
+            m_inline = plan_inlining(m_call_graph);
+        }
+        m_types.check_program(m_prog);
+        begin_prog();
         for (const NodeStmt* stmt : m_prog.stmts) {
             gen_stmt(stmt);
         }
-        m_output << "    mov rax, 60\n";
-        m_output << "    mov rdi, 0\n";
-        m_output << "    syscall\n";
-        return m_output.str();
+        return end_prog();
+    }
+
+    // Incremental form of gen_prog for callers that hand over one top-level
+    // statement at a time. Without the whole program there is no call graph, so
+    // nothing is inlined and calls are checked against definitions at the end.
+    void begin_prog() {
+        m_output << "_start:\n";
+        m_return_ctx.push_back({ .kind = ReturnCtx::Exit });
+    }
+
+    void gen_top_level(const NodeStmt* stmt) {
+        m_types.check_top_level(stmt);
+        m_streamed_calls.add(stmt);
+        gen_stmt(stmt);
+        if (m_stream != nullptr) {
+            flush_stream();
+        }
+    }
+
+    [[nodiscard]] std::string end_prog() {
+        finish_prog();
+        m_output << m_func_output.str();
+        m_output << m_worker_output.str();
+        std::string assembly = m_output.str();
+        if (m_layout_enabled) {
+            assembly = BlockLayout(assembly, m_rodata.str()).run();
+        }
+        // typed symbols let perf and gdb attribute samples to functions
+        std::stringstream symbols;
+        symbols << "global _start:function\n";
+        for (const std::string& symbol : m_func_symbols) {
+            symbols << "global " << symbol << ":function\n";
+        }
+        for (const std::string_view symbol : runtime_functions) {
+            symbols << "global " << symbol << ":function\n";
+        }
+        assembly.insert(0, symbols.str());
+        if (!m_debug_source.empty()) {
+            // the runtime maps to its own lines in the .asm file
+            const size_t line = static_cast<size_t>(std::ranges::count(assembly, '\n')) + 1;
+            assembly += "%line " + std::to_string(line + 1) + "+1 " + m_debug_asm + "\n";
+        }
+        assembly += runtime_text;
+        assembly += "\nsection .rodata\n";
+        assembly += runtime_rodata;
+        assembly += m_rodata.str();
+        assembly += runtime_bss;
+        return assembly;
+    }
+
+    // Streamed form of begin_prog/end_prog: the code of every top-level
+    // statement is written to `out` once gen_top_level returns, so none of it
+    // stays in memory. Function and worker bodies go to a section of their
+    // own, which ld places after the code of _start, and jump tables to
+    // .rodata. Block layout needs all of _start at once and is skipped.
+    void begin_stream(std::ostream& out) {
+        m_stream = &out;
+        m_layout_enabled = false;
+        write("global _start:function\n");
+        for (const std::string_view symbol : runtime_functions) {
+            write("global " + std::string(symbol) + ":function\n");
+        }
+        begin_prog();
+    }
+
+    void end_stream() {
+        finish_prog();
+        flush_stream();
+        if (!m_debug_source.empty()) {
+            write("%line " + std::to_string(m_stream_lines + 2) + "+1 " + m_debug_asm + "\n");
+        }
+        write(runtime_text);
+        write("\nsection .rodata\n");
+        write(runtime_rodata);
+        write(runtime_bss);
+        m_stream->flush();
+    }
+
+    void set_inlining(const bool enabled) {
+        m_inline_enabled = enabled;
+    }
+
+    void set_block_layout(const bool enabled) {
+        m_layout_enabled = enabled;
+    }
+
+    // without it every operation goes through the stack machine
+    void set_instruction_selection(const bool enabled) {
+        m_isel_enabled = enabled;
+    }
+
+    void set_isel_costs(const IselCosts& costs) {
+        m_isel_costs = costs;
+    }
+
+    // Emits `%line` directives so that `nasm -g -F dwarf` maps every
+    // instruction back to the statement in `source_path` it came from.
+    // `asm_name` is the file the assembly is written to.
+    void set_debug_info(std::string source_path, std::string asm_name) {
+        m_debug_source = std::move(source_path);
+        m_debug_asm = std::move(asm_name);
     }
 
 private:
@@ -248,37 +802,715 @@ private:
         m_stack_size--;
     }
 
+    // immediates of cmp/sub are sign-extended 32 bit, wider ones go through rbx
+    static bool fits_imm32(const int64_t value) {
+        return value >= INT32_MIN && value <= INT32_MAX;
+    }
+
+    void cmp_rax(const int64_t value) {
+        if (fits_imm32(value)) {
+            m_output << "   cmp rax, " << value << "\n";
+        }else {
+            m_output << "   mov rbx, " << value << "\n";
+            m_output << "   cmp rax, rbx\n";
+        }
+    }
+
+    void sub_rax(const int64_t value) {
+        if (fits_imm32(value)) {
+            m_output << "   sub rax, " << value << "\n";
+        }else {
+            m_output << "   mov rbx, " << value << "\n";
+            m_output << "   sub rax, rbx\n";
+        }
+    }
+
+    void mark_line(const int line) {
+        if (m_debug_source.empty() || line == 0 || line == m_line) {
+            return;
+        }
+        m_output << "%line " << line << "+0 " << m_debug_source << "\n";
+        m_line = line;
+    }
+
     void begin_scope(){
-        m_scopes.push_back(m_vars.size());
+        m_scopes.push_back({ .vars = m_vars.size(), .stack_size = m_stack_size, .pack = m_pack });
+        m_pack = {};
     }
 
     void end_scope(){
-        const size_t pop_count = m_vars.size() - m_scopes.back();
+        const Scope& scope = m_scopes.back();
+        const size_t pop_count = m_stack_size - scope.stack_size;
         if (pop_count > 0) { // Check pop_count > 0 to avoid adding rsp, 0
             m_output << "   add rsp, " << pop_count * 8 <<"\n";
             m_stack_size -= pop_count;
-            for (size_t i = 0; i < pop_count; i++) {
-                m_vars.pop_back();
-            }
         }
+        m_vars.resize(scope.vars);
+        m_pack = scope.pack;
         m_scopes.pop_back();
     }
 
+    // Variables narrower than a qword share one with the ones declared before
+    // them in the same scope, each at its natural alignment.
+    void declare_narrow(const NodeStmtInt* stmt_int) {
+        const size_t size = int_type_bytes(stmt_int->type);
+        const size_t offset = (m_pack.used + size - 1) / size * size;
+        if (!m_pack.open || offset + size > 8) {
+            // a new qword, the low bytes of the value left on the stack are the variable
+            if (stmt_int->expr != nullptr) {
+                gen_expr(stmt_int->expr);
+            }else {
+                push("0");
+            }
+            m_pack = { .open = true, .stack_loc = m_stack_size - 1, .used = size };
+            m_vars.push_back({ .name = stmt_int->ident.value.value(), .stack_loc = m_stack_size - 1, .type = stmt_int->type });
+            return;
+        }
+        const Var var { .name = stmt_int->ident.value.value(), .stack_loc = m_pack.stack_loc, .byte = offset, .type = stmt_int->type };
+        if (stmt_int->expr != nullptr) {
+            gen_value(stmt_int->expr, "rax");
+            m_output << "   mov " << slot_of(var) << ", " << rax_of(var.type) << "\n";
+        }else {
+            m_output << "   mov " << slot_of(var) << ", 0\n";
+        }
+        m_pack.used = offset + size;
+        m_vars.push_back(var);
+    }
+
+    static const char* size_of(const IntType type) {
+        switch (int_type_bytes(type)) {
+            case 1: return "BYTE";
+            case 2: return "WORD";
+            case 4: return "DWORD";
+            default: return "QWORD";
+        }
+    }
+
+    // the part of rax a value of `type` is stored from
+    static const char* rax_of(const IntType type) {
+        switch (int_type_bytes(type)) {
+            case 1: return "al";
+            case 2: return "ax";
+            case 4: return "eax";
+            default: return "rax";
+        }
+    }
+
+    // the checks and the exit that close _start
+    void finish_prog() {
+        m_types.finish();
+        m_return_ctx.pop_back();
+        m_output << "    xor edi, edi\n";
+        m_output << "    jmp hy_exit\n";
+        for (const auto& [name, num_args] : m_unresolved_calls) {
+            const auto it = m_defined_funcs.find(name);
+            if (it == m_defined_funcs.end()) {
+                std::cerr << "Undefined function: " << name << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            if (it->second != num_args) {
+                std::cerr << "Function " << name << " expects " << it->second
+                          << " arguments, got " << num_args << std::endl;
+                exit(EXIT_FAILURE);
+            }
+        }
+        m_streamed_calls.check_parallel_loops();
+    }
+
+    void write(const std::string_view text) {
+        *m_stream << text;
+        m_stream_lines += static_cast<size_t>(std::ranges::count(text, '\n'));
+    }
+
+    static std::string take(std::stringstream& ss) {
+        std::string text = ss.str();
+        ss.str({});
+        ss.clear();
+        return text;
+    }
+
+    // moves what the last top-level statement emitted to the stream
+    void flush_stream() {
+        write(take(m_output));
+        if (!m_func_symbols.empty()) {
+            write("section .text.hy_funcs progbits alloc exec nowrite align=16\n");
+            for (const std::string& symbol : m_func_symbols) {
+                write("global " + symbol + ":function\n");
+            }
+            m_func_symbols.clear();
+            write(take(m_func_output));
+            write(take(m_worker_output));
+            write("section .text\n");
+        }
+        if (m_rodata.tellp() > 0) {
+            write("section .rodata\n");
+            write(take(m_rodata));
+            write("section .text\n");
+        }
+    }
+
+    static std::string reg32(const std::string& reg) {
+        const auto it = std::ranges::find_if(isel_regs, [&](const IselReg& r) { return r.q == reg; });
+        return it != isel_regs.end() ? it->d : "e" + reg.substr(1); // rbx -> ebx
+    }
+
+    // loads a `type` from `mem` into the 64-bit register `reg`, extended to 64 bits
+    void load(const std::string& reg, const IntType type, const std::string& mem) {
+        switch (type) {
+            case IntType::I8:
+            case IntType::I16: m_output << "   movsx " << reg << ", " << mem << "\n"; break;
+            case IntType::I32: m_output << "   movsxd " << reg << ", " << mem << "\n"; break;
+            case IntType::U8:
+            case IntType::U16: m_output << "   movzx " << reg << ", " << mem << "\n"; break;
+            case IntType::U32: m_output << "   mov " << reg32(reg) << ", " << mem << "\n"; break;
+            default: m_output << "   mov " << reg << ", " << mem << "\n"; break;
+        }
+    }
+
+    // extends the low bytes of rax that make up a `type` to 64 bits
+    void extend_rax(const IntType type) {
+        switch (type) {
+            case IntType::I8: m_output << "   movsx rax, al\n"; break;
+            case IntType::I16: m_output << "   movsx rax, ax\n"; break;
+            case IntType::I32: m_output << "   movsxd rax, eax\n"; break;
+            case IntType::U8: m_output << "   movzx eax, al\n"; break;
+            case IntType::U16: m_output << "   movzx eax, ax\n"; break;
+            case IntType::U32: break; // 32-bit results are zero extended already
+            default: break;
+        }
+    }
+
+    void convert_rax(const IntType from, const IntType to) {
+        if (needs_narrowing(from, to)) {
+            if (to == IntType::U32) {
+                m_output << "   mov eax, eax\n";
+            }else {
+                extend_rax(to);
+            }
+        }
+    }
+
+    // Registers covered code computes in. No value stays in a register from
+    // one expression to the next and covered code calls nothing, so all the
+    // caller-saved ones are free.
+    struct IselReg {
+        const char* q;
+        const char* d;
+        const char* b;
+    };
+    inline static constexpr std::array<IselReg, 9> isel_regs {{
+        { "rax", "eax", "al" }, { "rcx", "ecx", "cl" }, { "rdx", "edx", "dl" },
+        { "rsi", "esi", "sil" }, { "rdi", "edi", "dil" }, { "r8", "r8d", "r8b" },
+        { "r9", "r9d", "r9b" }, { "r10", "r10d", "r10b" }, { "r11", "r11d", "r11b" },
+    }};
+
+    // one covered expression being emitted
+    struct IselEmit {
+        InstructionSelector sel;
+        std::vector<const NodeExpr*> operands{};                  // the Stack leaves, left to right
+        std::unordered_map<const NodeExpr*, size_t> stack_locs{}; // Stack leaf -> its slot
+        size_t base = 0;                                          // m_stack_size before them
+        uint32_t free = (1u << isel_regs.size()) - 1;
+    };
+
+    // where gen_expr_to leaves the value
+    struct ExprDest {
+        enum class Kind { Push, Reg, Branch } kind = Kind::Push;
+        std::string target{}; // the register, or the label to jump to when the value is 0
+    };
+
+    // An expression being generated. gen_expr_to keeps these on a stack instead
+    // of recursing, so nesting depth costs heap and not native stack.
+    struct ExprFrame {
+        const NodeExpr* expr;
+        ExprDest dest;
+        size_t stage = 0;                 // operands started so far
+        std::unique_ptr<IselEmit> sel{};  // a covered expression, its Stack leaves are the operands
+        size_t base = 0;                  // m_stack_size before an inlined call
+        bool pad = false;                 // of a call
+    };
+
+    // the operand a frame waits for
+    struct ExprOperand {
+        const NodeExpr* expr;
+        ExprDest dest{};
+    };
+
+    void gen_expr_to(const NodeExpr* expr, ExprDest dest) {
+        std::vector<ExprFrame> stack;
+        stack.push_back({ .expr = expr, .dest = std::move(dest) });
+        while (!stack.empty()) {
+            if (std::optional<ExprOperand> operand = gen_step(stack.back())) {
+                stack.push_back({ .expr = operand->expr, .dest = std::move(operand->dest) });
+            }else {
+                stack.pop_back();
+            }
+        }
+    }
+
+    // Emits `frame` up to its next operand and returns it, or finishes the frame
+    // and delivers its value.
+    std::optional<ExprOperand> gen_step(ExprFrame& frame) {
+        if (frame.stage == 0) {
+            frame.expr = InstructionSelector::strip_parens(frame.expr);
+            frame.sel = isel_begin(frame.expr);
+        }
+        if (frame.sel != nullptr) {
+            IselEmit& sel = *frame.sel;
+            if (frame.stage < sel.operands.size()) {
+                const NodeExpr* operand = sel.operands[frame.stage++];
+                sel.stack_locs.emplace(operand, m_stack_size);
+                return ExprOperand { operand };
+            }
+            isel_deliver(sel, frame.expr, frame.dest);
+            return {};
+        }
+        if (const auto bin = std::get_if<NodeBinExpr*>(&frame.expr->var)) {
+            if (frame.stage < 2) {
+                return ExprOperand { expr_child(frame.expr, frame.stage++) };
+            }
+            gen_bin_expr(*bin);
+            deliver(frame.dest);
+            return {};
+        }
+        const NodeTerm* term = std::get<NodeTerm*>(frame.expr->var);
+        if (const auto term_alloc = std::get_if<NodeTermAlloc*>(&term->var)) {
+            if (frame.stage++ == 0) {
+                return ExprOperand { (*term_alloc)->count, { .kind = ExprDest::Kind::Reg, .target = "rdi" } };
+            }
+            call_runtime("hy_alloc");
+            push("rax");
+        }else if (const auto term_index = std::get_if<NodeTermIndex*>(&term->var)) {
+            if (frame.stage++ == 0) {
+                return ExprOperand { (*term_index)->index, { .kind = ExprDest::Kind::Reg, .target = "rax" } };
+            }
+            const Var& base = var_of((*term_index)->ident);
+            load("rbx", base.type, slot_of(base));
+            m_output << "   mov rax, [rbx + rax * 8]\n";
+            push("rax");
+        }else if (const auto term_call = std::get_if<NodeTermCall*>(&term->var)) {
+            // arguments right to left, see gen_call
+            const NodeTermCall* call = *term_call;
+            const bool inlined = m_inline.contains(call->ident.value.value());
+            if (frame.stage == 0) {
+                if (inlined) {
+                    frame.base = gen_inline_call_begin(call);
+                }else {
+                    frame.pad = gen_call_begin(call);
+                }
+            }
+            if (frame.stage < call->args.size()) {
+                return ExprOperand { call->args[call->args.size() - ++frame.stage] };
+            }
+            if (inlined) {
+                gen_inline_call_end(call, frame.base);
+            }else {
+                gen_call_end(call, frame.pad);
+            }
+        }else {
+            gen_leaf(term);
+        }
+        deliver(frame.dest);
+        return {};
+    }
+
+    // the value the stack machine pushed goes where `dest` says
+    void deliver(const ExprDest& dest) {
+        if (dest.kind == ExprDest::Kind::Reg) {
+            pop(dest.target);
+        }else if (dest.kind == ExprDest::Kind::Branch) {
+            pop("rax");
+            m_output << "   test rax, rax\n";
+            m_output << "   jz " << dest.target << "\n";
+        }
+    }
+
+    // Labels `expr` when the selector covers it. gen_step then pushes its Stack
+    // leaves, left to right, so calls inside keep their order; the covered code
+    // after them only reads variables, which no call can change.
+    std::unique_ptr<IselEmit> isel_begin(const NodeExpr* expr) {
+        if (!m_isel_enabled || !InstructionSelector::coverable(expr)) {
+            return {};
+        }
+        auto sel = std::make_unique<IselEmit>(InstructionSelector(m_isel_costs, isel_regs.size()));
+        sel->sel.label(expr);
+        sel->sel.stack_operands(expr, sel->operands);
+        sel->base = m_stack_size;
+        return sel;
+    }
+
+    // the covered code once the Stack leaves are pushed, its value goes where
+    // `dest` says
+    void isel_deliver(IselEmit& sel, const NodeExpr* expr, const ExprDest& dest) {
+        if (dest.kind == ExprDest::Kind::Branch && sel.sel[expr].at(IselNt::Flags) != IselLabel::infinite) {
+            isel_flags(sel, expr);
+            isel_end(sel);
+            m_output << "   jne " << dest.target << "\n";
+            return;
+        }
+        const size_t r = isel_reg(sel, expr);
+        isel_end(sel);
+        if (dest.kind == ExprDest::Kind::Push) {
+            push(isel_regs[r].q);
+        }else if (dest.kind == ExprDest::Kind::Reg) {
+            if (isel_regs[r].q != dest.target) {
+                m_output << "   mov " << dest.target << ", " << isel_regs[r].q << "\n";
+            }
+        }else {
+            m_output << "   test " << isel_regs[r].q << ", " << isel_regs[r].q << "\n";
+            m_output << "   jz " << dest.target << "\n";
+        }
+    }
+
+    // drops the Stack leaves, `lea` keeps the flags of a compare intact
+    void isel_end(IselEmit& sel) {
+        if (m_stack_size > sel.base) {
+            m_output << "   lea rsp, [rsp + " << (m_stack_size - sel.base) * 8 << "]\n";
+            m_stack_size = sel.base;
+        }
+    }
+
+    static size_t isel_alloc(IselEmit& sel) {
+        assert(sel.free != 0 && "the selector bounds the register need");
+        const auto reg = static_cast<size_t>(std::countr_zero(sel.free));
+        sel.free &= ~(1u << reg);
+        return reg;
+    }
+
+    static void isel_release(IselEmit& sel, const size_t reg) {
+        sel.free |= 1u << reg;
+    }
+
+    static bool is_sub(const NodeExpr* expr) {
+        return std::holds_alternative<NodeBinExprSub*>(std::get<NodeBinExpr*>(InstructionSelector::strip_parens(expr)->var)->var);
+    }
+
+    const auto& isel_var(const NodeExpr* expr) const {
+        const NodeExpr* leaf = InstructionSelector::strip_parens(expr);
+        return var_of(std::get<NodeTermIdent*>(std::get<NodeTerm*>(leaf->var)->var)->ident);
+    }
+
+    // an Imm or Mem operand
+    std::string isel_operand(const IselEmit& sel, const NodeExpr* expr, const IselNt nt) const {
+        const IselLabel& label = sel.sel[expr];
+        switch (label.rule(nt).rule) {
+            case IselRule::Imm: return std::to_string(label.imm);
+            case IselRule::Var: return slot_of(isel_var(expr));
+            default: {
+                const size_t loc = sel.stack_locs.at(InstructionSelector::strip_parens(expr));
+                return "QWORD [rsp + " + std::to_string((m_stack_size - loc - 1) * 8) + "]";
+            }
+        }
+    }
+
+    // the two operands in registers, the one that needs more registers first
+    std::pair<size_t, size_t> isel_reg_pair(IselEmit& sel, const NodeExpr* a, const NodeExpr* b) {
+        if (sel.sel[b].need > sel.sel[a].need) {
+            const size_t rb = isel_reg(sel, b);
+            return { isel_reg(sel, a), rb };
+        }
+        const size_t ra = isel_reg(sel, a);
+        return { ra, isel_reg(sel, b) };
+    }
+
+    // emits the Reg cover of `expr`, returns the register holding the value
+    size_t isel_reg(IselEmit& sel, const NodeExpr* expr) {
+        const IselLabel& label = sel.sel[expr];
+        const IselChoice choice = label.rule(IselNt::Reg);
+        switch (choice.rule) {
+            case IselRule::MovImm:
+            case IselRule::LoadImm: {
+                const size_t r = isel_alloc(sel);
+                m_output << "   mov " << isel_regs[r].q << ", " << label.imm << "\n";
+                return r;
+            }
+            case IselRule::LoadVar: {
+                const size_t r = isel_alloc(sel);
+                const auto& var = isel_var(expr);
+                load(isel_regs[r].q, var.type, slot_of(var));
+                return r;
+            }
+            case IselRule::Load: {
+                const size_t r = isel_alloc(sel);
+                m_output << "   mov " << isel_regs[r].q << ", " << isel_operand(sel, expr, IselNt::Mem) << "\n";
+                return r;
+            }
+            case IselRule::Lea: {
+                const auto [addr, regs] = isel_addr(sel, expr, IselNt::Addr);
+                for (size_t i = 1; i < regs.size(); i++) {
+                    isel_release(sel, regs[i]);
+                }
+                const size_t r = regs.empty() ? isel_alloc(sel) : regs.front();
+                m_output << "   lea " << isel_regs[r].q << ", [" << addr << "]\n";
+                return r;
+            }
+            case IselRule::SetCc: {
+                isel_flags(sel, expr);
+                const size_t r = isel_alloc(sel);
+                m_output << "   sete " << isel_regs[r].b << "\n";
+                m_output << "   movzx " << isel_regs[r].d << ", " << isel_regs[r].b << "\n";
+                return r;
+            }
+            default:
+                break;
+        }
+        const auto [a, b] = InstructionSelector::operands(expr, choice);
+        const char* alu = is_sub(expr) ? "sub" : "add";
+        switch (choice.rule) {
+            case IselRule::AluRR:
+            case IselRule::ImulRR: {
+                const auto [ra, rb] = isel_reg_pair(sel, a, b);
+                m_output << "   " << (choice.rule == IselRule::AluRR ? alu : "imul") << " "
+                         << isel_regs[ra].q << ", " << isel_regs[rb].q << "\n";
+                isel_release(sel, rb);
+                return ra;
+            }
+            case IselRule::AluRI:
+            case IselRule::AluRM:
+            case IselRule::ImulRM: {
+                const size_t ra = isel_reg(sel, a);
+                m_output << "   " << (choice.rule == IselRule::ImulRM ? "imul" : alu) << " " << isel_regs[ra].q << ", "
+                         << isel_operand(sel, b, choice.rule == IselRule::AluRI ? IselNt::Imm : IselNt::Mem) << "\n";
+                return ra;
+            }
+            case IselRule::ImulRI: {
+                const size_t ra = isel_reg(sel, a);
+                m_output << "   imul " << isel_regs[ra].q << ", " << isel_regs[ra].q << ", " << isel_operand(sel, b, IselNt::Imm) << "\n";
+                return ra;
+            }
+            case IselRule::ImulMI: {
+                const size_t r = isel_alloc(sel);
+                m_output << "   imul " << isel_regs[r].q << ", " << isel_operand(sel, a, IselNt::Mem) << ", "
+                         << isel_operand(sel, b, IselNt::Imm) << "\n";
+                return r;
+            }
+            case IselRule::Shl: {
+                const size_t ra = isel_reg(sel, a);
+                m_output << "   shl " << isel_regs[ra].q << ", " << std::countr_zero(static_cast<uint64_t>(sel.sel[b].imm)) << "\n";
+                return ra;
+            }
+            default:
+                assert(false && "not a Reg rule");
+                return 0;
+        }
+    }
+
+    struct IselAddr {
+        std::string text;           // inside the brackets
+        std::vector<size_t> regs{}; // held until the address is used
+    };
+
+    // emits the registers of an Index, Sib or Addr cover
+    IselAddr isel_addr(IselEmit& sel, const NodeExpr* expr, const IselNt nt) {
+        const IselChoice choice = sel.sel[expr].rule(nt);
+        if (choice.rule == IselRule::AddrSib) {
+            return isel_addr(sel, expr, IselNt::Sib);
+        }
+        const auto [a, b] = InstructionSelector::operands(expr, choice);
+        switch (choice.rule) {
+            case IselRule::Scale: {
+                const size_t r = isel_reg(sel, a);
+                return { .text = std::string(isel_regs[r].q) + "*" + std::to_string(sel.sel[b].imm), .regs = { r } };
+            }
+            case IselRule::BaseIndex: {
+                const auto [ra, rb] = isel_reg_pair(sel, a, b);
+                return { .text = std::string(isel_regs[ra].q) + " + " + isel_regs[rb].q, .regs = { ra, rb } };
+            }
+            case IselRule::BaseScaled: {
+                size_t base = 0;
+                IselAddr index;
+                if (sel.sel[b].need > sel.sel[a].need) {
+                    index = isel_addr(sel, b, IselNt::Index);
+                    base = isel_reg(sel, a);
+                }else {
+                    base = isel_reg(sel, a);
+                    index = isel_addr(sel, b, IselNt::Index);
+                }
+                index.text = std::string(isel_regs[base].q) + " + " + index.text;
+                index.regs.insert(index.regs.begin(), base);
+                return index;
+            }
+            case IselRule::AddrDisp:
+            case IselRule::AddrScaled: {
+                IselAddr addr = isel_addr(sel, a, choice.rule == IselRule::AddrDisp ? IselNt::Sib : IselNt::Index);
+                const int64_t disp = is_sub(expr) ? -sel.sel[b].imm : sel.sel[b].imm;
+                addr.text += disp < 0 ? " - " + std::to_string(-disp) : " + " + std::to_string(disp);
+                return addr;
+            }
+            default:
+                assert(false && "not an address rule");
+                return {};
+        }
+    }
+
+    // emits the compare of a covered `==`
+    void isel_flags(IselEmit& sel, const NodeExpr* expr) {
+        const IselChoice choice = sel.sel[expr].rule(IselNt::Flags);
+        const auto [a, b] = InstructionSelector::operands(expr, choice);
+        switch (choice.rule) {
+            case IselRule::CmpRR: {
+                const auto [ra, rb] = isel_reg_pair(sel, a, b);
+                m_output << "   cmp " << isel_regs[ra].q << ", " << isel_regs[rb].q << "\n";
+                isel_release(sel, ra);
+                isel_release(sel, rb);
+                break;
+            }
+            case IselRule::CmpRI:
+            case IselRule::CmpRM: {
+                const size_t ra = isel_reg(sel, a);
+                m_output << "   cmp " << isel_regs[ra].q << ", "
+                         << isel_operand(sel, b, choice.rule == IselRule::CmpRI ? IselNt::Imm : IselNt::Mem) << "\n";
+                isel_release(sel, ra);
+                break;
+            }
+            default:
+                m_output << "   cmp " << isel_operand(sel, a, IselNt::Mem) << ", " << isel_operand(sel, b, IselNt::Imm) << "\n";
+                break;
+        }
+    }
+
+    void gen_call_expr(const NodeTermCall* call) {
+        if (m_inline.contains(call->ident.value.value())) {
+            gen_inline_call(call);
+        }else {
+            gen_call(call);
+        }
+    }
+
+    // restores the callee-saved registers and the caller's frame, leaves rax alone
+    void func_epilogue() {
+        m_output << "   lea rsp, [rbp - " << callee_saved.size() * 8 << "]\n";
+        for (const std::string& reg : callee_saved | std::views::reverse) {
+            m_output << "   pop " << reg << "\n";
+        }
+        m_output << "   pop rbp\n";
+    }
+
+    struct Var {
+        std::string name;
+        size_t stack_loc;
+        size_t byte = 0;                 // offset into the qword, for packed variables
+        IntType type = IntType::I64;
+    };
+
+    // the qword narrow variables of the current scope are being packed into
+    struct Pack {
+        bool open = false;
+        size_t stack_loc = 0;
+        size_t used = 0;                 // bytes
+    };
+
+    struct Scope {
+        size_t vars;
+        size_t stack_size;
+        Pack pack;                       // of the enclosing scope
+    };
+
+    // what gen_func and gen_parallel_worker put aside while they emit a body
+    struct SavedFrame {
+        size_t stack_size;
+        size_t frame_base;
+        size_t var_floor;
+        int line;
+        std::vector<Var> vars;
+        std::vector<Scope> scopes;
+        Pack pack;
+    };
+
+    SavedFrame save_frame() {
+        SavedFrame saved { .stack_size = m_stack_size, .frame_base = m_frame_base, .var_floor = m_var_floor,
+                           .line = m_line, .vars = std::move(m_vars), .scopes = std::move(m_scopes), .pack = m_pack };
+        m_pack = {};
+        return saved;
+    }
+
+    void restore_frame(SavedFrame saved) {
+        m_stack_size = saved.stack_size;
+        m_frame_base = saved.frame_base;
+        m_var_floor = saved.var_floor;
+        m_line = saved.line;
+        m_vars = std::move(saved.vars);
+        m_scopes = std::move(saved.scopes);
+        m_pack = saved.pack;
+    }
+
+    // variables of an inlined callee must not see the caller's locals
+    std::vector<Var>::const_iterator find_var(const Token& ident) const {
+        const auto it = std::ranges::find_if(m_vars.cbegin() + static_cast<std::ptrdiff_t>(m_var_floor), m_vars.cend(),
+            [&](const Var& var) {
+                return var.name == ident.value;
+            });
+        return it;
+    }
+
+    const Var& var_of(const Token& ident) const {
+        const auto it = find_var(ident);
+        if (it == m_vars.cend()) {
+            std::cerr << "Undeclared identifier: " << ident.value.value() << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        return *it;
+    }
+
+    // memory operand of a variable, sized to its type
+    std::string slot_of(const Var& var) const {
+        std::stringstream slot;
+        slot << size_of(var.type) << " [rsp + " << (m_stack_size - var.stack_loc - 1) * 8 + var.byte << "]";
+        return slot.str();
+    }
+
+    // operand for the stack slot of a declared variable
+    std::string var_slot(const Token& ident) const {
+        return slot_of(var_of(ident));
+    }
+
     std::string create_label(){
         std::stringstream ss;
         ss << "label_" << m_label_count++;
         return ss.str();
     }
 
-    struct Var {
-        std::string name;
-        size_t stack_loc;
+    // how a `return` leaves the current code: exit the process, return from a
+    // function frame, or jump to the end of an inlined body
+    struct ReturnCtx {
+        enum Kind { Exit, Func, Inline } kind;
+        std::string label{};
+        size_t base = 0;
+        IntType type = IntType::I64;     // of the value returned, Func and Inline only
     };
 
+    // rbx is the generator's scratch register next to rax
+    inline static const std::vector<std::string> callee_saved { "rbx" };
+    inline static const std::vector<std::string> arg_regs { "rdi", "rsi", "rdx", "rcx", "r8", "r9" };
+
     const NodeProg m_prog;
+    const CallGraph m_call_graph { m_prog };
+    CallGraph m_streamed_calls{};       // gen_top_level's statements, for their parallel for checks
+    std::unordered_set<std::string> m_inline{};
+    bool m_inline_enabled = true;
+    bool m_layout_enabled = true;
+    bool m_isel_enabled = true;
+    IselCosts m_isel_costs{};
+    std::string m_debug_source{};
+    std::string m_debug_asm{};
+    int m_line = 0;                    // of the last %line directive
+    std::vector<std::string> m_func_symbols{};
+    std::vector<ReturnCtx> m_return_ctx{};
+    size_t m_frame_base = 0; // qwords pushed between the last 16 byte boundary and the first slot
+    size_t m_var_floor = 0;
+    std::unordered_map<std::string, size_t> m_defined_funcs{}; // name -> number of parameters
+    std::set<std::pair<std::string, size_t>> m_unresolved_calls{}; // name, number of arguments
     std::stringstream m_output;
+    std::stringstream m_func_output;
+    std::stringstream m_worker_output; // parallel for bodies, may be emitted from inside a function
+    std::stringstream m_rodata;        // jump tables
+    std::ostream* m_stream = nullptr;  // see begin_stream
+    size_t m_stream_lines = 0;         // written to m_stream so far
     size_t m_stack_size = 0;
     std::vector<Var> m_vars{};
-    std::vector<size_t> m_scopes{};
+    std::vector<Scope> m_scopes{};
+    Pack m_pack{};
+    TypeChecker m_types{};
     int m_label_count = 0;
+    int m_worker_count = 0;
 };
\ No newline at end of file
@@ -0,0 +1,288 @@
+#pragma once
+
+#include <algorithm>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "lexer.hpp"
+#include "parser.hpp"
+
+// Replaces the bytes [begin, end) of the source with `text`.
+struct TextEdit {
+    size_t begin;
+    size_t end;
+    std::string text;
+};
+
+// Why an edit left the program as it was: the edit was out of range, or the
+// statements it touches no longer lex or parse.
+struct EditError {
+    std::string message;
+};
+
+// Front end for editors and watch mode. It keeps the source, the top-level
+// statements and the byte range each one covers, so an edit only re-lexes and
+// re-parses the statements it touches; every other NodeStmt is reused as is.
+//
+// The source is tiled into segments, one per top-level statement: a segment
+// starts where the previous statement's last token ends and ends after its own
+// last token, so it begins in a clean lexer state. The damaged window is the
+// run of segments around the edit. It grows by one segment while its tokens
+// could continue past the window: an open comment, unbalanced brackets, a last
+// token other than `;` or `}`, or a trailing `if` an `elif` could attach to.
+//
+// Re-parsed statements go into the same arena. The garbage is dropped by a full
+// rebuild once more tokens have been re-parsed than the whole source had.
+// Reused statements keep the line numbers they were parsed with, so `-g` line
+// info for code below an edit that added or removed lines is off until the
+// next rebuild.
+//
+// Lexer and parser errors never end the host process. An edit whose window
+// does not parse is still applied to the source, but the window keeps its
+// previous statements and stays damaged: later edits re-parse it along with
+// their own window until it parses again. program() is the last good parse of
+// every statement.
+class IncrementalCompiler {
+public:
+    // the source has to parse, there is no previous program to fall back to
+    explicit IncrementalCompiler(std::string src) : m_src(std::move(src)) {
+        rebuild();
+    }
+
+    IncrementalCompiler(const IncrementalCompiler&) = delete;
+    IncrementalCompiler& operator=(const IncrementalCompiler&) = delete;
+
+    [[nodiscard]] const NodeProg& program() const {
+        return m_prog;
+    }
+
+    [[nodiscard]] const std::string& source() const {
+        return m_src;
+    }
+
+    [[nodiscard]] bool damaged() const {
+        return m_damaged.has_value();
+    }
+
+    std::optional<EditError> apply(const TextEdit& edit) {
+        if (edit.begin > edit.end || edit.end > m_src.size()) {
+            return EditError { "Edit out of range: [" + std::to_string(edit.begin) + ", " + std::to_string(edit.end) + ") of "
+                               + std::to_string(m_src.size()) + " bytes" };
+        }
+        const int line_delta = newlines(edit.text) - newlines(std::string_view(m_src).substr(edit.begin, edit.end - edit.begin));
+        const std::ptrdiff_t delta = static_cast<std::ptrdiff_t>(edit.text.size()) - static_cast<std::ptrdiff_t>(edit.end - edit.begin);
+        m_src.replace(edit.begin, edit.end - edit.begin, edit.text);
+
+        // segments first..last are damaged, index size() stands for the tail
+        size_t first = segment_at(edit.begin);
+        size_t last = std::max(first, segment_at(edit.end));
+        if (m_damaged.has_value()) {
+            first = std::min(first, m_damaged->first);
+            last = std::max(last, m_damaged->second);
+        }
+        if (first > 0 && std::holds_alternative<NodeStmtIf*>(m_prog.stmts[first - 1]->var)) {
+            first--; // the edit may start an `elif` that belongs to it
+        }
+        try {
+            while (true) {
+                const size_t begin = segment_begin(first);
+                const size_t end = window_end(last, delta);
+                std::vector<Segment> segments;
+                std::vector<NodeStmt*> stmts;
+                if (relex_window(begin, end, first_line(first), segments, stmts)) {
+                    splice(first, last, segments, stmts, delta, line_delta);
+                    break;
+                }
+                last++;
+            }
+        } catch (const SyntaxError& e) {
+            keep_damaged(first, last, delta, line_delta);
+            return EditError { e.what() };
+        }
+        m_damaged.reset();
+        if (m_reparsed_tokens > m_full_tokens) {
+            rebuild();
+        }
+        return {};
+    }
+
+private:
+    struct Segment {
+        size_t end;  // byte after the statement's last token
+        int line;    // line of the segment's first byte
+    };
+
+    static int newlines(const std::string_view text) {
+        return static_cast<int>(std::ranges::count(text, '\n'));
+    }
+
+    static size_t shifted(const size_t offset, const std::ptrdiff_t delta) {
+        return static_cast<size_t>(static_cast<std::ptrdiff_t>(offset) + delta);
+    }
+
+    // index of the segment holding byte `offset`, size() for the tail
+    size_t segment_at(const size_t offset) const {
+        const auto it = std::ranges::upper_bound(m_segments, offset, {}, &Segment::end);
+        return static_cast<size_t>(it - m_segments.begin());
+    }
+
+    size_t segment_begin(const size_t index) const {
+        return index == 0 ? 0 : m_segments[index - 1].end;
+    }
+
+    int first_line(const size_t index) const {
+        return index < m_segments.size() ? m_segments[index].line : m_tail_line;
+    }
+
+    // in the edited source, the end of segment `last` was shifted by `delta`
+    size_t window_end(const size_t last, const std::ptrdiff_t delta) const {
+        return last == m_segments.size() ? m_src.size() : shifted(m_segments[last].end, delta);
+    }
+
+    // The window first..last did not parse: its statements stay, the segments
+    // after it move with the edit, and its own segments are clamped into it so
+    // the ends stay sorted. The next apply re-parses the whole window.
+    void keep_damaged(const size_t first, const size_t last, const std::ptrdiff_t delta, const int line_delta) {
+        const size_t end = window_end(last, delta);
+        const size_t after = std::min(last + 1, m_segments.size());
+        for (size_t i = first; i < after; i++) {
+            m_segments[i].end = std::min(m_segments[i].end, end);
+        }
+        if (last < m_segments.size()) {
+            m_segments[last].end = end;
+            for (size_t i = after; i < m_segments.size(); i++) {
+                m_segments[i].end = shifted(m_segments[i].end, delta);
+                m_segments[i].line += line_delta;
+            }
+            m_tail_line += line_delta;
+        }
+        m_damaged = { first, last };
+    }
+
+    // Lexes and parses [begin, end) of the source into top-level statements.
+    // False when the window has to grow because its text runs on past `end`.
+    bool relex_window(const size_t begin, const size_t end, const int line,
+            std::vector<Segment>& segments, std::vector<NodeStmt*>& stmts) {
+        const std::string_view window = std::string_view(m_src).substr(begin, end - begin);
+        const size_t newline = begin == 0 ? std::string::npos : m_src.rfind('\n', begin - 1);
+        const int column = static_cast<int>(begin - (newline == std::string::npos ? 0 : newline + 1)) + 1;
+        std::vector<size_t> token_ends;
+        Tokenizer tokenizer(window, line, column);
+        tokenizer.record_token_ends(token_ends);
+        tokenizer.throw_errors();
+        std::vector<Token> tokens = tokenizer.tokenize();
+        m_reparsed_tokens += tokens.size();
+        const bool at_eof = end == m_src.size();
+        if (!at_eof && !closes_cleanly(tokens, tokenizer)) {
+            return false;
+        }
+        m_parser->reset_tokens(std::move(tokens));
+        int seg_line = line;
+        size_t seg_begin = 0;
+        while (const auto stmt = m_parser->parse_next()) {
+            const size_t seg_end = token_ends[m_parser->position() - 1];
+            segments.push_back({ .end = begin + seg_end, .line = seg_line });
+            stmts.push_back(stmt.value());
+            seg_line += newlines(window.substr(seg_begin, seg_end - seg_begin));
+            seg_begin = seg_end;
+        }
+        m_window_line = seg_line;
+        return at_eof || stmts.empty() || !std::holds_alternative<NodeStmtIf*>(stmts.back()->var);
+    }
+
+    static bool closes_cleanly(const std::vector<Token>& tokens, const Tokenizer& tokenizer) {
+        if (tokenizer.ended_in_comment()) {
+            return false;
+        }
+        if (tokens.size() == 1) {
+            return true; // only EOF: the window is trivia
+        }
+        const TokenType last = tokens[tokens.size() - 2].type;
+        if (last != TokenType::Token_Semi && last != TokenType::Token_RBracket) {
+            return false;
+        }
+        int depth = 0;
+        for (const Token& tok : tokens) {
+            switch (tok.type) {
+                case TokenType::Token_LParen:
+                case TokenType::Token_LBracket:
+                case TokenType::Token_LSquare: depth++; break;
+                case TokenType::Token_RParen:
+                case TokenType::Token_RBracket:
+                case TokenType::Token_RSquare: depth--; break;
+                default: break;
+            }
+        }
+        return depth == 0;
+    }
+
+    void splice(const size_t first, const size_t last, const std::vector<Segment>& segments,
+            const std::vector<NodeStmt*>& stmts, const std::ptrdiff_t delta, const int line_delta) {
+        const bool tail = last == m_segments.size();
+        const auto removed = static_cast<std::ptrdiff_t>(std::min(last + 1, m_segments.size()) - first);
+        const auto at = static_cast<std::ptrdiff_t>(first);
+        if (removed == static_cast<std::ptrdiff_t>(segments.size())) {
+            // the common case, one statement edited in place
+            std::ranges::copy(segments, m_segments.begin() + at);
+            std::ranges::copy(stmts, m_prog.stmts.begin() + at);
+        }else {
+            m_segments.erase(m_segments.begin() + at, m_segments.begin() + at + removed);
+            m_prog.stmts.erase(m_prog.stmts.begin() + at, m_prog.stmts.begin() + at + removed);
+            m_segments.insert(m_segments.begin() + at, segments.begin(), segments.end());
+            m_prog.stmts.insert(m_prog.stmts.begin() + at, stmts.begin(), stmts.end());
+        }
+        if (tail) {
+            m_tail_line = m_window_line;
+            return;
+        }
+        if (delta == 0 && line_delta == 0) {
+            return;
+        }
+        for (size_t i = first + segments.size(); i < m_segments.size(); i++) {
+            m_segments[i].end = shifted(m_segments[i].end, delta);
+            m_segments[i].line += line_delta;
+        }
+        m_tail_line += line_delta;
+    }
+
+    // builds the new state aside, so a SyntaxError leaves the old one intact
+    void rebuild() {
+        std::vector<size_t> token_ends;
+        Tokenizer tokenizer(m_src, 1);
+        tokenizer.record_token_ends(token_ends);
+        tokenizer.throw_errors();
+        std::vector<Token> tokens = tokenizer.tokenize();
+        const size_t full_tokens = tokens.size();
+        Parser parser(std::move(tokens));
+        parser.throw_errors();
+        NodeProg prog;
+        std::vector<Segment> segments;
+        int line = 1;
+        size_t seg_begin = 0;
+        while (const auto stmt = parser.parse_next()) {
+            const size_t seg_end = token_ends[parser.position() - 1];
+            segments.push_back({ .end = seg_end, .line = line });
+            prog.stmts.push_back(stmt.value());
+            line += newlines(std::string_view(m_src).substr(seg_begin, seg_end - seg_begin));
+            seg_begin = seg_end;
+        }
+        m_parser.emplace(std::move(parser));
+        m_prog = std::move(prog);
+        m_segments = std::move(segments);
+        m_tail_line = line;
+        m_full_tokens = full_tokens;
+        m_reparsed_tokens = 0;
+    }
+
+    std::string m_src;
+    std::optional<Parser> m_parser{};
+    NodeProg m_prog{};
+    std::vector<Segment> m_segments{};  // parallel to m_prog.stmts
+    int m_tail_line = 1;                // line where the trivia after the last statement starts
+    int m_window_line = 1;              // line after the last statement of the window
+    size_t m_full_tokens = 0;           // tokens of the source at the last rebuild
+    size_t m_reparsed_tokens = 0;       // since then
+    std::optional<std::pair<size_t, size_t>> m_damaged{}; // segments first..last that did not parse
+};
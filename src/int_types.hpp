@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+// The integer types of the language; `int` is i64. A value of any type is
+// carried around as 64 bits, sign or zero extended from its width, so going
+// to a 64-bit type never changes the bits and going to a narrower one keeps
+// the low bytes and extends them again.
+enum class IntType : uint8_t { I8, I16, I32, I64, U8, U16, U32, U64 };
+
+inline std::optional<IntType> int_type_from(const std::string_view spelling) {
+    if (spelling == "int" || spelling == "i64") { return IntType::I64; }
+    if (spelling == "i8") { return IntType::I8; }
+    if (spelling == "i16") { return IntType::I16; }
+    if (spelling == "i32") { return IntType::I32; }
+    if (spelling == "u8") { return IntType::U8; }
+    if (spelling == "u16") { return IntType::U16; }
+    if (spelling == "u32") { return IntType::U32; }
+    if (spelling == "u64") { return IntType::U64; }
+    return {};
+}
+
+inline const char* int_type_name(const IntType type) {
+    switch (type) {
+        case IntType::I8: return "i8";
+        case IntType::I16: return "i16";
+        case IntType::I32: return "i32";
+        case IntType::I64: return "i64";
+        case IntType::U8: return "u8";
+        case IntType::U16: return "u16";
+        case IntType::U32: return "u32";
+        case IntType::U64: return "u64";
+    }
+    return "?";
+}
+
+inline constexpr size_t int_type_bytes(const IntType type) {
+    switch (type) {
+        case IntType::I8: case IntType::U8: return 1;
+        case IntType::I16: case IntType::U16: return 2;
+        case IntType::I32: case IntType::U32: return 4;
+        default: return 8;
+    }
+}
+
+inline constexpr bool int_type_signed(const IntType type) {
+    return type <= IntType::I64;
+}
+
+// operands narrower than 32 bits are widened to i32 before any arithmetic
+inline constexpr IntType promote(const IntType type) {
+    return int_type_bytes(type) < 4 ? IntType::I32 : type;
+}
+
+// Type an arithmetic operation or comparison is carried out in: the wider of
+// the promoted operands, unsigned when they are as wide and one is unsigned.
+inline constexpr IntType common_type(const IntType lhs, const IntType rhs) {
+    const IntType l = promote(lhs);
+    const IntType r = promote(rhs);
+    if (int_type_bytes(l) != int_type_bytes(r)) {
+        return int_type_bytes(l) > int_type_bytes(r) ? l : r;
+    }
+    return int_type_signed(l) ? r : l;
+}
+
+// false when every value of `from` is also a value of `to`, so the
+// conversion needs no instruction
+inline constexpr bool needs_narrowing(const IntType from, const IntType to) {
+    if (int_type_bytes(to) == 8) {
+        return false;
+    }
+    if (int_type_signed(from) == int_type_signed(to)) {
+        return int_type_bytes(from) > int_type_bytes(to);
+    }
+    return int_type_signed(from) || int_type_bytes(from) >= int_type_bytes(to);
+}
+
+// 64-bit types take any 64-bit pattern, e.g. 18446744073709551615 is -1 as an i64
+inline constexpr bool literal_fits(const uint64_t value, const IntType type) {
+    const size_t bits = int_type_bytes(type) * 8;
+    if (bits == 64) {
+        return true;
+    }
+    return value <= (uint64_t { 1 } << (int_type_signed(type) ? bits - 1 : bits)) - 1;
+}
+
+// the 64-bit form of `value` converted to `type`
+inline constexpr int64_t narrow_to(const int64_t value, const IntType type) {
+    switch (type) {
+        case IntType::I8: return static_cast<int8_t>(value);
+        case IntType::I16: return static_cast<int16_t>(value);
+        case IntType::I32: return static_cast<int32_t>(value);
+        case IntType::U8: return static_cast<uint8_t>(value);
+        case IntType::U16: return static_cast<uint16_t>(value);
+        case IntType::U32: return static_cast<uint32_t>(value);
+        default: return value;
+    }
+}
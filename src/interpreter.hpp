@@ -0,0 +1,366 @@
+#pragma once
+
+#include <algorithm>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <iterator>
+#include <limits>
+#include <charconv>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <vector>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "bytecode.hpp"
+#include "runtime.hpp"
+
+// The region heap of the native runtime (hy_alloc/hy_reset) over real memory:
+// same chunk sizes, same alignment and the same reuse after a reset, so a
+// program sees the same contents in both modes; only the addresses differ.
+class RegionHeap {
+public:
+    RegionHeap() = default;
+    RegionHeap(const RegionHeap&) = delete;
+    RegionHeap& operator=(const RegionHeap&) = delete;
+
+    ~RegionHeap() {
+        for (Chunk* chunk = m_first; chunk != nullptr;) {
+            Chunk* const next = chunk->next;
+            munmap(chunk, chunk->size);
+            chunk = next;
+        }
+    }
+
+    // nullptr when the request is absurd or mmap fails
+    std::byte* alloc(const int64_t qwords) {
+        if (static_cast<uint64_t>(qwords) >> runtime_heap_max_qwords_log2 != 0) {
+            return nullptr;
+        }
+        const uint64_t bytes = (static_cast<uint64_t>(qwords) * 8 + 15) & ~uint64_t { 15 };
+        if (bytes > static_cast<uint64_t>(m_end - m_ptr) && !use_chunk_for(bytes)) {
+            return nullptr;
+        }
+        std::byte* const block = m_ptr;
+        m_ptr += bytes;
+        return block;
+    }
+
+    void reset() {
+        if (m_first != nullptr) {
+            use(m_first);
+        }
+    }
+
+private:
+    struct Chunk {
+        Chunk* next;
+        uint64_t size;   // including this header
+    };
+    static_assert(sizeof(Chunk) == 16);
+
+    bool use_chunk_for(const uint64_t bytes) {
+        Chunk* last = m_cur;
+        for (Chunk* next = m_cur != nullptr ? m_cur->next : nullptr; next != nullptr; next = next->next) {
+            if (bytes <= next->size - sizeof(Chunk)) {
+                use(next);
+                return true;
+            }
+            last = next; // too small, it waits for the next reset
+        }
+        const uint64_t size = std::max<uint64_t>(runtime_heap_chunk_size, bytes + sizeof(Chunk));
+        void* const mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) {
+            return false;
+        }
+        auto chunk = new (mem) Chunk { .next = nullptr, .size = size };
+        (last != nullptr ? last->next : m_first) = chunk;
+        use(chunk);
+        return true;
+    }
+
+    void use(Chunk* chunk) {
+        m_cur = chunk;
+        m_ptr = reinterpret_cast<std::byte*>(chunk) + sizeof(Chunk);
+        m_end = reinterpret_cast<std::byte*>(chunk) + chunk->size;
+    }
+
+    Chunk* m_first = nullptr;
+    Chunk* m_cur = nullptr;
+    std::byte* m_ptr = nullptr;
+    std::byte* m_end = nullptr;
+};
+
+// Threaded interpreter for BytecodeProgram. With GCC/Clang every handler jumps
+// straight to the next one through a computed goto, so there is no central
+// dispatch branch for the predictor to thrash on. Arithmetic wraps like the
+// native x86-64 code and division traps the same way `idiv` does.
+class Interpreter {
+public:
+    explicit Interpreter(const BytecodeProgram& program)
+        : m_program(program), m_regs(program.num_regs, 0)
+    {
+    }
+
+    [[nodiscard]] int64_t run() {
+        const Instr* const code = m_program.code.data();
+        const int64_t* const constants = m_program.constants.data();
+        const BytecodeFunction* const functions = m_program.functions.data();
+        const SwitchTable* const switch_tables = m_program.switch_tables.data();
+        size_t base = 0;
+        size_t frame_size = m_program.num_regs;
+        int64_t* r = m_regs.data();
+        const Instr* ip = code;
+
+#if defined(__GNUC__)
+        static void* const dispatch_table[] = {
+            &&op_load_imm, &&op_move, &&op_narrow, &&op_add, &&op_sub, &&op_mul, &&op_div, &&op_div_u, &&op_equal,
+            &&op_add_imm, &&op_sub_imm, &&op_mul_imm, &&op_equal_imm,
+            &&op_jump, &&op_jump_if_zero, &&op_jump_if_not_equal, &&op_jump_if_not_equal_imm, &&op_jump_if_not_less,
+            &&op_exit, &&op_call, &&op_tail_call, &&op_ret, &&op_switch, &&op_print,
+            &&op_alloc, &&op_reset, &&op_load, &&op_store,
+        };
+        static_assert(std::size(dispatch_table) == static_cast<size_t>(OpCode::Count));
+#define DISPATCH() goto *dispatch_table[static_cast<size_t>(ip->op)]
+#define CASE(label, opcode) label:
+#else
+#define DISPATCH() goto dispatch
+#define CASE(label, opcode) case OpCode::opcode:
+#endif
+
+        DISPATCH();
+#if !defined(__GNUC__)
+    dispatch:
+        switch (ip->op) {
+#endif
+        CASE(op_load_imm, LoadImm)
+            r[ip->a] = ip->imm;
+            ++ip;
+            DISPATCH();
+        CASE(op_move, Move)
+            r[ip->a] = r[ip->b];
+            ++ip;
+            DISPATCH();
+        CASE(op_narrow, Narrow)
+            r[ip->a] = narrow_to(r[ip->b], static_cast<IntType>(ip->imm));
+            ++ip;
+            DISPATCH();
+        CASE(op_add, Add)
+            r[ip->a] = wrap(static_cast<uint64_t>(r[ip->b]) + static_cast<uint64_t>(r[ip->c]));
+            ++ip;
+            DISPATCH();
+        CASE(op_sub, Sub)
+            r[ip->a] = wrap(static_cast<uint64_t>(r[ip->b]) - static_cast<uint64_t>(r[ip->c]));
+            ++ip;
+            DISPATCH();
+        CASE(op_mul, Mul)
+            r[ip->a] = wrap(static_cast<uint64_t>(r[ip->b]) * static_cast<uint64_t>(r[ip->c]));
+            ++ip;
+            DISPATCH();
+        CASE(op_div, Div)
+            r[ip->a] = divide(r[ip->b], r[ip->c]);
+            ++ip;
+            DISPATCH();
+        CASE(op_div_u, DivU)
+            r[ip->a] = divide_unsigned(r[ip->b], r[ip->c]);
+            ++ip;
+            DISPATCH();
+        CASE(op_equal, Equal)
+            r[ip->a] = r[ip->b] == r[ip->c];
+            ++ip;
+            DISPATCH();
+        CASE(op_add_imm, AddImm)
+            r[ip->a] = wrap(static_cast<uint64_t>(r[ip->b]) + static_cast<uint64_t>(ip->imm));
+            ++ip;
+            DISPATCH();
+        CASE(op_sub_imm, SubImm)
+            r[ip->a] = wrap(static_cast<uint64_t>(r[ip->b]) - static_cast<uint64_t>(ip->imm));
+            ++ip;
+            DISPATCH();
+        CASE(op_mul_imm, MulImm)
+            r[ip->a] = wrap(static_cast<uint64_t>(r[ip->b]) * static_cast<uint64_t>(ip->imm));
+            ++ip;
+            DISPATCH();
+        CASE(op_equal_imm, EqualImm)
+            r[ip->a] = r[ip->b] == ip->imm;
+            ++ip;
+            DISPATCH();
+        CASE(op_jump, Jump)
+            ip = code + ip->imm;
+            DISPATCH();
+        CASE(op_jump_if_zero, JumpIfZero)
+            ip = r[ip->a] == 0 ? code + ip->imm : ip + 1;
+            DISPATCH();
+        CASE(op_jump_if_not_equal, JumpIfNotEqual)
+            ip = r[ip->a] != r[ip->b] ? code + ip->imm : ip + 1;
+            DISPATCH();
+        CASE(op_jump_if_not_equal_imm, JumpIfNotEqualImm)
+            ip = r[ip->a] != constants[ip->c] ? code + ip->imm : ip + 1;
+            DISPATCH();
+        CASE(op_jump_if_not_less, JumpIfNotLess)
+            ip = r[ip->a] >= r[ip->b] ? code + ip->imm : ip + 1;
+            DISPATCH();
+        CASE(op_exit, Exit)
+            flush();
+            return r[ip->a];
+        CASE(op_call, Call)
+        {
+            const BytecodeFunction& function = functions[ip->imm];
+            const size_t callee_base = base + frame_size;
+            reserve(callee_base + function.num_regs);
+            r = m_regs.data() + base;
+            std::copy_n(r + ip->b, ip->c, m_regs.data() + callee_base);
+            m_frames.push_back({ .ret = ip + 1, .base = base, .frame_size = frame_size, .dst = ip->a });
+            base = callee_base;
+            frame_size = function.num_regs;
+            r = m_regs.data() + base;
+            ip = code + function.entry;
+            DISPATCH();
+        }
+        CASE(op_tail_call, TailCall)
+        {
+            const BytecodeFunction& function = functions[ip->imm];
+            reserve(base + function.num_regs);
+            r = m_regs.data() + base;
+            for (uint16_t i = 0; i < ip->c; i++) {
+                r[i] = r[ip->b + i]; // arguments sit above the frame's variables
+            }
+            frame_size = function.num_regs;
+            ip = code + function.entry;
+            DISPATCH();
+        }
+        CASE(op_ret, Ret)
+        {
+            const int64_t value = r[ip->a];
+            const Frame frame = m_frames.back();
+            m_frames.pop_back();
+            base = frame.base;
+            frame_size = frame.frame_size;
+            r = m_regs.data() + base;
+            r[frame.dst] = value;
+            ip = frame.ret;
+            DISPATCH();
+        }
+        CASE(op_switch, Switch)
+            ip = code + switch_tables[ip->imm].target(r[ip->a]);
+            DISPATCH();
+        CASE(op_print, Print)
+            if (ip->b != 0) {
+                print(static_cast<uint64_t>(r[ip->a]));
+            }else {
+                print(r[ip->a]);
+            }
+            ++ip;
+            DISPATCH();
+        CASE(op_alloc, Alloc)
+        {
+            std::byte* const block = m_heap.alloc(r[ip->b]);
+            if (block == nullptr) {
+                out_of_memory();
+            }
+            r[ip->a] = static_cast<int64_t>(reinterpret_cast<uintptr_t>(block));
+            ++ip;
+            DISPATCH();
+        }
+        CASE(op_reset, Reset)
+            m_heap.reset();
+            ++ip;
+            DISPATCH();
+        CASE(op_load, Load)
+            r[ip->a] = *address(r[ip->b], r[ip->c]);
+            ++ip;
+            DISPATCH();
+        CASE(op_store, Store)
+            *address(r[ip->a], r[ip->b]) = r[ip->c];
+            ++ip;
+            DISPATCH();
+#if !defined(__GNUC__)
+            default:
+                break;
+        }
+        return 0;
+#endif
+#undef DISPATCH
+#undef CASE
+    }
+
+private:
+    struct Frame {
+        const Instr* ret;
+        size_t base;
+        size_t frame_size;
+        uint16_t dst;
+    };
+
+    // base + index * 8 with the wrap-around of the native addressing mode
+    static int64_t* address(const int64_t base, const int64_t index) {
+        return reinterpret_cast<int64_t*>(static_cast<uintptr_t>(base) + static_cast<uintptr_t>(index) * 8);
+    }
+
+    // same bytes and the same flush points as hy_print and hy_print_u in the native runtime
+    template <typename T> void print(const T value) {
+        char digits[24];
+        const auto [end, ec] = std::to_chars(digits, digits + sizeof(digits) - 1, value);
+        *end = '\n';
+        const size_t len = static_cast<size_t>(end + 1 - digits);
+        if (m_out_len + len > runtime_out_buf_size) {
+            flush();
+        }
+        std::memcpy(m_out.get() + m_out_len, digits, len);
+        m_out_len += len;
+    }
+
+    void flush() {
+        size_t done = 0;
+        while (done < m_out_len) {
+            const ssize_t n = write(STDOUT_FILENO, m_out.get() + done, m_out_len - done);
+            if (n <= 0) {
+                break;
+            }
+            done += static_cast<size_t>(n);
+        }
+        m_out_len = 0;
+    }
+
+    // like hy_oom: report, then exit with status 1 after flushing the output
+    [[noreturn]] void out_of_memory() {
+        [[maybe_unused]] const ssize_t n = write(STDERR_FILENO, runtime_oom_message.data(), runtime_oom_message.size());
+        flush();
+        exit(EXIT_FAILURE);
+    }
+
+    void reserve(const size_t num_regs) {
+        if (num_regs > m_regs.size()) {
+            m_regs.resize(std::max(num_regs, m_regs.size() * 2));
+        }
+    }
+
+    static int64_t wrap(const uint64_t value) {
+        return static_cast<int64_t>(value);
+    }
+
+    static int64_t divide(const int64_t lhs, const int64_t rhs) {
+        if (rhs == 0 || (lhs == std::numeric_limits<int64_t>::min() && rhs == -1)) {
+            // `idiv` raises #DE for both cases, which Linux delivers as SIGFPE
+            std::raise(SIGFPE);
+            exit(128 + SIGFPE);
+        }
+        return lhs / rhs;
+    }
+
+    static int64_t divide_unsigned(const int64_t lhs, const int64_t rhs) {
+        if (rhs == 0) {
+            std::raise(SIGFPE);
+            exit(128 + SIGFPE);
+        }
+        return static_cast<int64_t>(static_cast<uint64_t>(lhs) / static_cast<uint64_t>(rhs));
+    }
+
+    const BytecodeProgram& m_program;
+    std::vector<int64_t> m_regs;
+    std::vector<Frame> m_frames{};
+    std::unique_ptr<char[]> m_out { new char[runtime_out_buf_size] };
+    size_t m_out_len = 0;
+    RegionHeap m_heap{};
+};
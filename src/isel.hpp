@@ -0,0 +1,290 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+#include "parser.hpp"
+#include "type_check.hpp"
+
+// Cost of every instruction form the selector picks from. The defaults count
+// instructions; raise a form to steer the selector away from it.
+struct IselCosts {
+    uint32_t mov_imm = 1;   // mov r, imm
+    uint32_t load = 1;      // mov r, [m], or movsx/movzx of a narrow variable
+    uint32_t lea = 1;       // lea r, [b + i*k + d]
+    uint32_t alu = 1;       // add/sub r, r
+    uint32_t alu_imm = 1;   // add/sub r, imm
+    uint32_t alu_mem = 1;   // add/sub r, [m]
+    uint32_t imul = 1;      // imul r, r
+    uint32_t imul_imm = 1;  // imul r, r, imm and imul r, [m], imm
+    uint32_t imul_mem = 1;  // imul r, [m]
+    uint32_t shift = 1;     // shl r, k for a power of two factor
+    uint32_t cmp = 1;       // cmp r, r and cmp r, imm
+    uint32_t cmp_mem = 1;   // cmp r, [m] and cmp [m], imm
+    uint32_t setcc = 2;     // sete + movzx, `==` wanted as a value
+};
+
+// What a covered subtree can be reduced to: a value in a register, a
+// sign-extended 32-bit immediate, a qword memory operand, the parts of an
+// address (`i*k`, `b + i*k`, `b + i*k + d`) or the flags of a compare.
+enum class IselNt : uint8_t { Reg, Imm, Mem, Index, Sib, Addr, Flags, Count };
+
+// The patterns, by the nonterminal they produce. `a` and `b` are the operands
+// after a commutative swap.
+enum class IselRule : uint8_t {
+    None,
+    Imm,         // Imm   literal
+    MovImm,      // Reg   mov r, imm64 for a literal too wide for Imm
+    Var,         // Mem   a 64-bit variable's slot
+    LoadVar,     // Reg   movsx/movzx/mov r, a narrower variable
+    Stack,       // Mem   anything else, pushed by the stack machine beforehand
+    LoadImm,     // Reg   mov r, Imm
+    Load,        // Reg   mov r, Mem
+    Lea,         // Reg   lea r, [Addr]
+    SetCc,       // Reg   cmp ...; sete; movzx
+    AluRR,       // Reg   add/sub Reg(a), Reg(b)
+    AluRI,       // Reg   add/sub Reg(a), Imm(b)
+    AluRM,       // Reg   add/sub Reg(a), Mem(b)
+    ImulRR,      // Reg   imul Reg(a), Reg(b)
+    ImulRM,      // Reg   imul Reg(a), Mem(b)
+    ImulRI,      // Reg   imul Reg(a), Reg(a), Imm(b)
+    ImulMI,      // Reg   imul r, Mem(a), Imm(b)
+    Shl,         // Reg   shl Reg(a), log2 Imm(b)
+    Scale,       // Index Reg(a) * Imm(b), b in {2, 4, 8}
+    BaseIndex,   // Sib   Reg(a) + Reg(b)
+    BaseScaled,  // Sib   Reg(a) + Index(b)
+    AddrSib,     // Addr  Sib
+    AddrDisp,    // Addr  Sib(a) + Imm(b), or - Imm(b) for a subtraction
+    AddrScaled,  // Addr  Index(a) + Imm(b)
+    CmpRR,       // Flags cmp Reg(a), Reg(b)
+    CmpRI,       // Flags cmp Reg(a), Imm(b)
+    CmpRM,       // Flags cmp Reg(a), Mem(b)
+    CmpMI,       // Flags cmp Mem(a), Imm(b)
+};
+
+struct IselChoice {
+    IselRule rule = IselRule::None;
+    bool swap = false;  // operands taken as (rhs, lhs)
+};
+
+struct IselLabel {
+    static constexpr uint32_t infinite = std::numeric_limits<uint32_t>::max() / 4;
+    std::array<uint32_t, static_cast<size_t>(IselNt::Count)> cost{};
+    std::array<IselChoice, static_cast<size_t>(IselNt::Count)> choice{};
+    int64_t imm = 0;    // of a literal
+    uint32_t need = 1;  // registers to compute Reg (Sethi-Ullman)
+    bool stack = false; // left to the stack machine
+
+    [[nodiscard]] uint32_t at(const IselNt nt) const { return cost[static_cast<size_t>(nt)]; }
+    [[nodiscard]] IselChoice rule(const IselNt nt) const { return choice[static_cast<size_t>(nt)]; }
+};
+
+// Bottom-up tree pattern matcher over an expression: every node gets the
+// cheapest rule for every nonterminal (dynamic programming as in BURG), the
+// code generator then walks the chosen cover from the root down. `+`, `-`, `*`
+// and `==` on 64-bit values are covered, literals and variables are leaves and
+// everything else (calls, alloc, indexing, division, 32-bit arithmetic) is a
+// Stack leaf the stack machine evaluates first. A subtree whose register need
+// exceeds `num_regs` also becomes a Stack leaf, and so does one rooted deeper
+// than max_cover_depth, which bounds the recursion here and in the emitter.
+class InstructionSelector {
+public:
+    static constexpr size_t max_cover_depth = 64;
+
+    InstructionSelector(const IselCosts& costs, const uint32_t num_regs) : m_costs(costs), m_num_regs(num_regs) {}
+
+    static const NodeExpr* strip_parens(const NodeExpr* expr) {
+        while (const auto term = std::get_if<NodeTerm*>(&expr->var)) {
+            const auto paren = std::get_if<NodeTermParen*>(&(*term)->var);
+            if (paren == nullptr) {
+                break;
+            }
+            expr = (*paren)->expr;
+        }
+        return expr;
+    }
+
+    // whether `expr` is an operation the selector covers, as opposed to a leaf
+    static bool coverable(const NodeExpr* expr) {
+        expr = strip_parens(expr);
+        const auto bin = std::get_if<NodeBinExpr*>(&expr->var);
+        if (bin == nullptr || std::holds_alternative<NodeBinExprDiv*>((*bin)->var)) {
+            return false;
+        }
+        if (const auto equal = std::get_if<NodeBinExprEqual*>(&(*bin)->var)) {
+            return int_type_bytes(common_type((*equal)->lhs->type, (*equal)->rhs->type)) == 8;
+        }
+        return int_type_bytes(expr->type) == 8;
+    }
+
+    // `depth` operators below the root of the cover
+    const IselLabel& label(const NodeExpr* expr, const size_t depth = 0) {
+        expr = strip_parens(expr);
+        if (const auto it = m_labels.find(expr); it != m_labels.end()) {
+            return it->second;
+        }
+        IselLabel l;
+        l.cost.fill(IselLabel::infinite);
+        if (!coverable(expr)) {
+            leaf(expr, l);
+        }else if (depth > max_cover_depth) {
+            stack_leaf(l);
+        }else {
+            std::visit([&](const auto* bin) { binary(bin, l, depth); }, std::get<NodeBinExpr*>(expr->var)->var);
+        }
+        close(l);
+        return m_labels.insert_or_assign(expr, l).first->second;
+    }
+
+    const IselLabel& operator[](const NodeExpr* expr) const {
+        return m_labels.at(strip_parens(expr));
+    }
+
+    // the Stack leaves of the cover below `expr`, left to right
+    void stack_operands(const NodeExpr* expr, std::vector<const NodeExpr*>& out) const {
+        expr = strip_parens(expr);
+        if (m_labels.at(expr).stack) {
+            out.push_back(expr);
+            return;
+        }
+        if (const auto bin = std::get_if<NodeBinExpr*>(&expr->var)) {
+            std::visit([&](const auto* op) {
+                stack_operands(op->lhs, out);
+                stack_operands(op->rhs, out);
+            }, (*bin)->var);
+        }
+    }
+
+    // (lhs, rhs) of a covered node, swapped when the rule says so
+    static std::pair<const NodeExpr*, const NodeExpr*> operands(const NodeExpr* expr, const IselChoice choice) {
+        return std::visit([&](const auto* bin) {
+            return choice.swap ? std::pair { bin->rhs, bin->lhs } : std::pair { bin->lhs, bin->rhs };
+        }, std::get<NodeBinExpr*>(strip_parens(expr)->var)->var);
+    }
+
+private:
+    static void set(IselLabel& l, const IselNt nt, const uint32_t cost, const IselRule rule, const bool swap = false) {
+        if (cost < l.cost[static_cast<size_t>(nt)]) {
+            l.cost[static_cast<size_t>(nt)] = cost;
+            l.choice[static_cast<size_t>(nt)] = { .rule = rule, .swap = swap };
+        }
+    }
+
+    static bool fits_imm32(const int64_t value) {
+        return value >= INT32_MIN && value <= INT32_MAX;
+    }
+
+    void leaf(const NodeExpr* expr, IselLabel& l) const {
+        if (const auto term = std::get_if<NodeTerm*>(&expr->var)) {
+            if (const auto lit = std::get_if<NodeTermInt*>(&(*term)->var)) {
+                l.imm = static_cast<int64_t>(TypeChecker::literal_value((*lit)->int_lit));
+                if (fits_imm32(l.imm)) {
+                    set(l, IselNt::Imm, 0, IselRule::Imm);
+                }else {
+                    set(l, IselNt::Reg, m_costs.mov_imm, IselRule::MovImm);
+                }
+                return;
+            }
+            if (std::holds_alternative<NodeTermIdent*>((*term)->var)) {
+                if (int_type_bytes(expr->type) == 8) {
+                    set(l, IselNt::Mem, 0, IselRule::Var);
+                }else {
+                    set(l, IselNt::Reg, m_costs.load, IselRule::LoadVar);
+                }
+                return;
+            }
+        }
+        stack_leaf(l);
+    }
+
+    void stack_leaf(IselLabel& l) const {
+        l.cost.fill(IselLabel::infinite);
+        l.choice.fill({});
+        l.need = 1;
+        l.stack = true;
+        set(l, IselNt::Mem, 0, IselRule::Stack);
+        close(l);
+    }
+
+    // the chain rules
+    void close(IselLabel& l) const {
+        set(l, IselNt::Addr, l.at(IselNt::Sib), IselRule::AddrSib);
+        set(l, IselNt::Reg, l.at(IselNt::Imm) + m_costs.mov_imm, IselRule::LoadImm);
+        set(l, IselNt::Reg, l.at(IselNt::Mem) + m_costs.load, IselRule::Load);
+        set(l, IselNt::Reg, l.at(IselNt::Addr) + m_costs.lea, IselRule::Lea);
+        set(l, IselNt::Reg, l.at(IselNt::Flags) + m_costs.setcc, IselRule::SetCc);
+    }
+
+    // labels both operands, turning the hungrier one into a Stack leaf while
+    // the node needs more registers than there are
+    std::pair<const IselLabel*, const IselLabel*> operand_labels(const NodeExpr* lhs, const NodeExpr* rhs, IselLabel& l) {
+        IselLabel* a = &m_labels.at(strip_parens(lhs));
+        IselLabel* b = &m_labels.at(strip_parens(rhs));
+        while (true) {
+            l.need = a->need == b->need ? a->need + 1 : std::max(a->need, b->need);
+            if (l.need <= m_num_regs) {
+                return { a, b };
+            }
+            stack_leaf(a->need >= b->need ? *a : *b);
+        }
+    }
+
+    template <typename Bin> void binary(const Bin* bin, IselLabel& l, const size_t depth) {
+        label(bin->lhs, depth + 1);
+        label(bin->rhs, depth + 1);
+        const auto [lhs, rhs] = operand_labels(bin->lhs, bin->rhs, l);
+        constexpr bool is_add = std::is_same_v<Bin, NodeBinExprAdd>;
+        constexpr bool is_sub = std::is_same_v<Bin, NodeBinExprSub>;
+        constexpr bool is_mul = std::is_same_v<Bin, NodeBinExprMulti>;
+        constexpr bool commutative = !is_sub;
+        for (const bool swap : { false, true }) {
+            if (swap && !commutative) {
+                break;
+            }
+            const IselLabel& a = swap ? *rhs : *lhs;
+            const IselLabel& b = swap ? *lhs : *rhs;
+            const auto pair = [&](const IselNt x, const IselNt y) { return a.at(x) + b.at(y); };
+            if constexpr (is_add || is_sub) {
+                set(l, IselNt::Reg, pair(IselNt::Reg, IselNt::Reg) + m_costs.alu, IselRule::AluRR, swap);
+                set(l, IselNt::Reg, pair(IselNt::Reg, IselNt::Imm) + m_costs.alu_imm, IselRule::AluRI, swap);
+                set(l, IselNt::Reg, pair(IselNt::Reg, IselNt::Mem) + m_costs.alu_mem, IselRule::AluRM, swap);
+                if (is_add || b.imm != INT32_MIN) {
+                    set(l, IselNt::Addr, pair(IselNt::Sib, IselNt::Imm), IselRule::AddrDisp, swap);
+                }
+            }
+            if constexpr (is_add) {
+                set(l, IselNt::Sib, pair(IselNt::Reg, IselNt::Reg), IselRule::BaseIndex, swap);
+                set(l, IselNt::Sib, pair(IselNt::Reg, IselNt::Index), IselRule::BaseScaled, swap);
+                set(l, IselNt::Addr, pair(IselNt::Index, IselNt::Imm), IselRule::AddrScaled, swap);
+            }
+            if constexpr (is_mul) {
+                set(l, IselNt::Reg, pair(IselNt::Reg, IselNt::Reg) + m_costs.imul, IselRule::ImulRR, swap);
+                set(l, IselNt::Reg, pair(IselNt::Reg, IselNt::Mem) + m_costs.imul_mem, IselRule::ImulRM, swap);
+                set(l, IselNt::Reg, pair(IselNt::Reg, IselNt::Imm) + m_costs.imul_imm, IselRule::ImulRI, swap);
+                set(l, IselNt::Reg, pair(IselNt::Mem, IselNt::Imm) + m_costs.imul_imm, IselRule::ImulMI, swap);
+                if (b.at(IselNt::Imm) != IselLabel::infinite && b.imm > 1 && std::has_single_bit(static_cast<uint64_t>(b.imm))) {
+                    set(l, IselNt::Reg, pair(IselNt::Reg, IselNt::Imm) + m_costs.shift, IselRule::Shl, swap);
+                    if (b.imm <= 8) {
+                        set(l, IselNt::Index, pair(IselNt::Reg, IselNt::Imm), IselRule::Scale, swap);
+                    }
+                }
+            }
+            if constexpr (std::is_same_v<Bin, NodeBinExprEqual>) {
+                set(l, IselNt::Flags, pair(IselNt::Reg, IselNt::Reg) + m_costs.cmp, IselRule::CmpRR, swap);
+                set(l, IselNt::Flags, pair(IselNt::Reg, IselNt::Imm) + m_costs.cmp, IselRule::CmpRI, swap);
+                set(l, IselNt::Flags, pair(IselNt::Reg, IselNt::Mem) + m_costs.cmp_mem, IselRule::CmpRM, swap);
+                set(l, IselNt::Flags, pair(IselNt::Mem, IselNt::Imm) + m_costs.cmp_mem, IselRule::CmpMI, swap);
+            }
+        }
+    }
+
+    const IselCosts& m_costs;
+    const uint32_t m_num_regs;
+    std::unordered_map<const NodeExpr*, IselLabel> m_labels{};
+};
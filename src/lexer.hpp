@@ -1,9 +1,14 @@
 #pragma once
+#include <array>
+#include <cstdint>
 #include <iostream>
 #include <ostream>
 #include <vector>
 #include <string>
+#include <string_view>
 #include <optional>
+#include <stdexcept>
+#include "int_types.hpp"
 
 enum class TokenType {
     Token_Int,
@@ -27,7 +32,20 @@ enum class TokenType {
     Token_Greater,
     Token_GreaterEqual,
     Token_Semi,
+    Token_Comma,
     Token_Return,
+    Token_Switch,
+    Token_Case,
+    Token_Default,
+    Token_Colon,
+    Token_Print,
+    Token_Alloc,
+    Token_Reset,
+    Token_LSquare,
+    Token_RSquare,
+    Token_Parallel,
+    Token_For,
+    Token_Reduce,
     Token_EOF
 };
 
@@ -47,29 +65,51 @@ inline std::string tokenToString(const TokenType t) {
     else if (t == TokenType::Token_Greater) { return ">"; }
     else if (t == TokenType::Token_GreaterEqual) { return ">="; }
     else if (t == TokenType::Token_Semi) { return ";"; }
+    else if (t == TokenType::Token_Comma) { return ","; }
     else if (t == TokenType::Token_LBracket) { return "{"; }
     else if (t == TokenType::Token_RBracket) { return "}"; }
     else if (t == TokenType::Token_LParen) { return "("; }
-    else if (t == TokenType::Token_LParen) { return ")"; }
+    else if (t == TokenType::Token_RParen) { return ")"; }
     else if (t == TokenType::Token_Identifier) { return "Identifier"; }
     else if (t == TokenType::Token_IntLit) { return "IntLit"; }
     else if (t == TokenType::Token_Return) { return "return"; }
+    else if (t == TokenType::Token_Switch) { return "switch"; }
+    else if (t == TokenType::Token_Case) { return "case"; }
+    else if (t == TokenType::Token_Default) { return "default"; }
+    else if (t == TokenType::Token_Colon) { return ":"; }
+    else if (t == TokenType::Token_Print) { return "print"; }
+    else if (t == TokenType::Token_Alloc) { return "alloc"; }
+    else if (t == TokenType::Token_Reset) { return "reset"; }
+    else if (t == TokenType::Token_LSquare) { return "["; }
+    else if (t == TokenType::Token_RSquare) { return "]"; }
+    else if (t == TokenType::Token_Parallel) { return "parallel"; }
+    else if (t == TokenType::Token_For) { return "for"; }
+    else if (t == TokenType::Token_Reduce) { return "reduce"; }
     else if (t == TokenType::Token_EOF) {return "EOF";}
     return "";
 }
 
-inline std::optional<int> bin_prec(const TokenType type) {
-    switch (type) {
-        case TokenType::Token_Minus:
-        case TokenType::Token_Plus:
-            return 0;
-        case TokenType::Token_Star:
-        case TokenType::Token_Dividend:
-            return 1;
-        case TokenType::Token_Equal: return 1;
-        default:
-            return {};
-    }
+// Pratt binding powers of the infix operators, indexed by TokenType. An operator
+// binds when its left power is at least the caller's minimum, and its right
+// operand is parsed with the right power as the new minimum; right = left + 1
+// makes every level left associative. left == 0 marks a non-operator.
+struct BindingPower {
+    uint8_t left;
+    uint8_t right;
+};
+
+inline constexpr auto binding_powers = [] {
+    std::array<BindingPower, static_cast<size_t>(TokenType::Token_EOF) + 1> table {};
+    table[static_cast<size_t>(TokenType::Token_Equal)] = { 1, 2 };
+    table[static_cast<size_t>(TokenType::Token_Plus)] = { 3, 4 };
+    table[static_cast<size_t>(TokenType::Token_Minus)] = { 3, 4 };
+    table[static_cast<size_t>(TokenType::Token_Star)] = { 5, 6 };
+    table[static_cast<size_t>(TokenType::Token_Dividend)] = { 5, 6 };
+    return table;
+}();
+
+inline constexpr BindingPower binding_power(const TokenType type) {
+    return binding_powers[static_cast<size_t>(type)];
 }
 
 struct Token {
@@ -79,16 +119,85 @@ struct Token {
     std::optional<std::string> value{};
 };
 
+// A lexer or parser error, thrown instead of printed by a Tokenizer or Parser
+// set to throw_errors(), for hosts such as an editor that have to outlive a
+// half-typed statement.
+struct SyntaxError : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+// prints `msg` and exits, or throws it when `throw_error`
+[[noreturn]] inline void syntax_error(const std::string& msg, const bool throw_error) {
+    if (throw_error) {
+        throw SyntaxError(msg);
+    }
+    std::cerr << msg << std::endl;
+    exit(EXIT_FAILURE);
+}
+
 class Tokenizer {
 public:
-    explicit Tokenizer(std::string src) : data(std::move(src)) {}
+    explicit Tokenizer(std::string src) : m_owned(std::move(src)), data(m_owned) {}
+
+    // Lexes a view the caller keeps alive, e.g. one chunk of a larger buffer.
+    // `first_line` and `first_column` are the position of the first byte.
+    Tokenizer(const std::string_view src, const int first_line, const int first_column = 1)
+        : data(src), lineNum(first_line), colNum(first_column) {}
+
+    Tokenizer(const Tokenizer&) = delete;
+    Tokenizer& operator=(const Tokenizer&) = delete;
+
+    // line number after the last byte, i.e. first line + newlines seen
+    [[nodiscard]] int line() const {
+        return lineNum;
+    }
+
+    // true when a comment ran into the end of the input, so whatever follows
+    // the input would have been part of it
+    [[nodiscard]] bool ended_in_comment() const {
+        return m_ended_in_comment;
+    }
+
+    // Appends the byte offset just past every token except EOF to `ends`.
+    void record_token_ends(std::vector<size_t>& ends) {
+        m_token_ends = &ends;
+    }
+
+    void throw_errors() {
+        m_throw_errors = true;
+    }
 
     std::vector<Token> tokenize() {
         std::vector<Token> token;
+        auto no_batches = [](std::vector<Token>&) {};
+        tokenize_into(token, 0, no_batches);
+        return token;
+    }
+
+    // Hands the tokens to `on_batch` about every `batch_size` tokens, the last
+    // batch ends with EOF. `on_batch` may move the vector out.
+    template <typename F> void tokenize_batches(const size_t batch_size, F&& on_batch) {
+        std::vector<Token> token;
+        tokenize_into(token, batch_size, on_batch);
+        on_batch(token);
+    }
+
+private:
+    template <typename F> void tokenize_into(std::vector<Token>& token, const size_t batch_size, F& on_batch) {
         std::string buf;
 
         while (peek().has_value()) {
-            if (isspace(peek().value())) {
+            if (batch_size != 0 && token.size() >= batch_size) {
+                on_batch(token);
+                token.clear();
+            }
+            const size_t before = token.size();
+            if (peek().value() == '\n') {
+                consume();
+                ++lineNum;
+                colNum= 1;
+            }
+            else if (isspace(peek().value())) {
                 consume();
             }
             else if (std::isalpha(peek().value())) {
@@ -97,7 +206,8 @@ public:
                     buf.push_back(consume());
                 }
 
-                if (buf == "int") {
+                if (int_type_from(buf).has_value()) {
+                    // int and the sized types share a token, the spelling tells them apart
                     token.push_back({TokenType::Token_Int, lineNum, colNum, buf });
                 }else if (buf == "if") {
                     token.push_back({TokenType::Token_If, lineNum, colNum, buf });
@@ -107,6 +217,24 @@ public:
                     token.push_back({TokenType::Token_Else, lineNum, colNum, buf });
                 }else if (buf == "return") {
                     token.push_back({TokenType::Token_Return, lineNum, colNum, buf });
+                }else if (buf == "switch") {
+                    token.push_back({TokenType::Token_Switch, lineNum, colNum, buf });
+                }else if (buf == "case") {
+                    token.push_back({TokenType::Token_Case, lineNum, colNum, buf });
+                }else if (buf == "default") {
+                    token.push_back({TokenType::Token_Default, lineNum, colNum, buf });
+                }else if (buf == "print") {
+                    token.push_back({TokenType::Token_Print, lineNum, colNum, buf });
+                }else if (buf == "alloc") {
+                    token.push_back({TokenType::Token_Alloc, lineNum, colNum, buf });
+                }else if (buf == "reset") {
+                    token.push_back({TokenType::Token_Reset, lineNum, colNum, buf });
+                }else if (buf == "parallel") {
+                    token.push_back({TokenType::Token_Parallel, lineNum, colNum, buf });
+                }else if (buf == "for") {
+                    token.push_back({TokenType::Token_For, lineNum, colNum, buf });
+                }else if (buf == "reduce") {
+                    token.push_back({TokenType::Token_Reduce, lineNum, colNum, buf });
                 }else {
                     token.push_back({TokenType::Token_Identifier, lineNum, colNum, buf });
                 }
@@ -121,39 +249,38 @@ public:
                 }
                 if (peek().has_value() && isalpha(peek().value())) {
                     buf.push_back(consume());
-                    std::cout << "Invaild identifier: " << buf << std::endl;
-                    exit(EXIT_FAILURE);
+                    syntax_error("Invaild identifier: " + buf, m_throw_errors);
                 }
 
                 token.push_back({TokenType::Token_IntLit, lineNum, colNum, buf });
                 buf.clear();
-            }else if (peek().value() == '/' && peek(1).has_value() && peek().value() == '/') {
+            }else if (peek().value() == '/' && peek(1).has_value() && peek(1).value() == '/') {
                 consume();
                 consume();
-                while (peek().value() != '\n') {
+                while (peek().has_value() && peek().value() != '\n') { // the newline itself is counted above
                     consume();
                 }
-                ++lineNum;
-                colNum=1;
-            }else if (peek().value() == '/' && peek(1).has_value() && peek().value() == '*') {
+                m_ended_in_comment = !peek().has_value();
+            }else if (peek().value() == '/' && peek(1).has_value() && peek(1).value() == '*') {
                 consume();
                 consume();
-                while (peek().value()) {
-                    if (peek().value() == '*' && peek().has_value() && peek(1).value() == '/') {
+                while (peek().has_value()) {
+                    if (peek().value() == '*' && peek(1).has_value() && peek(1).value() == '/') {
                         break;
                     }
-                    if (peek().value() != '\n') {
+                    if (peek().value() == '\n') {
                         ++lineNum;
+                        colNum = 0;
                     }
                     consume();
                 }
+                m_ended_in_comment = !peek().has_value();
                 if (peek().has_value()) {
                     consume();
                 }
                 if (peek().has_value()) {
                     consume();
                 }
-                colNum=1;
             }else if (peek().value() == '+') {
                 consume();
                 token.push_back({TokenType::Token_Plus, lineNum, colNum, "+"});
@@ -169,7 +296,7 @@ public:
             }
             else if (peek().value() == '=') {
                 consume();
-                if (peek().value() == '=') {
+                if (peek().has_value() && peek().value() == '=') {
                     consume();
                     token.push_back({TokenType::Token_Equal, lineNum, colNum, "=="});
                 }else {
@@ -177,7 +304,7 @@ public:
                 }
             }else if (peek().value() == '<') {
                 consume();
-                if (peek().value() == '=') {
+                if (peek().has_value() && peek().value() == '=') {
                     consume();
                     token.push_back({TokenType::Token_LessEqual, lineNum, colNum, "<="});
                 } else {
@@ -185,7 +312,7 @@ public:
                 }
             }else if (peek().value() == '>') {
                 consume();
-                if (peek().value() == '=') {
+                if (peek().has_value() && peek().value() == '=') {
                     consume();
                     token.push_back({TokenType::Token_GreaterEqual, lineNum, colNum, ">="});
                 }else {
@@ -194,12 +321,12 @@ public:
             }else if (peek().value() == ';') {
                 consume();
                 token.push_back({TokenType::Token_Semi, lineNum, colNum, ";"});
-                ++lineNum;
-                colNum= 1;
-            }else if (peek().value() == '\n') {
+            }else if (peek().value() == ',') {
                 consume();
-                ++lineNum;
-                colNum= 1;
+                token.push_back({TokenType::Token_Comma, lineNum, colNum, ","});
+            }else if (peek().value() == ':') {
+                consume();
+                token.push_back({TokenType::Token_Colon, lineNum, colNum, ":"});
             }else if (peek().value() == '(') {
                 consume();
                 token.push_back({TokenType::Token_LParen, lineNum, colNum, "("});
@@ -212,21 +339,30 @@ public:
             }else if (peek().value() == '}') {
                 consume();
                 token.push_back({TokenType::Token_RBracket, lineNum, colNum, "}"});
+            }else if (peek().value() == '[') {
+                consume();
+                token.push_back({TokenType::Token_LSquare, lineNum, colNum, "["});
+            }else if (peek().value() == ']') {
+                consume();
+                token.push_back({TokenType::Token_RSquare, lineNum, colNum, "]"});
             }
             else {
-                std::cerr << "Unexpected char: " << peek().value() << std::endl;
-                exit(EXIT_FAILURE);
+                syntax_error(std::string("Unexpected char: ") + peek().value(), m_throw_errors);
+            }
+            if (m_token_ends != nullptr && token.size() > before) {
+                m_token_ends->push_back(c_Index);
             }
-
         }
         token.push_back({TokenType::Token_EOF, lineNum,0, ""});
-        return token;
     }
 
-private:
-    const std::string data;
-    int c_Index = 0;
+    const std::string m_owned;
+    const std::string_view data;
+    size_t c_Index = 0;
     int lineNum = 1, colNum = 1;
+    bool m_ended_in_comment = false;
+    bool m_throw_errors = false;
+    std::vector<size_t>* m_token_ends = nullptr;
 
     [[nodiscard]]std::optional<char> peek(size_t offset=0) const {
         if (c_Index + offset < data.length()) {
@@ -3,82 +3,227 @@
 #include <sstream>
 #include <ostream>
 #include <variant>
+#include <filesystem>
 #include "lexer.hpp"
+#include "parallel_lexer.hpp"
 #include "parser.hpp"
 #include "generation.hpp"
+#include "bytecode.hpp"
+#include "interpreter.hpp"
+#include "pipeline.hpp"
+#include "ast_cache.hpp"
+#include "passes.hpp"
+#include "streaming.hpp"
+
+// assembles and links out.asm into ./out
+static int assemble_and_link(const bool debug_info) {
+    std::cout << "\n=== ASSEMBLING ===\n";
+    system(debug_info ? "nasm -felf64 -g -F dwarf out.asm" : "nasm -felf64 out.asm");
+
+
+    std::cout << "=== LINKING ===\n";
+    system("ld -o out out.o"); // generate out.o file
+
+    std::cout << "\nCompilation complete! Executable: ./out\n";
+    return 0;
+}
+
+// writes out.asm, then assembles and links it into ./out
+static int write_and_link(const std::string& assembly, const bool debug_info) {
+    // check if generaion have error
+    if (assembly.empty()) {
+        std::cerr << "WARNING: Generated assembly is empty!\n";
+    }
+    // else { // print assembly language
+    //     std::cout << "\n--- Assembly Output ---\n";
+    //     std::cout << assembly << std::endl;
+    //     std::cout << "--- End Assembly ---\n\n";
+    // }
+
+    // Write to file to out.asm fix file
+    std::string output_filename = "out.asm";
+    std::ofstream output_file(output_filename);
+    if (!output_file.is_open()) { // check file open successfully
+        std::cerr << "ERROR: Could not open output file: " << output_filename << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    output_file << assembly; // write all into file
+    output_file.close();
+    return assemble_and_link(debug_info);
+}
 
 int main(int argc, char* argv[]){
     // std::cout << argv[0] << " " <<  argv[1] << "\n";
-    if (argc != 2) {
+    bool interp = false;
+    bool pipeline = false;
+    bool stream = false;
+    bool debug_info = false;
+    size_t lex_threads = 0; // 0: pick automatically
+    OptLevel opt_level = OptLevel::O2;
+    std::optional<std::string> print_after;
+    bool pass_stats = false;
+    std::optional<std::string> cache_dir;
+    const char* input_path = nullptr;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "--interp") {
+            interp = true;
+        }else if (arg == "--pipeline") {
+            pipeline = true;
+        }else if (arg == "--stream") {
+            stream = true;
+        }else if (arg == "-g") {
+            debug_info = true;
+        }else if (arg == "--ast-cache") {
+            cache_dir = ".hycache";
+        }else if (arg.starts_with("--ast-cache=")) {
+            cache_dir = arg.substr(std::string("--ast-cache=").size());
+        }else if (arg.starts_with("--lex-threads=")) {
+            lex_threads = std::stoul(arg.substr(std::string("--lex-threads=").size()));
+        }else if (const auto level = opt_level_from(arg)) {
+            opt_level = level.value();
+        }else if (arg.starts_with("--print-after=")) {
+            print_after = arg.substr(std::string("--print-after=").size());
+        }else if (arg == "--pass-stats") {
+            pass_stats = true;
+        }else if (input_path == nullptr) {
+            input_path = argv[i];
+        }else {
+            input_path = nullptr;
+            break;
+        }
+    }
+    if (input_path == nullptr) {
         std::cerr << "Incorrect file path. Correct usage is ..." << std::endl;
-        std::cerr << "my Example.hy ....." << std::endl;
+        std::cerr << "my [--interp] [--pipeline] [--stream] [-g] [-O0|-O1|-O2] [--print-after=PASS] [--pass-stats] [--lex-threads=N] [--ast-cache[=DIR]] Example.hy ....." << std::endl;
         return EXIT_SUCCESS;
     }
 
+    // absolute, so perf annotate and gdb find the source from anywhere
+    const std::string debug_source = std::filesystem::absolute(input_path).string();
+    const CodegenOptions codegen = CodegenOptions::at(opt_level);
+
+    //-------------------
+    // streaming mode: the source is never held whole, out.asm is written as it goes
+    if (stream && !interp) {
+        std::ifstream input(input_path, std::ios::binary);
+        std::ofstream output("out.asm");
+        if (!input.is_open() || !output.is_open()) {
+            std::cerr << "ERROR: Could not open " << (input.is_open() ? "out.asm" : input_path) << std::endl;
+            return EXIT_FAILURE;
+        }
+        StreamingCompiler compiler(input, output);
+        compiler.set_codegen_options(codegen);
+        if (debug_info) {
+            compiler.set_debug_info(debug_source, "out.asm");
+        }
+        compiler.compile();
+        output.close();
+        return assemble_and_link(debug_info);
+    }
+
     // copy high level language
-    std::fstream inputFile(argv[1], std::ios::in);
+    std::fstream inputFile(input_path, std::ios::in);
     std::stringstream contents_stream;
     contents_stream << inputFile.rdbuf();
     inputFile.close();
 
     std::string contents = contents_stream.str();
 
-    // ------------------
-    // lexer build
-    Tokenizer tokenizer(std::move(contents));
-    std::vector<Token> tokens = tokenizer.tokenize();
-
-    // print tokens for validation
-    // for (const Token& t:tokens) {
-    //     std::cout << "types: " << tokenToString(t.type) << " | line: " << t.line << " | column: " << t.column << " value: " << t.value.value() << std::endl;
-    // }
-
-    // ----------------
-    // parser tree build
-    Parser p(tokens);
-    auto prs = p.parse_program();
-
-    if (!prs.has_value()) {
-        std::cerr <<  "Parsing error." << std::endl;
-        return EXIT_FAILURE;
+    //-------------------
+    // pipelined mode: lexer, parser and generator run concurrently
+    if (pipeline && !interp) {
+        try {
+            // statements are emitted as they arrive, so only the codegen options apply
+            Pipeline compiler(std::move(contents));
+            compiler.set_codegen_options(codegen);
+            if (debug_info) {
+                compiler.set_debug_info(debug_source, "out.asm");
+            }
+            return write_and_link(compiler.compile(), debug_info);
+        } catch (const std::exception& e) {
+            std::cerr << "ERROR during code generation: " << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
     }
 
-    //-------------------
-    // assembly genration
-    try {
-        Generator generator(prs.value());
-        std::string assembly = generator.gen_prog();
+    // ------------------
+    // a cached AST for this exact source skips lexing and parsing
+    std::optional<AstCache> ast_cache;
+    AstCacheLoader cache_loader;
+    std::optional<NodeProg> prs;
+    if (cache_dir.has_value()) {
+        ast_cache.emplace(cache_dir.value(), contents);
+        prs = ast_cache->load(cache_loader);
+    }
 
-        // check if generaion have error
-        if (assembly.empty()) {
-            std::cerr << "WARNING: Generated assembly is empty!\n";
+    std::optional<Parser> p;
+    if (!prs.has_value()) {
+        // lexer build, large inputs are split into chunks and lexed in parallel
+        std::vector<Token> tokens;
+        if (lex_threads != 1 && contents.size() >= 2 * ParallelTokenizer::min_chunk_size) {
+            ParallelTokenizer tokenizer(contents, lex_threads);
+            tokens = tokenizer.tokenize();
+        }else {
+            Tokenizer tokenizer(std::move(contents));
+            tokens = tokenizer.tokenize();
         }
-        // else { // print assembly language
-        //     std::cout << "\n--- Assembly Output ---\n";
-        //     std::cout << assembly << std::endl;
-        //     std::cout << "--- End Assembly ---\n\n";
+
+        // print tokens for validation
+        // for (const Token& t:tokens) {
+        //     std::cout << "types: " << tokenToString(t.type) << " | line: " << t.line << " | column: " << t.column << " value: " << t.value.value() << std::endl;
         // }
 
-        // Write to file to out.asm fix file
-        std::string output_filename = "out.asm";
-        std::ofstream output_file(output_filename);
-        if (!output_file.is_open()) { // check file open successfully
-            std::cerr << "ERROR: Could not open output file: " << output_filename << std::endl;
+        // ----------------
+        // parser tree build
+        p.emplace(std::move(tokens));
+        prs = p->parse_program();
+
+        if (!prs.has_value()) {
+            std::cerr <<  "Parsing error." << std::endl;
             return EXIT_FAILURE;
         }
+        if (ast_cache.has_value()) {
+            ast_cache->store(prs.value());
+        }
+    }
 
-        output_file << assembly; // write all into file
-        output_file.close();
-
-        // Assemble and link
-        std::cout << "\n=== ASSEMBLING ===\n";
-        system("nasm -felf64 out.asm");
+    //-------------------
+    // AST passes for the -O level, both backends see their result
+    StandardPasses standard_passes;
+    PassManager passes;
+    standard_passes.register_with(passes);
+    if (print_after.has_value()) {
+        passes.set_print_after(print_after.value(), std::cerr);
+    }
+    const std::vector<PassStats> stats = passes.run(prs.value(), opt_level);
+    if (pass_stats) {
+        PassManager::print_stats(stats, std::cerr);
+    }
 
+    //-------------------
+    // bytecode interpretation, skips codegen, nasm and ld entirely
+    if (interp) {
+        BytecodeProgram program = BytecodeCompiler(prs.value()).compile();
+        Interpreter interpreter(program);
+        const int64_t result = interpreter.run();
+        return static_cast<int>(result & 0xFF); // same truncation as the exit syscall
+    }
 
-        std::cout << "=== LINKING ===\n";
-        system("ld -o out out.o"); // generate out.o file
+    //-------------------
+    // assembly genration
+    try {
+        Generator generator(prs.value());
+        generator.set_instruction_selection(codegen.instruction_selection);
+        generator.set_block_layout(codegen.block_layout);
+        generator.set_inlining(codegen.inlining);
+        if (debug_info) {
+            generator.set_debug_info(debug_source, "out.asm");
+        }
+        std::string assembly = generator.gen_prog();
 
-        std::cout << "\nCompilation complete! Executable: ./out\n";
+        return write_and_link(assembly, debug_info);
     } catch (const std::exception& e) {
         std::cerr << "ERROR during code generation: " << e.what() << std::endl;
         return EXIT_FAILURE;
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "lexer.hpp"
+
+// Parallel front end of Tokenizer for very large sources. A pre-scan picks
+// split points at newlines that are not inside a block comment, every chunk is
+// lexed on its own with line numbers starting at 1, and the per-chunk token
+// buffers are stitched together with the line offsets of the chunks before
+// them. Chunks start at column 1 of a line, so the result is identical to one
+// sequential Tokenizer over the whole buffer.
+class ParallelTokenizer {
+public:
+    // below this there is not enough work to pay for the threads
+    static constexpr size_t min_chunk_size = 1024 * 1024;
+
+    explicit ParallelTokenizer(const std::string_view src, const size_t num_threads = 0)
+        : data(src)
+        , m_num_threads(num_threads != 0 ? num_threads : std::max(1u, std::thread::hardware_concurrency()))
+    {
+    }
+
+    std::vector<Token> tokenize(const size_t chunk_size_hint = min_chunk_size) {
+        // a few chunks per thread so a chunk full of comments does not stall the rest
+        const size_t wanted = std::min(m_num_threads * 4, std::max<size_t>(1, data.size() / std::max<size_t>(1, chunk_size_hint)));
+        const std::vector<size_t> splits = find_split_points(data, wanted);
+        const size_t num_chunks = splits.size() - 1;
+        if (num_chunks == 1 || m_num_threads == 1) {
+            Tokenizer tokenizer(data, 1);
+            return tokenizer.tokenize();
+        }
+
+        struct Chunk {
+            std::vector<Token> tokens;
+            int lines = 0;         // newlines inside the chunk
+            int line_offset = 0;   // newlines before the chunk
+            size_t token_offset = 0;
+        };
+        std::vector<Chunk> chunks(num_chunks);
+
+        run_parallel(num_chunks, [&](const size_t i) {
+            Tokenizer tokenizer(data.substr(splits[i], splits[i + 1] - splits[i]), 1);
+            chunks[i].tokens = tokenizer.tokenize();
+            chunks[i].tokens.pop_back(); // per-chunk EOF
+            chunks[i].lines = tokenizer.line() - 1;
+        });
+
+        size_t total = 0;
+        int lines = 0;
+        for (Chunk& chunk : chunks) {
+            chunk.line_offset = lines;
+            chunk.token_offset = total;
+            lines += chunk.lines;
+            total += chunk.tokens.size();
+        }
+
+        std::vector<Token> tokens(total + 1);
+        run_parallel(num_chunks, [&](const size_t i) {
+            Chunk& chunk = chunks[i];
+            auto out = tokens.begin() + static_cast<std::ptrdiff_t>(chunk.token_offset);
+            for (Token& tok : chunk.tokens) {
+                tok.line += chunk.line_offset;
+                *out++ = std::move(tok);
+            }
+            chunk.tokens = {};
+        });
+        tokens.back() = {TokenType::Token_EOF, lines + 1, 0, ""};
+        return tokens;
+    }
+
+    // Returns chunk boundaries [0, ..., size]: each inner boundary is the byte after
+    // the first newline at or past an even split target that is outside a block
+    // comment. Line comments are tracked too so that `// /*` opens nothing.
+    static std::vector<size_t> find_split_points(const std::string_view src, const size_t num_chunks) {
+        std::vector<size_t> splits { 0 };
+        const size_t n = src.size();
+        const char* const base = src.data();
+        size_t next_target = n / std::max<size_t>(1, num_chunks);
+        size_t i = 0;
+        while (i < n && splits.size() < num_chunks && next_target > 0) {
+            const char c = base[i];
+            if (c == '\n') {
+                if (i + 1 >= next_target && i + 1 < n) {
+                    splits.push_back(i + 1);
+                    next_target = std::max(i + 1, splits.size() * n / num_chunks);
+                }
+                i++;
+            }else if (c == '/' && i + 1 < n && base[i + 1] == '/') {
+                const void* nl = std::memchr(base + i, '\n', n - i);
+                i = nl == nullptr ? n : static_cast<size_t>(static_cast<const char*>(nl) - base);
+            }else if (c == '/' && i + 1 < n && base[i + 1] == '*') {
+                i = skip_block_comment(src, i + 2);
+            }else {
+                // fast-forward to the next byte that can change state
+                const char* p = base + i + 1;
+                const char* const end = base + n;
+                while (p < end && *p != '\n' && *p != '/') {
+                    p++;
+                }
+                i = static_cast<size_t>(p - base);
+            }
+        }
+        splits.push_back(n);
+        return splits;
+    }
+
+private:
+    static size_t skip_block_comment(const std::string_view src, size_t i) {
+        const size_t n = src.size();
+        while (i < n) {
+            const void* star = std::memchr(src.data() + i, '*', n - i);
+            if (star == nullptr) {
+                return n;
+            }
+            i = static_cast<size_t>(static_cast<const char*>(star) - src.data()) + 1;
+            if (i < n && src[i] == '/') {
+                return i + 1;
+            }
+        }
+        return n;
+    }
+
+    template <typename F> void run_parallel(const size_t num_tasks, F&& task) const {
+        std::atomic<size_t> next { 0 };
+        auto worker = [&] {
+            for (size_t i = next.fetch_add(1); i < num_tasks; i = next.fetch_add(1)) {
+                task(i);
+            }
+        };
+        std::vector<std::jthread> threads;
+        const size_t num_threads = std::min(m_num_threads, num_tasks);
+        for (size_t t = 1; t < num_threads; t++) {
+            threads.emplace_back(worker);
+        }
+        worker();
+    }
+
+    const std::string_view data;
+    const size_t m_num_threads;
+};
@@ -1,8 +1,12 @@
 #pragma once
 
 #include "lexer.hpp"
+#include <algorithm>
 #include <variant>
 #include <cassert>
+#include <charconv>
+#include <functional>
+#include <unordered_set>
 #include "arena.hpp"
 
 struct NodeTermInt {
@@ -19,6 +23,22 @@ struct NodeTermParen {
     NodeExpr* expr;
 };
 
+struct NodeTermCall {
+    Token ident;
+    std::vector<NodeExpr*> args;
+};
+
+// a block of `count` qwords from the region heap, the value is its address
+struct NodeTermAlloc {
+    NodeExpr* count;
+};
+
+// ident[index], the qword at address ident + index * 8
+struct NodeTermIndex {
+    Token ident;
+    NodeExpr* index{};
+};
+
 struct NodeBinExprAdd {
     NodeExpr* lhs;
     NodeExpr* rhs;
@@ -49,11 +69,12 @@ struct NodeBinExpr {
 };
 
 struct  NodeTerm {
-    std::variant<NodeTermIdent*, NodeTermInt*, NodeTermParen*> var;
+    std::variant<NodeTermIdent*, NodeTermInt*, NodeTermParen*, NodeTermCall*, NodeTermAlloc*, NodeTermIndex*> var;
 };
 
 struct NodeExpr {
     std::variant<NodeTerm*, NodeBinExpr*> var;
+    IntType type = IntType::I64; // set by TypeChecker, before promotion
 };
 
 struct NodeStmtReturn {
@@ -63,6 +84,7 @@ struct NodeStmtReturn {
 struct NodeStmtInt {
     Token ident;
     NodeExpr* expr{};
+    IntType type = IntType::I64;
 };
 
 struct NodeStmt;
@@ -98,106 +120,386 @@ struct NodeStmtAssign {
     NodeExpr* expr{};
 };
 
+// ident[index] = expr;
+struct NodeStmtStore {
+    Token ident;
+    NodeExpr* index{};
+    NodeExpr* expr{};
+};
+
+// releases everything alloc() handed out
+struct NodeStmtReset {
+    Token reset;
+};
+
+// writes the value and a newline to stdout
+struct NodeStmtPrint {
+    NodeExpr* expr;
+};
+
+struct NodeStmtCall {
+    NodeTermCall* call;
+};
+
+struct NodeSwitchCase {
+    Token label;        // the integer literal after `case`
+    int64_t value;
+    NodeScope* scope;
+};
+
+// cases never fall through into each other
+struct NodeStmtSwitch {
+    NodeExpr* expr{};
+    std::vector<NodeSwitchCase> cases;  // in source order
+    NodeScope* default_scope{};
+};
+
+// only allowed at top level, `return` inside the body returns from the function
+struct NodeStmtFunc {
+    Token ident;
+    std::vector<Token> params;
+    NodeScope* body{};
+    IntType ret = IntType::I64;
+    std::vector<IntType> param_types{}; // parallel to params
+};
+
+// parallel for (ident = lo, hi) reduce (sum) { ... } runs the body for ident in
+// [lo, hi), spread over threads; `reduce (sum)` is optional
+struct NodeStmtParallelFor {
+    Token ident;
+    NodeExpr* lo{};
+    NodeExpr* hi{};
+    std::optional<Token> reduce{};
+    NodeScope* body{};
+};
+
 struct NodeStmt {
-    std::variant<NodeStmtInt*, NodeScope*, NodeStmtIf*, NodeStmtAssign*, NodeStmtReturn*> var;
+    std::variant<NodeStmtInt*, NodeScope*, NodeStmtIf*, NodeStmtAssign*, NodeStmtReturn*, NodeStmtCall*, NodeStmtFunc*, NodeStmtSwitch*, NodeStmtPrint*, NodeStmtStore*, NodeStmtReset*, NodeStmtParallelFor*> var;
+    int line = 0; // of the first token, for debug info
 };
 
 struct  NodeProg {
     std::vector<NodeStmt*> stmts;
 };
 
-class Parser {
+// the operands of `expr` in evaluation order: lhs and rhs, the expression in
+// parentheses, call arguments, the count of alloc and a subscript
+inline size_t expr_child_count(const NodeExpr* expr) {
+    if (std::holds_alternative<NodeBinExpr*>(expr->var)) {
+        return 2;
+    }
+    const NodeTerm* term = std::get<NodeTerm*>(expr->var);
+    if (const auto call = std::get_if<NodeTermCall*>(&term->var)) {
+        return (*call)->args.size();
+    }
+    return std::holds_alternative<NodeTermParen*>(term->var) || std::holds_alternative<NodeTermAlloc*>(term->var)
+           || std::holds_alternative<NodeTermIndex*>(term->var) ? 1 : 0;
+}
+
+inline NodeExpr* expr_child(const NodeExpr* expr, const size_t i) {
+    if (const auto bin = std::get_if<NodeBinExpr*>(&expr->var)) {
+        return std::visit([&](const auto* op) { return i == 0 ? op->lhs : op->rhs; }, (*bin)->var);
+    }
+    const NodeTerm* term = std::get<NodeTerm*>(expr->var);
+    if (const auto paren = std::get_if<NodeTermParen*>(&term->var)) {
+        return (*paren)->expr;
+    }
+    if (const auto call = std::get_if<NodeTermCall*>(&term->var)) {
+        return (*call)->args[i];
+    }
+    if (const auto alloc = std::get_if<NodeTermAlloc*>(&term->var)) {
+        return (*alloc)->count;
+    }
+    return std::get<NodeTermIndex*>(term->var)->index;
+}
+
+// Walks the tree under `root` with a stack on the heap, so the passes after
+// the parser take any nesting depth. visit(expr, done, count) runs before each
+// of the `count` children of expr, `done` of them walked so far, and once more
+// after the last one (done == count); a leaf only gets that call.
+template <typename Expr, typename Visit> void walk_expr(Expr* root, Visit&& visit) {
+    const size_t root_count = expr_child_count(root);
+    if (root_count == 0) {
+        visit(root, 0, 0);
+        return;
+    }
+    struct Frame {
+        Expr* expr;
+        size_t done;
+        size_t count;
+    };
+    std::vector<Frame> stack { { root, 0, root_count } };
+    while (!stack.empty()) {
+        Frame& frame = stack.back();
+        visit(frame.expr, frame.done, frame.count);
+        if (frame.done == frame.count) {
+            stack.pop_back();
+            continue;
+        }
+        Expr* child = expr_child(frame.expr, frame.done++);
+        stack.push_back({ child, 0, expr_child_count(child) });
+    }
+}
+
+// What a `parallel for` body may do once its iterations run concurrently:
+// declare and assign its own variables, read the ones around it, store through
+// pointers and call functions. The reduce variable only appears as
+// `sum = sum + expr;`, so giving every thread a copy that starts at 0 and adding
+// the copies up afterwards matches running the loop in order. print, alloc,
+// reset, return and nested loops are rejected because the runtime behind them
+// is single threaded. Functions the body reaches must avoid them too; the
+// CallGraph checks that once every function is known.
+class ParallelForCheck {
 public:
+    ParallelForCheck(const NodeStmtParallelFor* loop, const bool throw_errors) : m_loop(loop), m_throw_errors(throw_errors) {}
 
-    explicit Parser(std::vector<Token> tokens) : data(std::move(tokens)), m_allocator(1024 * 1024 * 4) {};
+    void run() {
+        scope(m_loop->body);
+    }
+
+private:
+    [[noreturn]] void error(const std::string& msg) const {
+        syntax_error("[Parse Error] " + msg + " in parallel for on line " + std::to_string(m_line), m_throw_errors);
+    }
 
-    void error_expected(const std::string& msg) const{
-        std::cerr << "[Parse Error] Expected " << msg << " on line " << peek(0).value().line << " on column " << peek(0).value().column << std::endl;
-        exit(EXIT_FAILURE);
+    [[nodiscard]] bool is_reduce(const Token& ident) const {
+        return m_loop->reduce.has_value() && m_loop->reduce->value == ident.value;
     }
 
-    std::optional<NodeTerm*> parse_term() {
-        if (auto int_lit = try_consume(TokenType::Token_IntLit)) {
-            auto term_int_lit = m_allocator.emplace<NodeTermInt>(int_lit.value());
-            auto term = m_allocator.emplace<NodeTerm>(term_int_lit);
-            return term;
+    void expr(const NodeExpr* root) {
+        walk_expr(root, [&](const NodeExpr* expr, const size_t done, size_t) {
+            const auto term = std::get_if<NodeTerm*>(&expr->var);
+            if (done != 0 || term == nullptr) {
+                return;
+            }
+            if (const auto ident = std::get_if<NodeTermIdent*>(&(*term)->var)) {
+                if (is_reduce((*ident)->ident)) {
+                    error("Reduce variable " + (*ident)->ident.value.value() + " read outside of `+`");
+                }
+            }else if (std::holds_alternative<NodeTermAlloc*>((*term)->var)) {
+                error("alloc is not allowed");
+            }
+        });
+    }
+
+    // sum = sum + expr or sum = sum + a + b ..., with sum nowhere else
+    void reduce_assign(const NodeStmtAssign* assign) {
+        const NodeExpr* sum = assign->expr;
+        std::vector<const NodeExpr*> addends;
+        while (const auto bin = std::get_if<NodeBinExpr*>(&sum->var)) {
+            const auto add = std::get_if<NodeBinExprAdd*>(&(*bin)->var);
+            if (add == nullptr) {
+                break;
+            }
+            addends.push_back((*add)->rhs);
+            sum = (*add)->lhs;
         }
-        if (auto ident = try_consume(TokenType::Token_Identifier)) {
-            auto term_ident = m_allocator.emplace<NodeTermIdent>(ident.value());
-            auto term = m_allocator.emplace<NodeTerm>(term_ident);
-            return term;
+        const auto term = std::get_if<NodeTerm*>(&sum->var);
+        const auto ident = term != nullptr ? std::get_if<NodeTermIdent*>(&(*term)->var) : nullptr;
+        if (addends.empty() || ident == nullptr || !is_reduce((*ident)->ident)) {
+            error("Reduce variable " + assign->ident.value.value() + " assigned other than `" +
+                  assign->ident.value.value() + " = " + assign->ident.value.value() + " + ...`");
         }
-        if (const auto open_paren = try_consume(TokenType::Token_LBracket)) {
-            auto expr = parse_expr();
-            if (!expr.has_value()) {
-                error_expected("expression");
-            }
-            try_consume_err(TokenType::Token_RParen);
-            auto term_paren = m_allocator.emplace<NodeTermParen>(expr.value());
-            auto term = m_allocator.emplace<NodeTerm>(term_paren);
-            return term;
+        for (const NodeExpr* addend : addends) {
+            expr(addend);
         }
-        return {};
     }
 
-    std::optional<NodeExpr*> parse_expr(const int min_prec = 0) {
-        std::optional<NodeTerm*> term_lhs = parse_term();
-        if (!term_lhs.has_value()) {
-            return {};
+    void scope(const NodeScope* scope) {
+        const size_t locals = m_locals.size();
+        for (const NodeStmt* stmt : scope->stmts) {
+            this->stmt(stmt);
+        }
+        m_locals.resize(locals);
+    }
+
+    void if_pred(const NodeIfPred* pred) {
+        if (const auto elif = std::get_if<NodeIfPredElif*>(&pred->var)) {
+            expr((*elif)->expr);
+            scope((*elif)->scope);
+            if ((*elif)->pred.has_value()) {
+                if_pred((*elif)->pred.value());
+            }
+            return;
         }
+        scope(std::get<NodeIfPredElse*>(pred->var)->scope);
+    }
 
-        auto expr_lhs =  m_allocator.emplace<NodeExpr>(term_lhs.value());
-        while (true) {
-            std::optional<Token> curr_tok = peek();
-            std::optional<int> prec;
-            if (curr_tok.has_value()) {
-                    prec = bin_prec(curr_tok->type);
-                if (!prec.has_value() || prec < min_prec) {
-                    break;
+    void stmt(const NodeStmt* stmt) {
+        m_line = stmt->line;
+        struct StmtVisitor {
+            ParallelForCheck& check;
+            void operator()(const NodeStmtInt* stmt_int) const {
+                if (stmt_int->expr != nullptr) {
+                    check.expr(stmt_int->expr);
                 }
+                check.m_locals.push_back(stmt_int->ident.value.value());
             }
-            else {
-                break;
+            void operator()(const NodeScope* scope) const { check.scope(scope); }
+            void operator()(const NodeStmtIf* stmt_if) const {
+                check.expr(stmt_if->expr);
+                check.scope(stmt_if->scope);
+                if (stmt_if->pred.has_value()) {
+                    check.if_pred(stmt_if->pred.value());
+                }
+            }
+            void operator()(const NodeStmtAssign* stmt_assign) const {
+                if (check.is_reduce(stmt_assign->ident)) {
+                    check.reduce_assign(stmt_assign);
+                    return;
+                }
+                if (std::ranges::find(check.m_locals, stmt_assign->ident.value.value()) == check.m_locals.end()) {
+                    check.error("Assignment to outer variable " + stmt_assign->ident.value.value());
+                }
+                check.expr(stmt_assign->expr);
+            }
+            void operator()(const NodeStmtReturn*) const { check.error("return is not allowed"); }
+            void operator()(const NodeStmtCall* stmt_call) const {
+                for (const NodeExpr* arg : stmt_call->call->args) {
+                    check.expr(arg);
+                }
             }
+            void operator()(const NodeStmtFunc*) const {}
+            void operator()(const NodeStmtSwitch* stmt_switch) const {
+                check.expr(stmt_switch->expr);
+                for (const NodeSwitchCase& c : stmt_switch->cases) {
+                    check.scope(c.scope);
+                }
+                if (stmt_switch->default_scope != nullptr) {
+                    check.scope(stmt_switch->default_scope);
+                }
+            }
+            void operator()(const NodeStmtPrint*) const { check.error("print is not allowed"); }
+            void operator()(const NodeStmtStore* stmt_store) const {
+                check.expr(stmt_store->index);
+                check.expr(stmt_store->expr);
+            }
+            void operator()(const NodeStmtReset*) const { check.error("reset is not allowed"); }
+            void operator()(const NodeStmtParallelFor*) const { check.error("A nested loop is not allowed"); }
+        };
+        std::visit(StmtVisitor { .check = *this }, stmt->var);
+    }
 
-            auto [type, line, column, val] = consume();
-            const int next_min_prec = prec.value() + 1;
+    const NodeStmtParallelFor* m_loop;
+    bool m_throw_errors;
+    std::vector<std::string> m_locals{};  // declared in the body so far, innermost last
+    int m_line = 0;
+};
 
-            auto expr_rhs = parse_expr(next_min_prec);
-            if (!expr_rhs.has_value()) {
-                error_expected("Expression");
-            }
-            auto expr = m_allocator.emplace<NodeBinExpr>();
-            auto expr_lhs2 = m_allocator.emplace<NodeExpr>();
-
-            if (type == TokenType::Token_Plus) {
-                expr_lhs2->var = expr_lhs->var;
-                auto add = m_allocator.emplace<NodeBinExprAdd>(expr_lhs2, expr_rhs.value());
-                expr->var = add;
-            }else if (type == TokenType::Token_Minus) {
-                expr_lhs2->var = expr_lhs->var;
-                auto sub = m_allocator.emplace<NodeBinExprSub>(expr_lhs2, expr_rhs.value());
-                expr->var = sub;
-            }else if (type == TokenType::Token_Star) {
-                expr_lhs2->var = expr_lhs->var;
-                auto multi = m_allocator.emplace<NodeBinExprMulti>(expr_lhs2, expr_rhs.value());
-                expr->var = multi;
-            }else if (type == TokenType::Token_Dividend) {
-                expr_lhs2->var = expr_lhs->var;
-                auto div = m_allocator.emplace<NodeBinExprDiv>(expr_lhs2, expr_rhs.value());
-                expr->var = div;
-            } else if (type == TokenType::Token_Equal) {
-                expr_lhs2->var = expr_lhs->var;
-                auto equal = m_allocator.emplace<NodeBinExprEqual>(expr_lhs2, expr_rhs.value());
-                expr->var = equal;
+class Parser {
+public:
+
+    explicit Parser(std::vector<Token> tokens) : data(std::move(tokens)), m_allocator(1024 * 1024 * 4) {};
+
+    // Pulls tokens on demand: `refill` appends the next batch and returns false
+    // once the stream is exhausted. Consumed tokens are dropped on each refill.
+    explicit Parser(std::function<bool(std::vector<Token>&)> refill)
+        : m_refill(std::move(refill)), m_allocator(1024 * 1024 * 4) {};
+
+    // errors throw a SyntaxError instead of exiting
+    void throw_errors() {
+        m_throw_errors = true;
+    }
+
+    [[noreturn]] void error_expected(const std::string& msg) {
+        error("Expected " + msg + " on line " + std::to_string(peek(0).value().line) + " on column " + std::to_string(peek(0).value().column));
+    }
+
+    // Parses a single operand, consuming only its tokens: `f(...)` when the
+    // caller has already seen an identifier followed by `(`.
+    NodeTermCall* parse_call() {
+        const auto expr = parse_expr(UINT8_MAX);
+        return std::get<NodeTermCall*>(std::get<NodeTerm*>(expr.value()->var)->var);
+    }
+
+    // Iterative Pratt parser. Every pending binary operator, open paren and
+    // call argument list is a frame on m_expr_stack instead of a native call,
+    // so nesting depth only costs heap and the parse stays linear.
+    std::optional<NodeExpr*> parse_expr(const int min_bp = 0) {
+        const size_t base = m_expr_stack.size();
+        int curr_min_bp = min_bp;
+        while (true) {
+            // operand
+            NodeExpr* operand = nullptr;
+            if (auto int_lit = try_consume(TokenType::Token_IntLit)) {
+                operand = term_expr(m_allocator.emplace<NodeTermInt>(int_lit.value()));
+            }else if (try_consume(TokenType::Token_Alloc)) {
+                try_consume_err(TokenType::Token_LParen);
+                m_expr_stack.push_back({ ExprFrame::Kind::Alloc, curr_min_bp, TokenType::Token_EOF, nullptr, nullptr });
+                curr_min_bp = 0;
+                continue;
+            }else if (auto ident = try_consume(TokenType::Token_Identifier)) {
+                if (try_consume(TokenType::Token_LSquare)) {
+                    auto index = m_allocator.emplace<NodeTermIndex>(ident.value());
+                    m_expr_stack.push_back({ ExprFrame::Kind::Index, curr_min_bp, TokenType::Token_EOF, nullptr, nullptr, index });
+                    curr_min_bp = 0;
+                    continue;
+                }
+                if (!try_consume(TokenType::Token_LParen)) {
+                    operand = term_expr(m_allocator.emplace<NodeTermIdent>(ident.value()));
+                }else {
+                    auto call = m_allocator.emplace<NodeTermCall>();
+                    call->ident = ident.value();
+                    if (try_consume(TokenType::Token_RParen)) {
+                        operand = term_expr(call);
+                    }else {
+                        m_expr_stack.push_back({ ExprFrame::Kind::Call, curr_min_bp, TokenType::Token_EOF, nullptr, call });
+                        curr_min_bp = 0;
+                        continue;
+                    }
+                }
+            }else if (try_consume(TokenType::Token_LParen)) {
+                m_expr_stack.push_back({ ExprFrame::Kind::Paren, curr_min_bp, TokenType::Token_EOF, nullptr, nullptr });
+                curr_min_bp = 0;
+                continue;
+            }else if (m_expr_stack.size() == base) {
+                return {};
+            }else {
+                error_expected(m_expr_stack.back().kind == ExprFrame::Kind::Call ? "argument" : "expression");
             }
 
-            else {
-                assert(false);
+            // operators, reducing frames until the operand's expression is complete
+            while (true) {
+                const std::optional<Token> curr_tok = peek();
+                const BindingPower bp = curr_tok.has_value() ? binding_power(curr_tok->type) : BindingPower {};
+                if (bp.left != 0 && bp.left >= curr_min_bp) {
+                    m_expr_stack.push_back({ ExprFrame::Kind::Binary, curr_min_bp, consume().type, operand, nullptr });
+                    curr_min_bp = bp.right;
+                    break;
+                }
+                if (m_expr_stack.size() == base) {
+                    return operand;
+                }
+                ExprFrame frame = m_expr_stack.back();
+                curr_min_bp = frame.min_bp;
+                if (frame.kind == ExprFrame::Kind::Binary) {
+                    m_expr_stack.pop_back();
+                    operand = bin_expr(frame.op, frame.lhs, operand);
+                }else if (frame.kind == ExprFrame::Kind::Paren) {
+                    m_expr_stack.pop_back();
+                    try_consume_err(TokenType::Token_RParen);
+                    operand = term_expr(m_allocator.emplace<NodeTermParen>(operand));
+                }else if (frame.kind == ExprFrame::Kind::Alloc) {
+                    m_expr_stack.pop_back();
+                    try_consume_err(TokenType::Token_RParen);
+                    operand = term_expr(m_allocator.emplace<NodeTermAlloc>(operand));
+                }else if (frame.kind == ExprFrame::Kind::Index) {
+                    m_expr_stack.pop_back();
+                    try_consume_err(TokenType::Token_RSquare);
+                    frame.index->index = operand;
+                    operand = term_expr(frame.index);
+                }else {
+                    frame.call->args.push_back(operand);
+                    if (try_consume(TokenType::Token_Comma)) {
+                        curr_min_bp = 0;
+                        break;
+                    }
+                    m_expr_stack.pop_back();
+                    try_consume_err(TokenType::Token_RParen);
+                    operand = term_expr(frame.call);
+                }
             }
-            expr_lhs->var = expr;
         }
-        return expr_lhs;
     }
 
     std::optional<NodeScope*> parse_scope() {
@@ -206,7 +508,13 @@ public:
         }
 
         auto scope = m_allocator.emplace<NodeScope>();
-        while (auto stmt = parse_stmt()) {
+        while (true) {
+            const int line = peek().has_value() ? peek()->line : 0;
+            const auto stmt = parse_stmt();
+            if (!stmt) {
+                break;
+            }
+            stmt.value()->line = line;
             scope->stmts.push_back(stmt.value());
         }
 
@@ -267,13 +575,94 @@ public:
         return node;
     }
 
+    // switch (expr) { case 1: { ... } case 7: { ... } default: { ... } }
+    NodeStmtSwitch* parse_switch() {
+        auto stmt_switch = m_allocator.emplace<NodeStmtSwitch>();
+        try_consume_err(TokenType::Token_LParen);
+        if (const auto expr = parse_expr()) {
+            stmt_switch->expr = expr.value();
+        }else {
+            error_expected("expression");
+        }
+        try_consume_err(TokenType::Token_RParen);
+        try_consume_err(TokenType::Token_LBracket);
+
+        std::unordered_set<int64_t> seen;
+        while (true) {
+            if (try_consume(TokenType::Token_Case)) {
+                const Token label = try_consume_err(TokenType::Token_IntLit);
+                int64_t value = 0;
+                const std::string& text = label.value.value();
+                if (std::from_chars(text.data(), text.data() + text.size(), value).ec != std::errc {}) {
+                    error("Case label out of range on line " + std::to_string(label.line));
+                }
+                if (!seen.insert(value).second) {
+                    error("Duplicate case " + text + " on line " + std::to_string(label.line));
+                }
+                try_consume_err(TokenType::Token_Colon);
+                const auto scope = parse_scope();
+                if (!scope.has_value()) {
+                    error_expected("scope");
+                }
+                stmt_switch->cases.push_back({ .label = label, .value = value, .scope = scope.value() });
+            }else if (const auto default_ = try_consume(TokenType::Token_Default)) {
+                if (stmt_switch->default_scope != nullptr) {
+                    error("Duplicate default on line " + std::to_string(default_->line));
+                }
+                try_consume_err(TokenType::Token_Colon);
+                const auto scope = parse_scope();
+                if (!scope.has_value()) {
+                    error_expected("scope");
+                }
+                stmt_switch->default_scope = scope.value();
+            }else {
+                break;
+            }
+        }
+        try_consume_err(TokenType::Token_RBracket);
+        return stmt_switch;
+    }
+
+    // parallel for (i = lo, hi) reduce (sum) { ... }, the `parallel` is consumed
+    NodeStmtParallelFor* parse_parallel_for() {
+        auto loop = m_allocator.emplace<NodeStmtParallelFor>();
+        try_consume_err(TokenType::Token_For);
+        try_consume_err(TokenType::Token_LParen);
+        loop->ident = try_consume_err(TokenType::Token_Identifier);
+        try_consume_err(TokenType::Token_Assign);
+        if (const auto lo = parse_expr()) {
+            loop->lo = lo.value();
+        }else {
+            error_expected("expression");
+        }
+        try_consume_err(TokenType::Token_Comma);
+        if (const auto hi = parse_expr()) {
+            loop->hi = hi.value();
+        }else {
+            error_expected("expression");
+        }
+        try_consume_err(TokenType::Token_RParen);
+        if (try_consume(TokenType::Token_Reduce)) {
+            try_consume_err(TokenType::Token_LParen);
+            loop->reduce = try_consume_err(TokenType::Token_Identifier);
+            try_consume_err(TokenType::Token_RParen);
+        }
+        if (const auto body = parse_scope()) {
+            loop->body = body.value();
+        }else {
+            error_expected("scope");
+        }
+        ParallelForCheck(loop, m_throw_errors).run();
+        return loop;
+    }
+
     std::optional<NodeStmt*> parse_stmt() {
         if (peek().has_value() && peek().value().type == TokenType::Token_Int &&
                 peek(1).has_value() && peek(1).value().type == TokenType::Token_Identifier &&
                 peek(2).has_value() && peek(2).value().type == TokenType::Token_Assign) {
 
-            consume();
             auto stmt_int = m_allocator.emplace<NodeStmtInt> ();
+            stmt_int->type = int_type(consume());
             stmt_int->ident = consume();
 
             consume();
@@ -291,9 +680,8 @@ public:
         }
         if (peek().has_value() && peek().value().type == TokenType::Token_Int &&
                 peek(1).has_value() && peek(1).value().type == TokenType::Token_Identifier) {
-            consume();
-
             auto stmt_int = m_allocator.emplace<NodeStmtInt>();
+            stmt_int->type = int_type(consume());
             stmt_int->ident = consume();
 
             if (try_consume(TokenType::Token_Assign)) {
@@ -321,10 +709,16 @@ public:
             }
             try_consume_err(TokenType::Token_Semi);
             auto stmt = m_allocator.emplace<NodeStmt>(assign);
-            std::cout << assign->ident.line << std::endl;
             return stmt;
 
         }
+        if (peek().has_value() && peek().value().type == TokenType::Token_Identifier &&
+                peek(1).has_value() && peek(1).value().type == TokenType::Token_LParen) {
+            const auto stmt_call = m_allocator.emplace<NodeStmtCall>(parse_call());
+            try_consume_err(TokenType::Token_Semi);
+            auto stmt = m_allocator.emplace<NodeStmt>(stmt_call);
+            return stmt;
+        }
         if (peek().has_value() && peek().value().type == TokenType::Token_LBracket) {
             if (auto scope = parse_scope()) {
                 auto stmt = m_allocator.emplace<NodeStmt>(scope.value());
@@ -353,6 +747,54 @@ public:
             auto stmt = m_allocator.emplace<NodeStmt>(stmt_if);
             return stmt;
         }
+        if (peek().has_value() && peek().value().type == TokenType::Token_Identifier &&
+                peek(1).has_value() && peek(1).value().type == TokenType::Token_LSquare) {
+            auto store = m_allocator.emplace<NodeStmtStore>(consume());
+            consume();
+            if (const auto index = parse_expr()) {
+                store->index = index.value();
+            }else {
+                error_expected("expression");
+            }
+            try_consume_err(TokenType::Token_RSquare);
+            try_consume_err(TokenType::Token_Assign);
+            if (const auto expr = parse_expr()) {
+                store->expr = expr.value();
+            }else {
+                error_expected("expression");
+            }
+            try_consume_err(TokenType::Token_Semi);
+            auto stmt = m_allocator.emplace<NodeStmt>(store);
+            return stmt;
+        }
+        if (const auto reset = try_consume(TokenType::Token_Reset)) {
+            try_consume_err(TokenType::Token_LParen);
+            try_consume_err(TokenType::Token_RParen);
+            try_consume_err(TokenType::Token_Semi);
+            auto stmt = m_allocator.emplace<NodeStmt>(m_allocator.emplace<NodeStmtReset>(reset.value()));
+            return stmt;
+        }
+        if (try_consume(TokenType::Token_Print)) {
+            try_consume_err(TokenType::Token_LParen);
+            auto stmt_print = m_allocator.emplace<NodeStmtPrint>();
+            if (const auto expr = parse_expr()) {
+                stmt_print->expr = expr.value();
+            }else {
+                error_expected("expression");
+            }
+            try_consume_err(TokenType::Token_RParen);
+            try_consume_err(TokenType::Token_Semi);
+            auto stmt = m_allocator.emplace<NodeStmt>(stmt_print);
+            return stmt;
+        }
+        if (try_consume(TokenType::Token_Switch)) {
+            auto stmt = m_allocator.emplace<NodeStmt>(parse_switch());
+            return stmt;
+        }
+        if (try_consume(TokenType::Token_Parallel)) {
+            auto stmt = m_allocator.emplace<NodeStmt>(parse_parallel_for());
+            return stmt;
+        }
         if (peek().has_value() && peek().value().type == TokenType::Token_Return) {
             consume();
             auto ret = parse_return_stmt();
@@ -365,10 +807,49 @@ public:
         return {};
     }
 
+    std::optional<NodeStmt*> parse_func() {
+        if (!(peek().has_value() && peek().value().type == TokenType::Token_Int &&
+                peek(1).has_value() && peek(1).value().type == TokenType::Token_Identifier &&
+                peek(2).has_value() && peek(2).value().type == TokenType::Token_LParen)) {
+            return {};
+        }
+        auto func = m_allocator.emplace<NodeStmtFunc>();
+        func->ret = int_type(consume());
+        func->ident = consume();
+        consume();
+        if (!try_consume(TokenType::Token_RParen)) {
+            do {
+                func->param_types.push_back(int_type(try_consume_err(TokenType::Token_Int)));
+                func->params.push_back(try_consume_err(TokenType::Token_Identifier));
+            } while (try_consume(TokenType::Token_Comma));
+            try_consume_err(TokenType::Token_RParen);
+        }
+        if (const auto body = parse_scope()) {
+            func->body = body.value();
+        }else {
+            error_expected("function body");
+        }
+        auto stmt = m_allocator.emplace<NodeStmt>(func);
+        return stmt;
+    }
+
+    // a top-level statement is either a function definition or a plain statement
+    std::optional<NodeStmt*> parse_top_level_stmt() {
+        const int line = peek().has_value() ? peek()->line : 0;
+        auto stmt = parse_func();
+        if (!stmt) {
+            stmt = parse_stmt();
+        }
+        if (stmt) {
+            stmt.value()->line = line;
+        }
+        return stmt;
+    }
+
     std::optional<NodeProg> parse_program() {
         NodeProg prog;
         while (peek().has_value() && peek()->type != TokenType::Token_EOF) {
-            auto stmt = parse_stmt();
+            auto stmt = parse_top_level_stmt();
             if (!stmt) {
                 error_expected("statement");
             }else {
@@ -377,12 +858,97 @@ public:
         }
         return prog;
     }
+
+    // Parses a new token vector with the same arena, so nodes handed out
+    // earlier stay valid. Used by IncrementalCompiler for each damaged window.
+    void reset_tokens(std::vector<Token> tokens) {
+        data = std::move(tokens);
+        c_Index = 0;
+        m_expr_stack.clear(); // left over when the last window threw
+    }
+
+    // tokens consumed from the current vector
+    [[nodiscard]] size_t position() const {
+        return c_Index;
+    }
+
+    // next top-level statement, empty at EOF
+    std::optional<NodeStmt*> parse_next() {
+        if (!peek().has_value() || peek()->type == TokenType::Token_EOF) {
+            return {};
+        }
+        auto stmt = parse_top_level_stmt();
+        if (!stmt) {
+            error_expected("statement");
+        }
+        return stmt;
+    }
+
+    // Streaming callers take a mark before parse_next() and release it once
+    // the statement is emitted, so the arena holds one statement at a time.
+    [[nodiscard]] ArenaAllocator::Mark ast_mark() const {
+        return m_allocator.mark();
+    }
+
+    void release_ast(const ArenaAllocator::Mark& mark) {
+        m_allocator.release(mark);
+    }
 private:
-    const std::vector<Token> data;
-    int c_Index = 0;
+    std::vector<Token> data;
+    size_t c_Index = 0;
+    std::function<bool(std::vector<Token>&)> m_refill{};
     ArenaAllocator m_allocator;
+    bool m_throw_errors = false;
+
+    // a pending operator, open paren, argument list or subscript of parse_expr
+    struct ExprFrame {
+        enum class Kind { Binary, Paren, Call, Alloc, Index } kind;
+        int min_bp;                   // restored when the frame is reduced
+        TokenType op;                 // Binary
+        NodeExpr* lhs;                // Binary
+        NodeTermCall* call;           // Call
+        NodeTermIndex* index{};       // Index
+    };
+    std::vector<ExprFrame> m_expr_stack{};
+
+    // of an `int`, `i32`, `u8`, ... token
+    static IntType int_type(const Token& tok) {
+        return int_type_from(tok.value.value()).value_or(IntType::I64);
+    }
+
+    [[noreturn]] void error(const std::string& msg) const {
+        syntax_error("[Parse Error] " + msg, m_throw_errors);
+    }
+
+    template <typename T> NodeExpr* term_expr(T* term) {
+        return m_allocator.emplace<NodeExpr>(m_allocator.emplace<NodeTerm>(term));
+    }
+
+    NodeExpr* bin_expr(const TokenType op, NodeExpr* lhs, NodeExpr* rhs) {
+        auto expr = m_allocator.emplace<NodeBinExpr>();
+        switch (op) {
+            case TokenType::Token_Plus: expr->var = m_allocator.emplace<NodeBinExprAdd>(lhs, rhs); break;
+            case TokenType::Token_Minus: expr->var = m_allocator.emplace<NodeBinExprSub>(lhs, rhs); break;
+            case TokenType::Token_Star: expr->var = m_allocator.emplace<NodeBinExprMulti>(lhs, rhs); break;
+            case TokenType::Token_Dividend: expr->var = m_allocator.emplace<NodeBinExprDiv>(lhs, rhs); break;
+            case TokenType::Token_Equal: expr->var = m_allocator.emplace<NodeBinExprEqual>(lhs, rhs); break;
+            default: assert(false);
+        }
+        return m_allocator.emplace<NodeExpr>(expr);
+    }
+
+    void refill(const size_t offset) {
+        while (m_refill && c_Index + offset >= data.size()) {
+            data.erase(data.begin(), data.begin() + static_cast<std::ptrdiff_t>(c_Index));
+            c_Index = 0;
+            if (!m_refill(data)) {
+                m_refill = nullptr;
+            }
+        }
+    }
 
-    [[nodiscard]]std::optional<Token> peek(const size_t offset=0) const {
+    [[nodiscard]]std::optional<Token> peek(const size_t offset=0) {
+        refill(offset);
         if (c_Index + offset < data.size()) {
             auto tok = data[c_Index + offset];
             return tok;
@@ -391,6 +957,7 @@ private:
     }
 
     Token consume() {
+        refill(0);
         if (c_Index < data.size()) {
             return data[c_Index++];
         }
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "parser.hpp"
+#include "ast_printer.hpp"
+
+enum class OptLevel : uint8_t { O0, O1, O2 };
+
+inline std::optional<OptLevel> opt_level_from(const std::string_view flag) {
+    if (flag == "-O0") { return OptLevel::O0; }
+    if (flag == "-O1") { return OptLevel::O1; }
+    if (flag == "-O2") { return OptLevel::O2; }
+    return {};
+}
+
+// What the Generator does on its own at a level; these work on the emitted
+// code rather than the AST, so they are switched instead of scheduled.
+struct CodegenOptions {
+    bool instruction_selection = true;
+    bool block_layout = true;
+    bool inlining = true;
+
+    static CodegenOptions at(const OptLevel level) {
+        return {
+            .instruction_selection = level >= OptLevel::O1,
+            .block_layout = level >= OptLevel::O1,
+            .inlining = level >= OptLevel::O2,
+        };
+    }
+};
+
+// A transformation of the whole program between parsing and emission.
+// `run` returns how many changes it made.
+struct Pass {
+    std::string name;
+    OptLevel level;                   // lowest level it runs at
+    std::vector<std::string> depends; // run first, even below their own level
+    std::function<size_t(NodeProg&)> run;
+};
+
+struct PassStats {
+    std::string name;
+    std::chrono::nanoseconds time;
+    size_t changes;
+};
+
+// Schedules the registered passes for an -O level: every pass at or below
+// the level plus whatever they depend on, each after its dependencies and
+// otherwise in registration order.
+class PassManager {
+public:
+    void add(Pass pass) {
+        for (const std::string& dep : pass.depends) {
+            if (find(dep) == nullptr) {
+                std::cerr << "Pass " << pass.name << " depends on unknown pass " << dep << std::endl;
+                exit(EXIT_FAILURE);
+            }
+        }
+        m_passes.push_back(std::move(pass));
+    }
+
+    [[nodiscard]] bool has(const std::string_view name) const {
+        return find(name) != nullptr;
+    }
+
+    // dumps the program to `out` after every run of `name`
+    void set_print_after(std::string name, std::ostream& out) {
+        if (!has(name)) {
+            std::cerr << "Unknown pass: " << name << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        m_print_after = std::move(name);
+        m_print_out = &out;
+    }
+
+    [[nodiscard]] std::vector<const Pass*> schedule(const OptLevel level) const {
+        std::vector<const Pass*> order;
+        for (const Pass& pass : m_passes) {
+            if (pass.level <= level) {
+                visit(pass, order);
+            }
+        }
+        return order;
+    }
+
+    std::vector<PassStats> run(NodeProg& prog, const OptLevel level) const {
+        std::vector<PassStats> stats;
+        for (const Pass* pass : schedule(level)) {
+            const auto start = std::chrono::steady_clock::now();
+            const size_t changes = pass->run(prog);
+            stats.push_back({ .name = pass->name, .time = std::chrono::steady_clock::now() - start, .changes = changes });
+            if (m_print_out != nullptr && m_print_after == pass->name) {
+                *m_print_out << "// *** after " << pass->name << " ***\n";
+                AstPrinter(*m_print_out).program(prog);
+            }
+        }
+        return stats;
+    }
+
+    static void print_stats(const std::vector<PassStats>& stats, std::ostream& out) {
+        out << std::left << std::setw(12) << "pass" << std::right << std::setw(12) << "time (us)" << std::setw(10) << "changes" << "\n";
+        for (const PassStats& s : stats) {
+            out << std::left << std::setw(12) << s.name << std::right << std::setw(12) << std::fixed << std::setprecision(1)
+                << std::chrono::duration<double, std::micro>(s.time).count() << std::setw(10) << s.changes << "\n";
+        }
+    }
+
+private:
+    [[nodiscard]] const Pass* find(const std::string_view name) const {
+        const auto it = std::ranges::find(m_passes, name, &Pass::name);
+        return it != m_passes.end() ? &*it : nullptr;
+    }
+
+    // dependencies are registered before their users, so this cannot cycle
+    void visit(const Pass& pass, std::vector<const Pass*>& order) const {
+        if (std::ranges::find(order, &pass) != order.end()) {
+            return;
+        }
+        for (const std::string& dep : pass.depends) {
+            visit(*find(dep), order);
+        }
+        order.push_back(&pass);
+    }
+
+    std::vector<Pass> m_passes{};
+    std::string m_print_after{};
+    std::ostream* m_print_out = nullptr;
+};
@@ -0,0 +1,343 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+#include "arena.hpp"
+#include "parser.hpp"
+#include "pass_manager.hpp"
+#include "type_check.hpp"
+
+// The AST passes every -O level picks from:
+//
+//   types  types the program, for the passes after it (no changes)
+//   fold   folds `+ - * / ==` on literals and drops `x + 0`, `x - 0`, `x * 1`,
+//          `x / 1`, turns a side effect free `x * 0` into 0
+//   dce    drops statements after a `return` and `if`/`elif` branches whose
+//          condition is a literal
+//
+// Passes only rewrite; every diagnostic has been given by the time they run,
+// so a program is accepted or rejected the same way at every level.
+class StandardPasses {
+public:
+    StandardPasses() : m_allocator(1024 * 64) {}
+
+    void register_with(PassManager& passes) {
+        passes.add({ .name = "types", .level = OptLevel::O1, .depends = {}, .run = [this](NodeProg& prog) {
+            m_types.emplace();
+            m_types->record_stored();
+            m_types->check_program(prog);
+            return size_t { 0 };
+        } });
+        passes.add({ .name = "fold", .level = OptLevel::O1, .depends = { "types" }, .run = [this](NodeProg& prog) {
+            size_t changes = 0;
+            for_each_stmt(prog.stmts, [&](NodeStmt* stmt) { changes += fold_stmt(stmt); });
+            return changes;
+        } });
+        passes.add({ .name = "dce", .level = OptLevel::O1, .depends = { "fold" }, .run = [this](NodeProg& prog) {
+            return dce(prog.stmts);
+        } });
+    }
+
+private:
+    // the literal `expr` is, seen through parentheses
+    static const Token* literal_token(const NodeExpr* expr) {
+        while (const auto term = std::get_if<NodeTerm*>(&expr->var)) {
+            if (const auto paren = std::get_if<NodeTermParen*>(&(*term)->var)) {
+                expr = (*paren)->expr;
+                continue;
+            }
+            if (const auto lit = std::get_if<NodeTermInt*>(&(*term)->var)) {
+                return &(*lit)->int_lit;
+            }
+            break;
+        }
+        return nullptr;
+    }
+
+    // a literal the type checker types as i64
+    static std::optional<int64_t> literal(const NodeExpr* expr) {
+        const Token* token = literal_token(expr);
+        if (token == nullptr || TypeChecker::literal_value(*token) > INT64_MAX) {
+            return {};
+        }
+        return static_cast<int64_t>(TypeChecker::literal_value(*token));
+    }
+
+    // reads variables and literals only, and cannot trap
+    static bool pure(const NodeExpr* root) {
+        std::vector<const NodeExpr*> todo { root };
+        while (!todo.empty()) {
+            const NodeExpr* expr = todo.back();
+            todo.pop_back();
+            if (const auto bin = std::get_if<NodeBinExpr*>(&expr->var)) {
+                if (std::holds_alternative<NodeBinExprDiv*>((*bin)->var)) {
+                    return false;
+                }
+                todo.push_back(expr_child(expr, 0));
+                todo.push_back(expr_child(expr, 1));
+                continue;
+            }
+            const NodeTerm* term = std::get<NodeTerm*>(expr->var);
+            if (const auto paren = std::get_if<NodeTermParen*>(&term->var)) {
+                todo.push_back((*paren)->expr);
+            }else if (!std::holds_alternative<NodeTermInt*>(term->var) && !std::holds_alternative<NodeTermIdent*>(term->var)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void set_literal(NodeExpr* expr, const int64_t value, const int line) {
+        const Token token { .type = TokenType::Token_IntLit, .line = line, .column = 0, .value = std::to_string(value) };
+        expr->var = m_allocator.emplace<NodeTerm>(m_allocator.emplace<NodeTermInt>(token));
+        expr->type = IntType::I64;
+    }
+
+    // i64 arithmetic as the generated code does it, wrapping on overflow
+    template <typename Op> static std::optional<int64_t> evaluate(const int64_t lhs, const int64_t rhs) {
+        const auto l = static_cast<uint64_t>(lhs);
+        const auto r = static_cast<uint64_t>(rhs);
+        if constexpr (std::is_same_v<Op, NodeBinExprAdd>) { return static_cast<int64_t>(l + r); }
+        else if constexpr (std::is_same_v<Op, NodeBinExprSub>) { return static_cast<int64_t>(l - r); }
+        else if constexpr (std::is_same_v<Op, NodeBinExprMulti>) { return static_cast<int64_t>(l * r); }
+        else if constexpr (std::is_same_v<Op, NodeBinExprDiv>) {
+            if (rhs == 0) {
+                return {}; // left to trap at run time
+            }
+            return lhs / rhs;
+        }else {
+            return lhs == rhs ? 1 : 0;
+        }
+    }
+
+    // Folds the tree under `root` bottom up, every node once its children are
+    // folded.
+    size_t fold_expr(NodeExpr* root) {
+        size_t changes = 0;
+        m_paren_targets.clear();
+        walk_expr(root, [&](NodeExpr* expr, const size_t done, const size_t count) {
+            const auto term = std::get_if<NodeTerm*>(&expr->var);
+            const auto paren = term != nullptr ? std::get_if<NodeTermParen*>(&(*term)->var) : nullptr;
+            if (paren != nullptr && done == 0) {
+                if (const std::optional<IntType> target = this->target(expr)) {
+                    m_paren_targets.insert_or_assign((*paren)->expr, target.value());
+                }
+            }
+            if (done == count) {
+                changes += fold_node(expr);
+            }
+        });
+        return changes;
+    }
+
+    // what a literal in place of `expr` is checked against, the type it is
+    // stored as, which parentheses hand down to the expression inside
+    std::optional<IntType> target(const NodeExpr* expr) const {
+        const auto it = m_paren_targets.find(expr);
+        return it != m_paren_targets.end() ? std::optional(it->second) : m_types->stored_as(expr);
+    }
+
+    // Folds `expr` itself. A result that would not fit its target stays
+    // unfolded, and so do negative ones, which have no literal.
+    size_t fold_node(NodeExpr* expr) {
+        if (std::holds_alternative<NodeTerm*>(expr->var)) {
+            return 0;
+        }
+        const std::optional<IntType> target = this->target(expr);
+        return std::visit([&](auto* op) -> size_t {
+            using Op = std::remove_cvref_t<decltype(*op)>;
+            const std::optional<int64_t> lhs = literal(op->lhs);
+            const std::optional<int64_t> rhs = literal(op->rhs);
+            if (lhs.has_value() && rhs.has_value()) {
+                const std::optional<int64_t> value = evaluate<Op>(lhs.value(), rhs.value());
+                if (!value.has_value() || value.value() < 0 ||
+                        (target.has_value() && !literal_fits(value.value(), target.value()))) {
+                    return 0;
+                }
+                set_literal(expr, value.value(), literal_token(op->lhs)->line);
+                return 1;
+            }
+            // x stands in for the node only with the node's own type
+            const auto keep = [&](const NodeExpr* x) {
+                if (literal_token(x) != nullptr || x->type != expr->type) {
+                    return false;
+                }
+                expr->var = x->var;
+                return true;
+            };
+            bool changed = false;
+            if constexpr (std::is_same_v<Op, NodeBinExprAdd>) {
+                changed = (rhs == 0 && keep(op->lhs)) || (lhs == 0 && keep(op->rhs));
+            }else if constexpr (std::is_same_v<Op, NodeBinExprSub>) {
+                changed = rhs == 0 && keep(op->lhs);
+            }else if constexpr (std::is_same_v<Op, NodeBinExprMulti>) {
+                changed = (rhs == 1 && keep(op->lhs)) || (lhs == 1 && keep(op->rhs));
+                const NodeExpr* other = rhs == 0 ? op->lhs : op->rhs;
+                if (!changed && (rhs == 0 || lhs == 0) && expr->type == IntType::I64 && pure(other)) {
+                    set_literal(expr, 0, 0);
+                    changed = true;
+                }
+            }else if constexpr (std::is_same_v<Op, NodeBinExprDiv>) {
+                changed = rhs == 1 && keep(op->lhs);
+            }
+            return changed ? 1 : 0;
+        }, std::get<NodeBinExpr*>(expr->var)->var);
+    }
+
+    // the expressions of `stmt` itself, not of the statements nested in it
+    size_t fold_stmt(NodeStmt* stmt) {
+        struct StmtVisitor {
+            StandardPasses& p;
+            size_t operator()(const NodeStmtInt* stmt_int) const { return stmt_int->expr != nullptr ? p.fold_expr(stmt_int->expr) : 0; }
+            size_t operator()(const NodeScope*) const { return 0; }
+            size_t operator()(const NodeStmtIf* stmt_if) const {
+                size_t changes = p.fold_expr(stmt_if->expr);
+                for (auto pred = stmt_if->pred; pred.has_value();) {
+                    const auto elif = std::get_if<NodeIfPredElif*>(&pred.value()->var);
+                    if (elif == nullptr) {
+                        break;
+                    }
+                    changes += p.fold_expr((*elif)->expr);
+                    pred = (*elif)->pred;
+                }
+                return changes;
+            }
+            size_t operator()(const NodeStmtAssign* stmt_assign) const { return p.fold_expr(stmt_assign->expr); }
+            size_t operator()(const NodeStmtReturn* stmt_return) const { return p.fold_expr(stmt_return->expr); }
+            size_t operator()(const NodeStmtCall* stmt_call) const {
+                size_t changes = 0;
+                for (NodeExpr* arg : stmt_call->call->args) {
+                    changes += p.fold_expr(arg);
+                }
+                return changes;
+            }
+            size_t operator()(const NodeStmtFunc*) const { return 0; }
+            size_t operator()(const NodeStmtSwitch* stmt_switch) const { return p.fold_expr(stmt_switch->expr); }
+            size_t operator()(const NodeStmtPrint* stmt_print) const { return p.fold_expr(stmt_print->expr); }
+            size_t operator()(const NodeStmtStore* stmt_store) const {
+                return p.fold_expr(stmt_store->index) + p.fold_expr(stmt_store->expr);
+            }
+            size_t operator()(const NodeStmtReset*) const { return 0; }
+            size_t operator()(const NodeStmtParallelFor* loop) const { return p.fold_expr(loop->lo) + p.fold_expr(loop->hi); }
+        };
+        return std::visit(StmtVisitor { .p = *this }, stmt->var);
+    }
+
+    // the scopes nested directly in `stmt`
+    template <typename F> static void for_each_scope(NodeStmt* stmt, F&& f) {
+        if (const auto scope = std::get_if<NodeScope*>(&stmt->var)) {
+            f(*scope);
+        }else if (const auto stmt_if = std::get_if<NodeStmtIf*>(&stmt->var)) {
+            f((*stmt_if)->scope);
+            for (auto pred = (*stmt_if)->pred; pred.has_value();) {
+                if (const auto els = std::get_if<NodeIfPredElse*>(&pred.value()->var)) {
+                    f((*els)->scope);
+                    break;
+                }
+                const NodeIfPredElif* elif = std::get<NodeIfPredElif*>(pred.value()->var);
+                f(elif->scope);
+                pred = elif->pred;
+            }
+        }else if (const auto func = std::get_if<NodeStmtFunc*>(&stmt->var)) {
+            f((*func)->body);
+        }else if (const auto stmt_switch = std::get_if<NodeStmtSwitch*>(&stmt->var)) {
+            for (const NodeSwitchCase& c : (*stmt_switch)->cases) {
+                f(c.scope);
+            }
+            if ((*stmt_switch)->default_scope != nullptr) {
+                f((*stmt_switch)->default_scope);
+            }
+        }else if (const auto loop = std::get_if<NodeStmtParallelFor*>(&stmt->var)) {
+            f((*loop)->body);
+        }
+    }
+
+    // every statement, outer ones first
+    template <typename F> static void for_each_stmt(const std::vector<NodeStmt*>& stmts, F&& f) {
+        for (NodeStmt* stmt : stmts) {
+            f(stmt);
+            for_each_scope(stmt, [&](const NodeScope* scope) { for_each_stmt(scope->stmts, f); });
+        }
+    }
+
+    // Rewrites an `if` whose condition is a literal into the branch it takes;
+    // false when nothing is left of it.
+    bool fold_if(NodeStmt* stmt, size_t& changes) {
+        while (const auto stmt_if = std::get_if<NodeStmtIf*>(&stmt->var)) {
+            const std::optional<int64_t> cond = literal((*stmt_if)->expr);
+            if (!cond.has_value()) {
+                break;
+            }
+            changes++;
+            if (cond.value() != 0) {
+                stmt->var = (*stmt_if)->scope;
+                return true;
+            }
+            if (!(*stmt_if)->pred.has_value()) {
+                return false;
+            }
+            const NodeIfPred* pred = (*stmt_if)->pred.value();
+            if (const auto els = std::get_if<NodeIfPredElse*>(&pred->var)) {
+                stmt->var = (*els)->scope;
+                return true;
+            }
+            const NodeIfPredElif* elif = std::get<NodeIfPredElif*>(pred->var);
+            (*stmt_if)->expr = elif->expr;
+            (*stmt_if)->scope = elif->scope;
+            (*stmt_if)->pred = elif->pred;
+        }
+        const auto stmt_if = std::get_if<NodeStmtIf*>(&stmt->var);
+        if (stmt_if == nullptr) {
+            return true;
+        }
+        std::optional<NodeIfPred*>* pred = &(*stmt_if)->pred;
+        while (pred->has_value()) {
+            const auto elif = std::get_if<NodeIfPredElif*>(&pred->value()->var);
+            if (elif == nullptr) {
+                break;
+            }
+            const std::optional<int64_t> cond = literal((*elif)->expr);
+            if (!cond.has_value()) {
+                pred = &(*elif)->pred;
+                continue;
+            }
+            changes++;
+            if (cond.value() != 0) {
+                *pred = m_allocator.emplace<NodeIfPred>(m_allocator.emplace<NodeIfPredElse>((*elif)->scope));
+                break;
+            }
+            *pred = (*elif)->pred;
+        }
+        return true;
+    }
+
+    // functions after a `return` are still callable, so only they survive it
+    size_t dce(std::vector<NodeStmt*>& stmts) {
+        size_t changes = 0;
+        bool returned = false;
+        std::vector<NodeStmt*> kept;
+        kept.reserve(stmts.size());
+        for (NodeStmt* stmt : stmts) {
+            if (returned && !std::holds_alternative<NodeStmtFunc*>(stmt->var)) {
+                changes++;
+                continue;
+            }
+            if (!fold_if(stmt, changes)) {
+                continue;
+            }
+            for_each_scope(stmt, [&](NodeScope* scope) { changes += dce(scope->stmts); });
+            returned = returned || std::holds_alternative<NodeStmtReturn*>(stmt->var);
+            kept.push_back(stmt);
+        }
+        stmts = std::move(kept);
+        return changes;
+    }
+
+    ArenaAllocator m_allocator; // nodes the passes create
+    std::optional<TypeChecker> m_types{};
+    std::unordered_map<const NodeExpr*, IntType> m_paren_targets{}; // of the expression folded, see target()
+};
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <string>
+#include <thread>
+#include <vector>
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "generation.hpp"
+#include "pass_manager.hpp"
+#include "spsc_queue.hpp"
+
+// Runs lexing, parsing and code generation as three overlapping stages:
+//
+//   lexer --token batches--> parser --top-level statements--> codegen
+//
+// connected by lock-free single-producer/single-consumer rings, so the end to
+// end time approaches that of the slowest stage instead of the sum of all three.
+// The Parser owns the AST arena and outlives the codegen thread that reads it.
+class Pipeline {
+public:
+    static constexpr size_t token_batch_size = 4096;
+    static constexpr size_t token_ring_size = 64;    // batches
+    static constexpr size_t stmt_ring_size = 4096;   // statements
+
+    explicit Pipeline(std::string src) : m_src(std::move(src)) {}
+
+    // see Generator::set_debug_info
+    void set_debug_info(std::string source_path, std::string asm_name) {
+        m_debug_source = std::move(source_path);
+        m_debug_asm = std::move(asm_name);
+    }
+
+    // inlining stays off, it needs the whole program
+    void set_codegen_options(const CodegenOptions& options) {
+        m_codegen = options;
+    }
+
+    [[nodiscard]] std::string compile() {
+        SpscQueue<std::vector<Token>> token_ring(token_ring_size);
+        SpscQueue<NodeStmt*> stmt_ring(stmt_ring_size);
+
+        Parser parser([&](std::vector<Token>& tokens) {
+            std::vector<Token> batch;
+            if (!token_ring.pop(batch)) {
+                return false;
+            }
+            tokens.insert(tokens.end(), std::make_move_iterator(batch.begin()), std::make_move_iterator(batch.end()));
+            return true;
+        });
+
+        std::string assembly;
+        {
+            std::jthread lexer([&] {
+                Tokenizer tokenizer(std::move(m_src));
+                tokenizer.tokenize_batches(token_batch_size, [&](std::vector<Token>& batch) {
+                    token_ring.push(std::move(batch));
+                });
+                token_ring.close();
+            });
+
+            std::jthread codegen([&] {
+                Generator generator(NodeProg{});
+                generator.set_inlining(false);
+                generator.set_instruction_selection(m_codegen.instruction_selection);
+                generator.set_block_layout(m_codegen.block_layout);
+                if (!m_debug_source.empty()) {
+                    generator.set_debug_info(m_debug_source, m_debug_asm);
+                }
+                generator.begin_prog();
+                NodeStmt* stmt = nullptr;
+                while (stmt_ring.pop(stmt)) {
+                    generator.gen_top_level(stmt);
+                }
+                assembly = generator.end_prog();
+            });
+
+            // the parser runs on the calling thread
+            while (const auto stmt = parser.parse_next()) {
+                stmt_ring.push(stmt.value());
+            }
+            stmt_ring.close();
+        }
+        return assembly;
+    }
+
+private:
+    std::string m_src;
+    std::string m_debug_source{};
+    CodegenOptions m_codegen{};
+    std::string m_debug_asm{};
+};
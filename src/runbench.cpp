@@ -0,0 +1,544 @@
+// hy_runbench: compiles the .hy kernels in bench/kernels, runs every produced
+// executable a number of times and reads hardware counters for the child
+// process through perf_event_open, then compares the medians with a stored
+// baseline so codegen regressions show up as numbers. Kernels go through the
+// same passes and Generator options as `comp` at the chosen -O level.
+//
+//   hy_runbench [-O0|-O1|-O2] [--runs=N] [--baseline=FILE] [--write-baseline] [--threshold=PCT] [--wall-threshold=PCT] [kernel.hy ...]
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <elf.h>
+#include <unistd.h>
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "generation.hpp"
+#include "pass_manager.hpp"
+#include "passes.hpp"
+
+#ifndef HY_BENCH_DIR
+#define HY_BENCH_DIR "bench"
+#endif
+
+namespace fs = std::filesystem;
+
+// one row of the table, in the order the counters are opened
+struct Counter {
+    const char* name;
+    uint32_t type;
+    uint64_t config;
+};
+
+static constexpr Counter counters[] = {
+    { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { "branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    { "l1d_misses", PERF_TYPE_HW_CACHE,
+      PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+};
+static constexpr size_t num_counters = std::size(counters);
+
+using Metrics = std::map<std::string, double>;
+
+struct Options {
+    OptLevel level = OptLevel::O2;
+    int runs = 10;
+    double threshold = 5.0; // percent
+    double wall_threshold = 25.0; // percent, wall time is noisier than the counters
+    bool write_baseline = false;
+    fs::path baseline = fs::path(HY_BENCH_DIR) / "baseline.json";
+    std::vector<fs::path> kernels{};
+};
+
+struct RunResult {
+    bool ok = false;
+    int exit_code = 0;
+    double wall_ns = 0;
+    std::optional<std::array<uint64_t, num_counters>> counts{};
+};
+
+// Counters are opened on the forked child before it execs, disabled, with
+// enable_on_exec, so only the kernel itself is measured and not the fork or
+// the dynamic setup of this process. The child waits on a pipe until they are
+// attached. User space only, which is what perf_event_paranoid=2 allows.
+class ChildCounters {
+public:
+    // returns an error string instead of throwing so that the caller can fall
+    // back to wall-clock timing
+    std::optional<std::string> open(const pid_t pid) {
+        for (size_t i = 0; i < num_counters; i++) {
+            perf_event_attr attr {};
+            attr.size = sizeof(attr);
+            attr.type = counters[i].type;
+            attr.config = counters[i].config;
+            attr.disabled = i == 0;          // members follow the group leader
+            attr.enable_on_exec = i == 0;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP;
+            const int group = m_fds.empty() ? -1 : m_fds.front();
+            const long fd = syscall(SYS_perf_event_open, &attr, pid, -1, group, PERF_FLAG_FD_CLOEXEC);
+            if (fd < 0) {
+                const int err = errno;
+                close_all();
+                return std::string(counters[i].name) + ": " + std::strerror(err)
+                    + (err == EACCES || err == EPERM ? " (see /proc/sys/kernel/perf_event_paranoid)" : "");
+            }
+            m_fds.push_back(static_cast<int>(fd));
+        }
+        return {};
+    }
+
+    [[nodiscard]] std::optional<std::array<uint64_t, num_counters>> read() const {
+        struct {
+            uint64_t nr;
+            uint64_t values[num_counters];
+        } group {};
+        if (m_fds.empty() || ::read(m_fds.front(), &group, sizeof(group)) != static_cast<ssize_t>(sizeof(group))
+                || group.nr != num_counters) {
+            return {};
+        }
+        std::array<uint64_t, num_counters> out {};
+        std::copy_n(group.values, num_counters, out.begin());
+        return out;
+    }
+
+    ~ChildCounters() {
+        close_all();
+    }
+
+private:
+    void close_all() {
+        for (const int fd : m_fds) {
+            close(fd);
+        }
+        m_fds.clear();
+    }
+
+    std::vector<int> m_fds{};
+};
+
+static RunResult run_once(const fs::path& exe, bool& use_counters, std::string& counter_error) {
+    RunResult result;
+    int go[2];
+    if (pipe2(go, O_CLOEXEC) != 0) {
+        return result;
+    }
+    const pid_t pid = fork();
+    if (pid < 0) {
+        close(go[0]);
+        close(go[1]);
+        return result;
+    }
+    if (pid == 0) {
+        close(go[1]);
+        char c;
+        if (::read(go[0], &c, 1) != 1) {
+            _exit(127);
+        }
+        const int null = ::open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        execl(exe.c_str(), exe.c_str(), static_cast<char*>(nullptr));
+        _exit(127);
+    }
+    close(go[0]);
+
+    ChildCounters perf;
+    if (use_counters) {
+        if (const auto error = perf.open(pid)) {
+            use_counters = false;
+            counter_error = error.value();
+        }
+    }
+    const auto start = std::chrono::steady_clock::now();
+    const bool started = write(go[1], "g", 1) == 1;
+    close(go[1]);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    const auto end = std::chrono::steady_clock::now();
+
+    result.ok = started && WIFEXITED(status) && WEXITSTATUS(status) != 127;
+    result.exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    result.wall_ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+    if (use_counters) {
+        result.counts = perf.read();
+    }
+    return result;
+}
+
+// writes <work>/<name>.asm and links <work>/<name>; empty on failure
+static std::optional<fs::path> build_kernel(const fs::path& source, const fs::path& work, const OptLevel level) {
+    std::ifstream in(source);
+    if (!in.is_open()) {
+        std::cerr << "cannot read " << source << std::endl;
+        return {};
+    }
+    std::stringstream contents;
+    contents << in.rdbuf();
+
+    Tokenizer tokenizer(contents.str());
+    Parser parser(tokenizer.tokenize());
+    auto prog = parser.parse_program();
+    if (!prog.has_value()) {
+        std::cerr << "parse error in " << source << std::endl;
+        return {};
+    }
+    StandardPasses standard_passes;
+    PassManager passes;
+    standard_passes.register_with(passes);
+    passes.run(prog.value(), level);
+
+    const CodegenOptions codegen = CodegenOptions::at(level);
+    Generator generator(prog.value());
+    generator.set_instruction_selection(codegen.instruction_selection);
+    generator.set_block_layout(codegen.block_layout);
+    generator.set_inlining(codegen.inlining);
+    const std::string assembly = generator.gen_prog();
+
+    const fs::path base = work / source.stem();
+    const fs::path asm_path = fs::path(base).replace_extension(".asm");
+    const fs::path obj_path = fs::path(base).replace_extension(".o");
+    std::ofstream(asm_path) << assembly;
+    const std::string assemble = "nasm -felf64 -o '" + obj_path.string() + "' '" + asm_path.string() + "'";
+    const std::string link = "ld -o '" + base.string() + "' '" + obj_path.string() + "'";
+    if (system(assemble.c_str()) != 0 || system(link.c_str()) != 0) {
+        std::cerr << "failed to assemble or link " << source << std::endl;
+        return {};
+    }
+    return base;
+}
+
+// Bytes of machine code in the executable, the sum of its executable
+// segments. Unlike the counters it needs no PMU and does not vary between
+// runs, so it gates on every machine.
+static std::optional<double> code_bytes(const fs::path& exe) {
+    std::ifstream in(exe, std::ios::binary);
+    Elf64_Ehdr header {};
+    if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)) || std::memcmp(header.e_ident, ELFMAG, SELFMAG) != 0
+            || header.e_ident[EI_CLASS] != ELFCLASS64 || header.e_phentsize != sizeof(Elf64_Phdr)) {
+        return {};
+    }
+    uint64_t bytes = 0;
+    for (size_t i = 0; i < header.e_phnum; i++) {
+        Elf64_Phdr segment {};
+        in.seekg(static_cast<std::streamoff>(header.e_phoff + i * sizeof(segment)));
+        if (!in.read(reinterpret_cast<char*>(&segment), sizeof(segment))) {
+            return {};
+        }
+        if (segment.p_type == PT_LOAD && (segment.p_flags & PF_X) != 0) {
+            bytes += segment.p_filesz;
+        }
+    }
+    return static_cast<double>(bytes);
+}
+
+static double median(std::vector<double> values) {
+    std::sort(values.begin(), values.end());
+    const size_t n = values.size();
+    return n % 2 == 1 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+}
+
+// Baseline format, one object per kernel with one number per metric:
+//   { "fib": { "cycles": 123, "instructions": 456 }, ... }
+// Only this shape is read, so the parser is a small recursive descent.
+class BaselineReader {
+public:
+    explicit BaselineReader(std::string text) : m_text(std::move(text)) {}
+
+    std::optional<std::map<std::string, Metrics>> parse() {
+        std::map<std::string, Metrics> out;
+        if (!accept('{')) {
+            return {};
+        }
+        if (peek() == '}') {
+            m_pos++;
+            return out;
+        }
+        do {
+            const auto kernel = string();
+            if (!kernel.has_value() || !accept(':') || !accept('{')) {
+                return {};
+            }
+            Metrics& metrics = out[kernel.value()];
+            if (peek() != '}') {
+                do {
+                    const auto name = string();
+                    if (!name.has_value() || !accept(':')) {
+                        return {};
+                    }
+                    const auto value = number();
+                    if (!value.has_value()) {
+                        return {};
+                    }
+                    metrics[name.value()] = value.value();
+                } while (accept(','));
+            }
+            if (!accept('}')) {
+                return {};
+            }
+        } while (accept(','));
+        if (!accept('}')) {
+            return {};
+        }
+        return out;
+    }
+
+private:
+    char peek() {
+        while (m_pos < m_text.size() && std::isspace(static_cast<unsigned char>(m_text[m_pos]))) {
+            m_pos++;
+        }
+        return m_pos < m_text.size() ? m_text[m_pos] : '\0';
+    }
+
+    bool accept(const char c) {
+        if (peek() == c) {
+            m_pos++;
+            return true;
+        }
+        return false;
+    }
+
+    std::optional<std::string> string() {
+        if (!accept('"')) {
+            return {};
+        }
+        const size_t end = m_text.find('"', m_pos);
+        if (end == std::string::npos) {
+            return {};
+        }
+        std::string out = m_text.substr(m_pos, end - m_pos);
+        m_pos = end + 1;
+        return out;
+    }
+
+    std::optional<double> number() {
+        peek();
+        const char* begin = m_text.c_str() + m_pos;
+        char* end = nullptr;
+        const double value = std::strtod(begin, &end);
+        if (end == begin) {
+            return {};
+        }
+        m_pos += static_cast<size_t>(end - begin);
+        return value;
+    }
+
+    std::string m_text;
+    size_t m_pos = 0;
+};
+
+static void write_baseline(const fs::path& path, const std::map<std::string, Metrics>& results) {
+    std::ofstream out(path);
+    out << "{\n";
+    size_t k = 0;
+    for (const auto& [kernel, metrics] : results) {
+        out << "  \"" << kernel << "\": {";
+        size_t m = 0;
+        for (const auto& [name, value] : metrics) {
+            out << (m++ == 0 ? " " : ", ") << '"' << name << "\": " << std::fixed << std::setprecision(0) << value;
+        }
+        out << " }" << (++k < results.size() ? "," : "") << "\n";
+    }
+    out << "}\n";
+}
+
+// the whole of `text` as a number, nothing when anything is left over
+template <typename T>
+static std::optional<T> parse_number(const std::string& text) {
+    T value{};
+    const auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+    if (ec != std::errc() || end != text.data() + text.size()) {
+        return {};
+    }
+    return value;
+}
+
+static std::optional<Options> parse_options(const int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (const auto level = opt_level_from(arg)) {
+            options.level = level.value();
+        }else if (arg.starts_with("--runs=")) {
+            const auto runs = parse_number<int>(arg.substr(7));
+            if (!runs.has_value() || runs.value() < 1) {
+                return {};
+            }
+            options.runs = runs.value();
+        }else if (arg.starts_with("--baseline=")) {
+            options.baseline = arg.substr(11);
+        }else if (arg.starts_with("--threshold=")) {
+            const auto threshold = parse_number<double>(arg.substr(12));
+            if (!threshold.has_value()) {
+                return {};
+            }
+            options.threshold = threshold.value();
+        }else if (arg.starts_with("--wall-threshold=")) {
+            const auto threshold = parse_number<double>(arg.substr(17));
+            if (!threshold.has_value()) {
+                return {};
+            }
+            options.wall_threshold = threshold.value();
+        }else if (arg == "--write-baseline") {
+            options.write_baseline = true;
+        }else if (arg.starts_with("--")) {
+            return {};
+        }else {
+            options.kernels.emplace_back(arg);
+        }
+    }
+    if (options.kernels.empty()) {
+        for (const auto& entry : fs::directory_iterator(fs::path(HY_BENCH_DIR) / "kernels")) {
+            if (entry.path().extension() == ".hy") {
+                options.kernels.push_back(entry.path());
+            }
+        }
+        std::sort(options.kernels.begin(), options.kernels.end());
+    }
+    return options;
+}
+
+int main(int argc, char* argv[]) {
+    const auto options = parse_options(argc, argv);
+    if (!options.has_value()) {
+        std::cerr << "hy_runbench [-O0|-O1|-O2] [--runs=N] [--baseline=FILE] [--write-baseline] [--threshold=PCT] [--wall-threshold=PCT] [kernel.hy ...]" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    const fs::path work = fs::temp_directory_path() / ("hy_runbench." + std::to_string(getpid()));
+    fs::create_directories(work);
+
+    bool use_counters = true;
+    std::string counter_error;
+    std::map<std::string, Metrics> results;
+    bool failed = false;
+    for (const fs::path& kernel : options->kernels) {
+        const auto exe = build_kernel(kernel, work, options->level);
+        if (!exe.has_value()) {
+            failed = true;
+            continue;
+        }
+        std::vector<double> wall;
+        std::array<std::vector<double>, num_counters> samples;
+        std::optional<int> exit_code;
+        for (int r = 0; r < options->runs; r++) {
+            const RunResult run = run_once(exe.value(), use_counters, counter_error);
+            if (!run.ok || (exit_code.has_value() && exit_code != run.exit_code)) {
+                std::cerr << kernel.stem().string() << ": run failed or exit code changed between runs" << std::endl;
+                failed = true;
+                break;
+            }
+            exit_code = run.exit_code;
+            wall.push_back(run.wall_ns);
+            if (run.counts.has_value()) {
+                for (size_t i = 0; i < num_counters; i++) {
+                    samples[i].push_back(static_cast<double>(run.counts.value()[i]));
+                }
+            }
+        }
+        if (wall.empty()) {
+            continue;
+        }
+        Metrics& metrics = results[kernel.stem().string()];
+        metrics["wall_ns"] = median(wall);
+        if (const auto bytes = code_bytes(exe.value())) {
+            metrics["text_bytes"] = bytes.value();
+        }
+        for (size_t i = 0; i < num_counters; i++) {
+            if (samples[i].size() == wall.size()) {
+                metrics[counters[i].name] = median(samples[i]);
+            }
+        }
+    }
+    fs::remove_all(work);
+
+    if (!counter_error.empty()) {
+        std::cerr << "hardware counters unavailable (" << counter_error << "), reporting wall time only" << std::endl;
+    }
+
+    if (options->write_baseline) {
+        write_baseline(options->baseline, results);
+        std::cout << "baseline written to " << options->baseline.string() << std::endl;
+        return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    std::map<std::string, Metrics> baseline;
+    std::ifstream in(options->baseline);
+    if (!in.is_open()) {
+        std::cerr << "no baseline at " << options->baseline.string() << ", record one with --write-baseline" << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::stringstream text;
+    text << in.rdbuf();
+    if (auto parsed = BaselineReader(text.str()).parse()) {
+        baseline = std::move(parsed.value());
+    }else {
+        std::cerr << "malformed baseline " << options->baseline.string() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // only metrics the baseline has are gated, so a machine with counters still
+    // passes against a baseline recorded without them; wall time gets its own,
+    // looser threshold. Nothing compared at all fails, or the gate could never fire
+    size_t regressions = 0;
+    size_t missing = 0;
+    size_t compared = 0;
+    std::cout << std::left << std::setw(16) << "kernel" << std::setw(16) << "metric"
+              << std::right << std::setw(16) << "baseline" << std::setw(16) << "current" << std::setw(13) << "delta" << "\n";
+    for (const auto& [kernel, metrics] : results) {
+        for (const auto& [name, value] : metrics) {
+            std::cout << std::left << std::setw(16) << kernel << std::setw(16) << name << std::right << std::fixed << std::setprecision(0);
+            const auto b = baseline.find(kernel);
+            if (b == baseline.end() || !b->second.contains(name)) {
+                std::cout << std::setw(16) << "-" << std::setw(16) << value << std::setw(13) << "-" << "  not gated\n";
+                missing++;
+                continue;
+            }
+            if (b->second.at(name) == 0) {
+                compared++;
+                std::cout << std::setw(16) << 0 << std::setw(16) << value << std::setw(13) << "-" << "\n";
+                continue;
+            }
+            compared++;
+            const double base = b->second.at(name);
+            const double delta = (value - base) / base * 100;
+            const bool regressed = delta > (name == "wall_ns" ? options->wall_threshold : options->threshold);
+            regressions += regressed;
+            std::cout << std::setw(16) << base << std::setw(16) << value
+                      << std::setw(12) << std::showpos << std::setprecision(1) << delta << std::noshowpos << "%"
+                      << (regressed ? "  REGRESSION" : "") << "\n";
+        }
+    }
+    if (regressions > 0) {
+        std::cout << regressions << " metric(s) regressed by more than " << options->threshold
+                  << "% (wall time " << options->wall_threshold << "%)" << std::endl;
+    }
+    if (missing > 0) {
+        std::cerr << "warning: " << missing << " metric(s) have no baseline and were not gated, record them with --write-baseline on the reference machine" << std::endl;
+    }
+    if (compared == 0) {
+        std::cerr << "no metric has a baseline, nothing was gated" << std::endl;
+    }
+    return failed || regressions > 0 || compared == 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,431 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <string_view>
+
+// Hand written support code appended to every generated program. It only uses
+// rax, rcx, rdx, rsi, rdi and r8-r11, which the generator never keeps live
+// across a call, and it does not depend on the stack alignment.
+//
+//   hy_print  rdi = value   appends the decimal value and a newline to the buffer
+//   hy_print_u rdi = value  the same for a u64
+//   hy_flush                writes the buffer with as few `write` calls as possible
+//   hy_exit   rdi = status  flushes, then exits; never returns
+//   hy_alloc  rdi = qwords  returns rax = 16 byte aligned block of rdi * 8 bytes
+//   hy_reset                releases every block handed out so far
+//   hy_parallel_for         rdi = worker, rsi = ctx, rdx = lo, rcx = hi; runs
+//                           worker(ctx, begin, end) over chunks of [lo, hi) on
+//                           all CPUs and returns rax = the sum of the results
+//
+// Output is buffered in .bss and only flushed when the next value would not
+// fit or at exit, so printing a million values costs a few hundred syscalls.
+//
+// The heap is a region: chunks of at least 4 MiB come straight from mmap and
+// are chained through their header { next, size }, blocks are bumped out of
+// the current chunk, and hy_reset rewinds to the first chunk so the chain is
+// reused. The fast path is a bounds check and a pointer bump. Fresh chunks are
+// zero filled; after a reset the old contents are visible again.
+//
+// hy_parallel_for starts one thread per CPU with a raw clone on an mmap'd
+// stack (8 MiB plus a guard page, kept for the next loop) and takes part
+// itself. Threads claim chunks of about 1/8 of their share with `lock xadd` on
+// a counter that has a cache line to itself, add the worker's results up in a
+// register and store the total into their own cache line only once at the end.
+// The kernel clears a thread's tid word and wakes it through the futex when the
+// thread is gone (CLONE_CHILD_CLEARTID), which is the join. hy_parallel_for
+// saves the callee-saved registers it uses; the other routines are not thread
+// safe and must not run while a loop is in flight.
+//
+// The interpreter mirrors both, keep the sizes in sync with the asm below.
+inline constexpr size_t runtime_out_buf_size = 65536;
+inline constexpr size_t runtime_heap_chunk_size = 4 * 1024 * 1024;
+inline constexpr size_t runtime_heap_max_qwords_log2 = 40; // larger requests fail
+inline constexpr std::string_view runtime_oom_message = "alloc: out of memory\n";
+
+inline constexpr std::array<std::string_view, 10> runtime_functions {
+    "hy_print", "hy_print_u", "hy_flush", "hy_exit", "hy_alloc", "hy_reset", "hy_oom",
+    "hy_parallel_for", "hy_par_work", "hy_par_threads",
+};
+
+inline constexpr std::string_view runtime_text = R"(
+; ---- runtime ----
+hy_print:
+   mov rax, rdi
+   mov r8, rdi                  ; sign
+   test rax, rax
+   jns hy_print_digits
+   neg rax                      ; INT64_MIN stays 2^63 as an unsigned value
+   jmp hy_print_digits
+
+hy_print_u:
+   mov rax, rdi
+   xor r8d, r8d
+hy_print_digits:                ; rax = magnitude, r8 < 0 for a '-'
+   sub rsp, 32                  ; 20 digits, '-' and '\n' fit
+   lea rsi, [rsp + 31]
+   mov byte [rsi], 10
+   mov ecx, 10
+.print_digit:
+   xor edx, edx
+   div rcx
+   add dl, '0'
+   dec rsi
+   mov [rsi], dl
+   test rax, rax
+   jnz .print_digit
+   test r8, r8
+   jns .print_copy
+   dec rsi
+   mov byte [rsi], '-'
+.print_copy:
+   lea rdx, [rsp + 32]
+   sub rdx, rsi                 ; length
+   mov rax, [rel hy_out_len]
+   lea rcx, [rax + rdx]
+   cmp rcx, 65536
+   jbe .print_append
+   push rsi
+   push rdx
+   call hy_flush
+   pop rdx
+   pop rsi
+   xor eax, eax
+.print_append:
+   lea rdi, [rel hy_out_buf]
+   add rdi, rax
+   mov rcx, rdx
+   rep movsb
+   add rax, rdx
+   mov [rel hy_out_len], rax
+   add rsp, 32
+   ret
+
+hy_flush:
+   mov rdx, [rel hy_out_len]
+   lea rsi, [rel hy_out_buf]
+.flush_write:
+   test rdx, rdx
+   jz .flush_done
+   mov eax, 1                   ; write(1, rsi, rdx)
+   mov edi, 1
+   syscall
+   test rax, rax
+   jle .flush_done              ; the output is gone, drop the rest
+   add rsi, rax
+   sub rdx, rax
+   jmp .flush_write
+.flush_done:
+   mov qword [rel hy_out_len], 0
+   ret
+
+hy_exit:
+   push rdi
+   call hy_flush
+   pop rdi
+   mov eax, 231                 ; exit_group
+   syscall
+
+hy_alloc:
+   mov rax, rdi
+   shr rax, 40                  ; negative or absurd sizes
+   jnz hy_oom
+   lea rdi, [rdi * 8 + 15]
+   and rdi, -16
+   mov rax, [rel hy_heap_ptr]
+   mov rdx, [rel hy_heap_end]
+   sub rdx, rax
+   cmp rdi, rdx
+   ja .alloc_slow
+   add rdi, rax
+   mov [rel hy_heap_ptr], rdi
+   ret
+.alloc_slow:                    ; rdi = bytes; try the chunks after the current one
+   mov rcx, [rel hy_heap_cur]
+   test rcx, rcx
+   jz .alloc_map
+.alloc_next:
+   mov rdx, [rcx]
+   test rdx, rdx
+   jz .alloc_map                ; rcx is the last chunk
+   mov rcx, rdx
+   mov r8, [rcx + 8]
+   sub r8, 16
+   cmp rdi, r8
+   ja .alloc_next               ; too small, it waits for the next reset
+   jmp .alloc_use
+.alloc_map:                     ; mmap(0, max(4 MiB, rdi + 16), RW, PRIVATE | ANONYMOUS, -1, 0)
+   push rcx
+   push rdi
+   lea rsi, [rdi + 16]
+   mov eax, 4194304
+   cmp rsi, rax
+   cmovb rsi, rax
+   push rsi
+   mov eax, 9
+   xor edi, edi
+   mov edx, 3
+   mov r10d, 0x22
+   mov r8, -1
+   xor r9d, r9d
+   syscall
+   pop rsi
+   pop rdi
+   pop rcx
+   cmp rax, -4096
+   jae hy_oom
+   mov qword [rax], 0
+   mov [rax + 8], rsi
+   test rcx, rcx
+   jz .alloc_first
+   mov [rcx], rax
+   jmp .alloc_link
+.alloc_first:
+   mov [rel hy_heap_first], rax
+.alloc_link:
+   mov rcx, rax
+.alloc_use:                     ; rcx = chunk to bump from
+   mov [rel hy_heap_cur], rcx
+   lea rax, [rcx + 16]
+   mov rdx, [rcx + 8]
+   add rdx, rcx
+   mov [rel hy_heap_end], rdx
+   add rdi, rax
+   mov [rel hy_heap_ptr], rdi
+   ret
+
+hy_reset:
+   mov rcx, [rel hy_heap_first]
+   test rcx, rcx
+   jz .reset_done
+   mov [rel hy_heap_cur], rcx
+   lea rax, [rcx + 16]
+   mov [rel hy_heap_ptr], rax
+   mov rdx, [rcx + 8]
+   add rdx, rcx
+   mov [rel hy_heap_end], rdx
+.reset_done:
+   ret
+
+hy_oom:
+   mov eax, 1                   ; write(2, msg, len)
+   mov edi, 2
+   lea rsi, [rel hy_oom_msg]
+   mov edx, 21
+   syscall
+   mov edi, 1
+   jmp hy_exit
+
+hy_parallel_for:
+   push rbp
+   mov rbp, rsp
+   push rbx
+   push r12
+   push r13
+   push r14
+   push r15
+   and rsp, -16
+   xor eax, eax
+   cmp rcx, rdx
+   jle .par_done                ; empty range
+   mov [rel hy_job_fn], rdi
+   mov [rel hy_job_ctx], rsi
+   mov [rel hy_job_lo], rdx
+   sub rcx, rdx                 ; iterations, unsigned
+   mov [rel hy_job_count], rcx
+   mov qword [rel hy_job_next], 0
+   call hy_par_threads
+   mov rcx, [rel hy_job_count]
+   cmp rax, rcx
+   cmova rax, rcx               ; no more threads than iterations
+   mov r15, rax                 ; threads taking part
+   lea rbx, [rax * 8]
+   mov rax, rcx
+   xor edx, edx
+   div rbx
+   test rax, rax
+   jnz .par_chunk
+   mov eax, 1
+.par_chunk:
+   mov [rel hy_job_chunk], rax
+   mov r14d, 1
+.par_spawn:                     ; r14 = next thread
+   cmp r14, r15
+   jae .par_run
+   lea rbx, [rel hy_par_stacks]
+   mov rax, [rbx + r14 * 8]
+   test rax, rax
+   jnz .par_clone
+   mov eax, 9                   ; mmap(0, 4 KiB + 8 MiB, RW, PRIVATE | ANONYMOUS | NORESERVE | STACK, -1, 0)
+   xor edi, edi
+   mov esi, 8392704
+   mov edx, 3
+   mov r10d, 0x24022
+   mov r8, -1
+   xor r9d, r9d
+   syscall
+   cmp rax, -4096
+   jae .par_short
+   mov r12, rax
+   mov rdi, rax                 ; mprotect(stack, 4096, PROT_NONE), the guard page
+   mov esi, 4096
+   xor edx, edx
+   mov eax, 10
+   syscall
+   mov rax, r12
+   mov [rbx + r14 * 8], rax
+.par_clone:
+   lea rsi, [rax + 8392704]     ; top of the stack
+   mov r12, r14
+   shl r12, 6
+   lea rax, [rel hy_par_partials]
+   add r12, rax                 ; the thread's result slot, inherited by the child
+   lea rdx, [rel hy_par_tids]
+   lea rdx, [rdx + r14 * 8]
+   mov r10, rdx
+   xor r8d, r8d
+   mov edi, 0x350f00            ; VM | FS | FILES | SIGHAND | THREAD | SYSVSEM | PARENT_SETTID | CHILD_CLEARTID
+   mov eax, 56                  ; clone(flags, stack, &tid, &tid, 0)
+   syscall
+   test rax, rax
+   jz .par_child
+   js .par_short
+   inc r14
+   jmp .par_spawn
+.par_child:
+   mov rdi, r12
+   call hy_par_work
+   mov eax, 60                  ; exit this thread only
+   xor edi, edi
+   syscall
+.par_short:                     ; out of stacks or threads, go on with the ones running
+   mov r15, r14
+.par_run:
+   lea rdi, [rel hy_par_partials]
+   call hy_par_work             ; this thread is worker 0
+   lea rbx, [rel hy_par_tids]
+   mov r14d, 1
+.par_join:
+   cmp r14, r15
+   jae .par_sum
+.par_wait:
+   mov edx, [rbx + r14 * 8]
+   test edx, edx
+   jz .par_joined
+   lea rdi, [rbx + r14 * 8]     ; futex(&tid, FUTEX_WAIT, tid, 0)
+   xor esi, esi
+   xor r10d, r10d
+   mov eax, 202
+   syscall
+   jmp .par_wait
+.par_joined:
+   inc r14
+   jmp .par_join
+.par_sum:
+   lea rbx, [rel hy_par_partials]
+   xor eax, eax
+   xor ecx, ecx
+.par_add:
+   add rax, [rbx]
+   add rbx, 64
+   inc rcx
+   cmp rcx, r15
+   jb .par_add
+.par_done:
+   lea rsp, [rbp - 40]
+   pop r15
+   pop r14
+   pop r13
+   pop r12
+   pop rbx
+   pop rbp
+   ret
+
+hy_par_work:                    ; rdi = result slot; runs chunks until none are left
+   push rbx
+   push r12
+   push r13
+   mov r12, rdi
+   xor r13d, r13d
+.work_next:
+   mov rsi, [rel hy_job_chunk]
+   mov rbx, rsi
+   lock xadd [rel hy_job_next], rsi
+   mov rax, [rel hy_job_count]
+   cmp rsi, rax
+   jae .work_done
+   add rbx, rsi
+   cmp rbx, rax
+   cmova rbx, rax               ; chunk = [rsi, rbx) as offsets from lo
+   mov rdx, [rel hy_job_lo]
+   add rsi, rdx
+   add rdx, rbx
+   mov rdi, [rel hy_job_ctx]
+   call qword [rel hy_job_fn]
+   add r13, rax
+   jmp .work_next
+.work_done:
+   mov [r12], r13
+   pop r13
+   pop r12
+   pop rbx
+   ret
+
+hy_par_threads:                 ; rax = CPUs the process may run on, 1 to 64
+   mov rax, [rel hy_par_nthreads]
+   test rax, rax
+   jnz .threads_done
+   sub rsp, 128
+   mov eax, 204                 ; sched_getaffinity(0, 128, rsp)
+   xor edi, edi
+   mov esi, 128
+   mov rdx, rsp
+   syscall
+   xor ecx, ecx
+   xor edx, edx
+.threads_count:
+   cmp rdx, rax                 ; rax = bytes of mask, negative on error
+   jge .threads_counted
+   popcnt r8, qword [rsp + rdx]
+   add rcx, r8
+   add rdx, 8
+   jmp .threads_count
+.threads_counted:
+   add rsp, 128
+   mov eax, 64
+   cmp rcx, rax
+   cmova rcx, rax
+   mov eax, 1
+   test rcx, rcx
+   cmovz rcx, rax
+   mov [rel hy_par_nthreads], rcx
+   mov rax, rcx
+.threads_done:
+   ret
+)";
+
+inline constexpr std::string_view runtime_rodata = R"(
+hy_oom_msg: db "alloc: out of memory", 10
+)";
+
+inline constexpr std::string_view runtime_bss = R"(
+section .bss
+alignb 16
+hy_out_buf: resb 65536
+hy_out_len: resq 1
+hy_heap_ptr: resq 1             ; next free byte of the current chunk
+hy_heap_end: resq 1
+hy_heap_cur: resq 1             ; current chunk, 0 before the first alloc
+hy_heap_first: resq 1
+hy_par_stacks: resq 64          ; per thread, 0 until it first runs
+hy_par_tids: resq 64            ; the low dword is the tid while the thread lives
+hy_par_nthreads: resq 1         ; 0 until the first loop
+hy_job_fn: resq 1
+hy_job_ctx: resq 1
+hy_job_lo: resq 1
+hy_job_count: resq 1
+hy_job_chunk: resq 1
+alignb 64
+hy_job_next: resq 8             ; next iteration offset, alone on its cache line
+hy_par_partials: resb 4096      ; one cache line per thread
+)";
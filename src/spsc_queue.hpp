@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <new>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Bounded lock-free ring for exactly one producer thread and one consumer
+// thread. Head and tail live on their own cache lines, and each side keeps a
+// cached copy of the other side's index so the shared line is only touched when
+// the ring looks full (producer) or empty (consumer).
+template <typename T> class SpscQueue {
+public:
+    explicit SpscQueue(const size_t capacity)
+        : m_slots(std::bit_ceil(std::max<size_t>(capacity, 2)))
+        , m_mask(m_slots.size() - 1)
+    {
+    }
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    // producer side
+    [[nodiscard]] bool try_push(T& value) {
+        const size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head_cache == m_slots.size()) {
+            m_head_cache = m_head.load(std::memory_order_acquire);
+            if (tail - m_head_cache == m_slots.size()) {
+                return false;
+            }
+        }
+        m_slots[tail & m_mask] = std::move(value);
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    void push(T value) {
+        while (!try_push(value)) {
+            std::this_thread::yield();
+        }
+    }
+
+    // no more pushes will follow
+    void close() {
+        m_closed.store(true, std::memory_order_release);
+    }
+
+    // consumer side
+    [[nodiscard]] bool try_pop(T& out) {
+        const size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail_cache) {
+            m_tail_cache = m_tail.load(std::memory_order_acquire);
+            if (head == m_tail_cache) {
+                return false;
+            }
+        }
+        out = std::move(m_slots[head & m_mask]);
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // blocks until a value arrives; false once the queue is closed and drained
+    [[nodiscard]] bool pop(T& out) {
+        while (!try_pop(out)) {
+            if (m_closed.load(std::memory_order_acquire)) {
+                return try_pop(out); // pushes made before close() are visible now
+            }
+            std::this_thread::yield();
+        }
+        return true;
+    }
+
+private:
+    static constexpr size_t cache_line = 64;
+
+    std::vector<T> m_slots;
+    const size_t m_mask;
+    alignas(cache_line) std::atomic<size_t> m_tail { 0 };
+    size_t m_head_cache = 0; // producer's view of m_head
+    alignas(cache_line) std::atomic<size_t> m_head { 0 };
+    size_t m_tail_cache = 0; // consumer's view of m_tail
+    alignas(cache_line) std::atomic<bool> m_closed { false };
+};
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <istream>
+#include <iterator>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "lexer.hpp"
+#include "parallel_lexer.hpp"
+#include "parser.hpp"
+#include "generation.hpp"
+#include "pass_manager.hpp"
+
+// Lexes an input stream a chunk at a time. A chunk ends at the first newline
+// past the middle of the unlexed bytes that is outside a block comment, so
+// each one starts in a clean lexer state and the rest carried over never
+// exceeds one read; only those bytes and one chunk of tokens are held.
+class StreamTokenizer {
+public:
+    static constexpr size_t read_size = 64 * 1024;
+
+    explicit StreamTokenizer(std::istream& in) : m_in(in) {}
+
+    // Appends the tokens of the next chunk, the last one ends with EOF.
+    // Returns false once that has been handed out.
+    bool next(std::vector<Token>& tokens) {
+        if (m_done) {
+            return false;
+        }
+        while (true) {
+            if (!m_eof) {
+                read();
+            }
+            const std::vector<size_t> splits = ParallelTokenizer::find_split_points(m_buf, 2);
+            if (!m_eof && splits.size() < 3) {
+                continue; // a line or block comment longer than what has been read
+            }
+            const size_t cut = m_eof ? m_buf.size() : splits[1];
+            Tokenizer tokenizer(std::string_view(m_buf).substr(0, cut), m_line);
+            std::vector<Token> chunk = tokenizer.tokenize();
+            if (!m_eof) {
+                chunk.pop_back(); // per-chunk EOF
+            }
+            tokens.insert(tokens.end(), std::make_move_iterator(chunk.begin()), std::make_move_iterator(chunk.end()));
+            m_line = tokenizer.line();
+            m_buf.erase(0, cut);
+            m_done = m_eof;
+            return true;
+        }
+    }
+
+private:
+    void read() {
+        const size_t size = m_buf.size();
+        m_buf.resize(size + read_size);
+        m_in.read(m_buf.data() + size, static_cast<std::streamsize>(read_size));
+        m_buf.resize(size + static_cast<size_t>(m_in.gcount()));
+        m_eof = !m_in;
+    }
+
+    std::istream& m_in;
+    std::string m_buf{};  // the bytes not lexed yet
+    int m_line = 1;       // of the first of them
+    bool m_eof = false;
+    bool m_done = false;
+};
+
+// Compiles a source of any size in bounded memory. The input is lexed a chunk
+// at a time; every top-level statement is parsed, written to the output as
+// assembly and then released from the parser's arena. What stays is one chunk
+// of tokens, one statement's AST, the symbol tables and the names each
+// function calls, however long the input.
+// Like --pipeline it sees no whole program, so there are no AST passes and no
+// inlining.
+class StreamingCompiler {
+public:
+    StreamingCompiler(std::istream& in, std::ostream& out) : m_in(in), m_out(out) {}
+
+    // see Generator::set_debug_info
+    void set_debug_info(std::string source_path, std::string asm_name) {
+        m_debug_source = std::move(source_path);
+        m_debug_asm = std::move(asm_name);
+    }
+
+    void set_codegen_options(const CodegenOptions& options) {
+        m_codegen = options;
+    }
+
+    void compile() {
+        StreamTokenizer tokenizer(m_in);
+        Parser parser([&](std::vector<Token>& tokens) {
+            return tokenizer.next(tokens);
+        });
+        Generator generator(NodeProg{});
+        generator.set_inlining(false);
+        generator.set_instruction_selection(m_codegen.instruction_selection);
+        if (!m_debug_source.empty()) {
+            generator.set_debug_info(m_debug_source, m_debug_asm);
+        }
+        generator.begin_stream(m_out);
+        while (true) {
+            const ArenaAllocator::Mark mark = parser.ast_mark();
+            const auto stmt = parser.parse_next();
+            if (!stmt.has_value()) {
+                break;
+            }
+            generator.gen_top_level(stmt.value());
+            parser.release_ast(mark);
+        }
+        generator.end_stream();
+    }
+
+private:
+    std::istream& m_in;
+    std::ostream& m_out;
+    std::string m_debug_source{};
+    std::string m_debug_asm{};
+    CodegenOptions m_codegen{};
+};
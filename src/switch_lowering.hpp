@@ -0,0 +1,48 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "parser.hpp"
+
+// Knobs for lowering a switch. A jump table costs a bounds check and one
+// indirect jump whatever the case count, but one 8 byte entry per value in
+// [min, max]; a balanced compare tree costs about log2(cases) compares and
+// branches and no data.
+struct SwitchHeuristic {
+    size_t min_table_cases = 4;        // a few compares are as cheap as the table jump
+    uint64_t max_table_entries = 4096;
+    uint64_t min_density_percent = 40; // cases per table entry
+};
+
+struct SwitchPlan {
+    std::vector<const NodeSwitchCase*> cases{}; // sorted by value
+    bool table = false;
+    int64_t min = 0;
+    uint64_t entries = 0;                       // max - min + 1 for a table
+};
+
+// Shared by the native generator and the bytecode compiler so that both
+// backends dispatch the same way.
+inline SwitchPlan plan_switch(const NodeStmtSwitch* stmt, const SwitchHeuristic& heuristic = {}) {
+    SwitchPlan plan;
+    for (const NodeSwitchCase& c : stmt->cases) {
+        plan.cases.push_back(&c);
+    }
+    std::ranges::sort(plan.cases, {}, &NodeSwitchCase::value);
+    if (plan.cases.size() < heuristic.min_table_cases) {
+        return plan;
+    }
+    const int64_t min = plan.cases.front()->value;
+    const uint64_t span = static_cast<uint64_t>(plan.cases.back()->value) - static_cast<uint64_t>(min);
+    if (span >= heuristic.max_table_entries) {
+        return plan;
+    }
+    const uint64_t entries = span + 1;
+    if (plan.cases.size() * 100 >= entries * heuristic.min_density_percent) {
+        plan.table = true;
+        plan.min = min;
+        plan.entries = entries;
+    }
+    return plan;
+}
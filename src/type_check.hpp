@@ -0,0 +1,304 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <ranges>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#include "parser.hpp"
+
+// Gives every expression its IntType (NodeExpr::type). A literal is an i64,
+// or a u64 when it is larger than INT64_MAX; arithmetic is done in the
+// common_type of its operands, `==` yields an i64, a call has the return type
+// of its callee and alloc() and ident[...] are i64. Storing a value into a
+// narrower variable, parameter or return value keeps its low bytes, only a bare
+// literal that would change its value on the way is rejected.
+class TypeChecker {
+public:
+    // the whole program, so functions may be called before their definition
+    void check_program(const NodeProg& prog) {
+        for (const NodeStmt* stmt : prog.stmts) {
+            if (const auto func = std::get_if<NodeStmtFunc*>(&stmt->var)) {
+                declare(*func);
+            }
+        }
+        for (const NodeStmt* stmt : prog.stmts) {
+            this->stmt(stmt);
+        }
+    }
+
+    // Streamed input, one top-level statement at a time. A call to a function
+    // that has not been seen yet is taken to return an i64, finish() checks
+    // that guess once everything is in.
+    void check_top_level(const NodeStmt* stmt) {
+        if (const auto func = std::get_if<NodeStmtFunc*>(&stmt->var)) {
+            declare(*func);
+        }
+        this->stmt(stmt);
+    }
+
+    void finish() const {
+        for (const auto& [name, call] : m_forward_calls) {
+            const auto it = m_funcs.find(name);
+            if (it != m_funcs.end() && it->second.ret != IntType::I64) {
+                std::cerr << "Function " << name << " returns " << int_type_name(it->second.ret)
+                          << " and must be defined before its call on line " << call.line << std::endl;
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    static uint64_t literal_value(const Token& int_lit) {
+        const std::string& text = int_lit.value.value();
+        uint64_t value = 0;
+        const auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+        if (ec != std::errc {} || end != text.data() + text.size()) {
+            std::cerr << "Integer literal out of range: " << text << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        return value;
+    }
+
+    // keeps the types stored_as() reports, off by default since the map grows
+    // with the program
+    void record_stored() {
+        m_record_stored = true;
+    }
+
+    // the type `expr` is stored as when it is a declaration's initializer, an
+    // assigned, returned or argument value
+    std::optional<IntType> stored_as(const NodeExpr* expr) const {
+        const auto it = m_stored.find(expr);
+        return it != m_stored.end() ? std::optional(it->second) : std::nullopt;
+    }
+
+private:
+    // a copy, streamed statements are released once they are emitted
+    struct Signature {
+        IntType ret;
+        std::vector<IntType> params;
+    };
+
+    void declare(const NodeStmtFunc* func) {
+        m_funcs.try_emplace(func->ident.value.value(), Signature { .ret = func->ret, .params = func->param_types });
+    }
+
+    struct Var {
+        std::string name;
+        IntType type;
+    };
+
+    IntType lookup(const Token& ident) const {
+        const auto it = std::ranges::find_if(m_vars | std::views::reverse, [&](const Var& var) {
+            return var.name == ident.value;
+        });
+        if (it == m_vars.rend()) {
+            std::cerr << "Undeclared identifier: " << ident.value.value() << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        return it->type;
+    }
+
+    // `expr` is about to be stored as a `to`
+    void convert(const NodeExpr* expr, const IntType to) {
+        if (m_record_stored) {
+            m_stored.insert_or_assign(expr, to);
+        }
+        while (const auto term = std::get_if<NodeTerm*>(&expr->var)) {
+            if (const auto paren = std::get_if<NodeTermParen*>(&(*term)->var)) {
+                expr = (*paren)->expr;
+                continue;
+            }
+            if (const auto lit = std::get_if<NodeTermInt*>(&(*term)->var)) {
+                const Token& tok = (*lit)->int_lit;
+                if (!literal_fits(literal_value(tok), to)) {
+                    std::cerr << "Integer literal " << tok.value.value() << " does not fit in "
+                              << int_type_name(to) << " on line " << tok.line << std::endl;
+                    exit(EXIT_FAILURE);
+                }
+            }
+            break;
+        }
+    }
+
+    // the argument has its type, convert it to the parameter's
+    void call_arg(const NodeTermCall* call, const size_t i) {
+        const auto it = m_funcs.find(call->ident.value.value());
+        if (it != m_funcs.end() && it->second.params.size() == call->args.size()) {
+            convert(call->args[i], it->second.params[i]);
+        }
+    }
+
+    // the arguments have their types
+    IntType call_type(const NodeTermCall* call) {
+        const auto it = m_funcs.find(call->ident.value.value());
+        if (it == m_funcs.end()) {
+            m_forward_calls.try_emplace(call->ident.value.value(), call->ident);
+            return IntType::I64;
+        }
+        return it->second.ret;
+    }
+
+    IntType call(const NodeTermCall* call) {
+        for (size_t i = 0; i < call->args.size(); i++) {
+            expr(call->args[i]);
+            call_arg(call, i);
+        }
+        return call_type(call);
+    }
+
+    // the children have their types
+    IntType term(const NodeTerm* term) {
+        struct TermVisitor {
+            TypeChecker& check;
+            IntType operator()(const NodeTermInt* term_int) const {
+                return literal_value(term_int->int_lit) > INT64_MAX ? IntType::U64 : IntType::I64;
+            }
+            IntType operator()(const NodeTermIdent* term_ident) const {
+                return check.lookup(term_ident->ident);
+            }
+            IntType operator()(const NodeTermParen* term_paren) const {
+                return term_paren->expr->type;
+            }
+            IntType operator()(const NodeTermCall* term_call) const {
+                return check.call_type(term_call);
+            }
+            IntType operator()(const NodeTermAlloc*) const {
+                return IntType::I64;
+            }
+            IntType operator()(const NodeTermIndex*) const {
+                return IntType::I64;
+            }
+        };
+        return std::visit(TermVisitor { .check = *this }, term->var);
+    }
+
+    // bottom up, every node once its children are typed
+    IntType expr(NodeExpr* root) {
+        walk_expr(root, [&](NodeExpr* expr, const size_t done, const size_t count) {
+            if (const auto term = std::get_if<NodeTerm*>(&expr->var)) {
+                if (const auto call = std::get_if<NodeTermCall*>(&(*term)->var); call != nullptr && done > 0) {
+                    call_arg(*call, done - 1);
+                }else if (const auto index = std::get_if<NodeTermIndex*>(&(*term)->var); index != nullptr && done == 0) {
+                    lookup((*index)->ident);
+                }
+                if (done == count) {
+                    expr->type = this->term(*term);
+                }
+                return;
+            }
+            if (done < count) {
+                return;
+            }
+            expr->type = std::visit([](const auto* bin) {
+                if constexpr (std::is_same_v<decltype(bin), const NodeBinExprEqual*>) {
+                    return IntType::I64;
+                }else {
+                    return common_type(bin->lhs->type, bin->rhs->type);
+                }
+            }, std::get<NodeBinExpr*>(expr->var)->var);
+        });
+        return root->type;
+    }
+
+    void scope(const NodeScope* scope) {
+        const size_t vars = m_vars.size();
+        for (const NodeStmt* stmt : scope->stmts) {
+            this->stmt(stmt);
+        }
+        m_vars.resize(vars);
+    }
+
+    void if_pred(const NodeIfPred* pred) {
+        if (const auto elif = std::get_if<NodeIfPredElif*>(&pred->var)) {
+            expr((*elif)->expr);
+            scope((*elif)->scope);
+            if ((*elif)->pred.has_value()) {
+                if_pred((*elif)->pred.value());
+            }
+            return;
+        }
+        scope(std::get<NodeIfPredElse*>(pred->var)->scope);
+    }
+
+    void stmt(const NodeStmt* stmt) {
+        struct StmtVisitor {
+            TypeChecker& check;
+            void operator()(const NodeStmtInt* stmt_int) const {
+                if (stmt_int->expr != nullptr) {
+                    check.expr(stmt_int->expr);
+                    check.convert(stmt_int->expr, stmt_int->type);
+                }
+                check.m_vars.push_back({ .name = stmt_int->ident.value.value(), .type = stmt_int->type });
+            }
+            void operator()(const NodeScope* scope) const { check.scope(scope); }
+            void operator()(const NodeStmtIf* stmt_if) const {
+                check.expr(stmt_if->expr);
+                check.scope(stmt_if->scope);
+                if (stmt_if->pred.has_value()) {
+                    check.if_pred(stmt_if->pred.value());
+                }
+            }
+            void operator()(const NodeStmtAssign* stmt_assign) const {
+                const IntType type = check.lookup(stmt_assign->ident);
+                check.expr(stmt_assign->expr);
+                check.convert(stmt_assign->expr, type);
+            }
+            void operator()(const NodeStmtReturn* stmt_return) const {
+                check.expr(stmt_return->expr);
+                if (check.m_ret.has_value()) {
+                    check.convert(stmt_return->expr, check.m_ret.value());
+                }
+            }
+            void operator()(const NodeStmtCall* stmt_call) const { check.call(stmt_call->call); }
+            // a body sees its parameters only
+            void operator()(const NodeStmtFunc* func) const {
+                std::vector<Var> outer = std::move(check.m_vars);
+                check.m_vars.clear();
+                for (size_t i = 0; i < func->params.size(); i++) {
+                    check.m_vars.push_back({ .name = func->params[i].value.value(), .type = func->param_types[i] });
+                }
+                check.m_ret = func->ret;
+                check.scope(func->body);
+                check.m_ret.reset();
+                check.m_vars = std::move(outer);
+            }
+            void operator()(const NodeStmtSwitch* stmt_switch) const {
+                check.expr(stmt_switch->expr);
+                for (const NodeSwitchCase& c : stmt_switch->cases) {
+                    check.scope(c.scope);
+                }
+                if (stmt_switch->default_scope != nullptr) {
+                    check.scope(stmt_switch->default_scope);
+                }
+            }
+            void operator()(const NodeStmtPrint* stmt_print) const { check.expr(stmt_print->expr); }
+            void operator()(const NodeStmtStore* stmt_store) const {
+                check.lookup(stmt_store->ident);
+                check.expr(stmt_store->index);
+                check.expr(stmt_store->expr);
+            }
+            void operator()(const NodeStmtReset*) const {}
+            void operator()(const NodeStmtParallelFor* loop) const {
+                check.expr(loop->lo);
+                check.expr(loop->hi);
+                check.m_vars.push_back({ .name = loop->ident.value.value(), .type = IntType::I64 });
+                check.scope(loop->body);
+                check.m_vars.pop_back();
+            }
+        };
+        std::visit(StmtVisitor { .check = *this }, stmt->var);
+    }
+
+    std::unordered_map<std::string, Signature> m_funcs{};
+    std::map<std::string, Token> m_forward_calls{}; // the first call of each, by name
+    std::vector<Var> m_vars{};            // visible variables, innermost last
+    std::optional<IntType> m_ret{};       // inside a function body
+    bool m_record_stored = false;
+    std::unordered_map<const NodeExpr*, IntType> m_stored{};
+};
@@ -0,0 +1,174 @@
+// Checks the AST cache. Every program in the directories given is parsed,
+// stored and loaded back, and the loaded AST has to print the same as a fresh
+// parse. Then one entry is damaged: cut short at every length, written by
+// another format version, keyed to a different source, and given corrupt
+// headers, references and node kinds. Each of those has to read as a miss.
+// Random single-byte corruption has to load or miss, never crash.
+//
+//   ast_cache_test dir...
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "lexer.hpp"
+#include "ast_cache.hpp"
+#include "ast_printer.hpp"
+
+namespace fs = std::filesystem;
+using Format = AstCacheFormat;
+
+static std::string dump(const NodeProg& prog) {
+    std::stringstream out;
+    AstPrinter(out).program(prog);
+    return out.str();
+}
+
+// parses `src` and stores it in `cache`, the printed AST of the fresh parse
+static std::string store(const AstCache& cache, const std::string& src) {
+    Tokenizer tokenizer(src);
+    Parser parser(tokenizer.tokenize()); // owns the nodes
+    const NodeProg prog = parser.parse_program().value();
+    cache.store(prog);
+    return dump(prog);
+}
+
+static std::string read_file(const fs::path& path) {
+    std::ifstream in(path, std::ios::binary);
+    std::stringstream text;
+    text << in.rdbuf();
+    return text.str();
+}
+
+static void write_file(const fs::path& path, const std::string& bytes) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+}
+
+static bool round_trip(const fs::path& dir, const fs::path& source) {
+    const std::string src = read_file(source);
+    const AstCache cache(dir, src);
+    const std::string fresh = store(cache, src);
+    AstCacheLoader loader;
+    const std::optional<NodeProg> loaded = cache.load(loader);
+    if (!loaded.has_value()) {
+        std::cerr << source.string() << ": stored entry reads as a miss" << std::endl;
+        return false;
+    }
+    if (dump(loaded.value()) != fresh) {
+        std::cerr << source.string() << ": loaded AST differs from a fresh parse" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// the header and records of `bytes`, edited in place
+template <typename T> static T& at(std::string& bytes, const uint64_t offset) {
+    return *reinterpret_cast<T*>(bytes.data() + offset);
+}
+
+static bool check_damage(const fs::path& dir) {
+    const std::string src =
+        "int add(int a, u8 b) {\n    return (a + b * 2);\n}\n"
+        "int x = add(1, 2);\n"
+        "switch (x) { case 5: { x = (x - 1) / 2; } default: { print(x == 5); } }\n"
+        "if (x == 2) { print(x); } elif (x == 3) { x = 4; } else { x = 0; }\n"
+        "return (x);\n";
+    const AstCache cache(dir, src);
+    (void)store(cache, src);
+    const std::string good = read_file(cache.path());
+    Format::Header header {};
+    std::memcpy(&header, good.data(), sizeof(header));
+    bool ok = true;
+
+    // `damaged` written over the entry has to read as a miss
+    const auto miss = [&](const std::string& what, const std::string& damaged) {
+        write_file(cache.path(), damaged);
+        AstCacheLoader loader;
+        if (cache.load(loader).has_value()) {
+            std::cerr << what << ": damaged entry was loaded" << std::endl;
+            ok = false;
+        }
+    };
+    const auto edited = [&](const std::function<void(std::string&)>& edit) {
+        std::string bytes = good;
+        edit(bytes);
+        return bytes;
+    };
+
+    for (size_t size = 0; size < good.size(); size++) {
+        miss("cut to " + std::to_string(size) + " bytes", good.substr(0, size));
+    }
+    miss("bad magic", edited([](std::string& b) { b[0] = 'X'; }));
+    miss("older version", edited([](std::string& b) { at<Format::Header>(b, 0).version = Format::version - 1; }));
+    miss("newer version", edited([](std::string& b) { at<Format::Header>(b, 0).version = Format::version + 1; }));
+    miss("root list out of range", edited([&](std::string& b) { at<Format::Header>(b, 0).root_list = static_cast<uint32_t>(header.num_lists); }));
+    miss("too many nodes", edited([&](std::string& b) { at<Format::Header>(b, 0).num_nodes = header.num_nodes + 1000; }));
+    miss("misaligned nodes", edited([&](std::string& b) { at<Format::Header>(b, 0).nodes_offset = header.nodes_offset + 1; }));
+
+    // the last node is a root statement, the first one a leaf
+    const uint64_t last = header.nodes_offset + (header.num_nodes - 1) * sizeof(Format::Node);
+    miss("node referencing itself", edited([&](std::string& b) { at<Format::Node>(b, last).a = static_cast<uint32_t>(header.num_nodes - 1); }));
+    miss("node referencing a later one", edited([&](std::string& b) { at<Format::Node>(b, header.nodes_offset).kind = Format::Kind::ExprParen;
+                                                                       at<Format::Node>(b, header.nodes_offset).a = 1; }));
+    miss("unknown node kind", edited([&](std::string& b) { at<Format::Node>(b, header.nodes_offset).kind = static_cast<Format::Kind>(999); }));
+    miss("token out of range", edited([&](std::string& b) { at<Format::Node>(b, header.nodes_offset).a = static_cast<uint32_t>(header.num_tokens); }));
+    miss("string out of range", edited([&](std::string& b) { at<Format::Tok>(b, header.tokens_offset).str_len = static_cast<uint32_t>(header.strings_size + 1); }));
+
+    // a source of the same size but different text, and a longer one
+    std::string other = src;
+    other[other.find("1, 2")] = '3';
+    for (const std::string& stale : { other, src + "\n" }) {
+        const AstCache stale_cache(dir, stale);
+        write_file(stale_cache.path(), good);
+        AstCacheLoader loader;
+        if (stale_cache.load(loader).has_value()) {
+            std::cerr << "an entry for another source was loaded" << std::endl;
+            ok = false;
+        }
+    }
+
+    std::mt19937 rng(1);
+    for (int i = 0; i < 5000; i++) {
+        std::string bytes = good;
+        bytes[rng() % bytes.size()] = static_cast<char>(rng());
+        write_file(cache.path(), bytes);
+        AstCacheLoader loader;
+        (void)cache.load(loader);
+    }
+    return ok;
+}
+
+int main(int argc, char* argv[]) {
+    const fs::path dir = fs::temp_directory_path() / ("hy_ast_cache_test." + std::to_string(getpid()));
+    bool ok = true;
+    size_t programs = 0;
+    for (int i = 1; i < argc; i++) {
+        std::vector<fs::path> sources;
+        for (const auto& entry : fs::directory_iterator(argv[i])) {
+            if (entry.path().extension() == ".hy") {
+                sources.push_back(entry.path());
+            }
+        }
+        std::ranges::sort(sources);
+        for (const fs::path& source : sources) {
+            ok &= round_trip(dir, source);
+            programs++;
+        }
+    }
+    ok &= check_damage(dir);
+    fs::remove_all(dir);
+    if (ok) {
+        std::cout << "ast cache: ok, " << programs << " programs round-tripped" << std::endl;
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,83 @@
+// Checks which blocks BlockLayout aligns: the targets of CFG back edges (a
+// loop, a function that tail calls itself) and nothing else, in particular not
+// a join point that layout places before the blocks jumping to it.
+//
+//   block_layout_test
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include "block_layout.hpp"
+
+static bool aligned(const std::string& out, const std::string& label) {
+    return out.find("align 16\n" + label + ":\n") != std::string::npos;
+}
+
+static bool check(const std::string& what, const std::string& text, const std::string& label, const bool expect) {
+    const std::string out = BlockLayout(text, "").run();
+    if (aligned(out, label) == expect) {
+        return true;
+    }
+    std::cerr << what << ": " << label << (expect ? " is not aligned" : " is aligned") << "\n" << out << std::endl;
+    return false;
+}
+
+int main() {
+    // label_2 is a join: the fall-through from `mov rax, 2` keeps it in place,
+    // so the jump to it from label_1 ends up backwards
+    const std::string join =
+        "_start:\n"
+        "   cmp rax, 1\n"
+        "   je label_1\n"
+        "   mov rax, 2\n"
+        "label_2:\n"
+        "   mov rdi, rax\n"
+        "   ret\n"
+        "label_1:\n"
+        "   mov rax, 3\n"
+        "   jmp label_2\n";
+    // a switch: each case jumps forward to the end label, the default falls
+    // into it, and jump table cases are reached from `data` only
+    const std::string cases =
+        "_start:\n"
+        "   cmp rax, 40\n"
+        "   je label_1\n"
+        "   cmp rax, 2\n"
+        "   je label_3\n"
+        "   jmp label_4\n"
+        "label_1:\n"
+        "   mov rbx, 1\n"
+        "   jmp label_5\n"
+        "label_3:\n"
+        "   mov rbx, 2\n"
+        "   jmp label_5\n"
+        "label_4:\n"
+        "   mov rbx, 3\n"
+        "label_5:\n"
+        "   mov rdi, rbx\n"
+        "   ret\n";
+    const std::string loop =
+        "fn_count:\n"
+        "   mov rax, 0\n"
+        "label_3:\n"
+        "   add rax, 1\n"
+        "   cmp rax, 10\n"
+        "   jne label_3\n"
+        "   ret\n";
+    const std::string tail_call =
+        "fn_down:\n"
+        "   cmp rdi, 0\n"
+        "   je label_1\n"
+        "   sub rdi, 1\n"
+        "   jmp fn_down\n"
+        "label_1:\n"
+        "   ret\n";
+    const bool ok = check("join", join, "label_2", false)
+        && check("switch", cases, "label_5", false)
+        && check("loop", loop, "label_3", true)
+        && check("tail call", tail_call, "fn_down", true);
+    if (ok) {
+        std::cout << "block layout: ok" << std::endl;
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
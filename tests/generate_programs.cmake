@@ -0,0 +1,75 @@
+# Programs too large to check in, written into the build tree at configure
+# time and run like tests/programs/*.hy: expressions nested thousands of levels
+# deep and flat operator chains thousands of terms long. Sets
+# generated_program_tests to their paths.
+
+set(generated_dir ${CMAKE_BINARY_DIR}/generated_programs)
+
+# `count` copies of `term` joined by `op`
+function(chain out term op count)
+    math(EXPR rest "${count} - 1")
+    string(REPEAT "${term}${op}" ${rest} text)
+    set(${out} "${text}${term}" PARENT_SCOPE)
+endfunction()
+
+# `inner` wrapped in `count` pairs of `open` and `close`
+function(nest out open inner close count)
+    string(REPEAT "${open}" ${count} head)
+    string(REPEAT "${close}" ${count} tail)
+    set(${out} "${head}${inner}${tail}" PARENT_SCOPE)
+endfunction()
+
+nest(parens "(" "7" ")" 5000)
+nest(right_sum "1 + (" "1" ")" 2999)
+nest(calls "inc(" "0" ")" 2000)
+nest(subscripts "p[" "1" "]" 1000)
+nest(alternating "1 - (" "12" ")" 1500)
+nest(result "(" "42" ")" 5000)
+file(CONFIGURE OUTPUT ${generated_dir}/deep_nest.hy @ONLY CONTENT "// exit: 42
+// prints: 7 3000 2000 1 12
+int a = ${parens};
+print(a);
+int b = ${right_sum};
+print(b);
+int inc(int x) {
+    return (x + 1);
+}
+print(${calls});
+int p = alloc(2);
+p[0] = 0;
+p[1] = 1;
+print(${subscripts});
+int c = ${alternating};
+print(c);
+return ${result};
+")
+
+chain(literals "1" " + " 5000)
+chain(vars "one" " + " 5000)
+chain(mixed "one * 3 - one" " + " 1000)
+chain(params "x" " + " 2000)
+chain(compared "one" " + " 3000)
+chain(condition "one" " + " 2500)
+file(CONFIGURE OUTPUT ${generated_dir}/long_chain.hy @ONLY CONTENT "// exit: 7
+// prints: 5000 5000 2000 6000 1 5000
+int one = 1;
+int a = ${literals};
+print(a);
+int b = ${vars};
+print(b);
+int c = ${mixed};
+print(c);
+int triple(int x) {
+    return (${params});
+}
+print(triple(3));
+print(${compared} == 3000);
+int d = 0;
+if (${condition} == 2500) {
+    d = 5000;
+}
+print(d);
+return (a - b + 7);
+")
+
+set(generated_program_tests ${generated_dir}/deep_nest.hy ${generated_dir}/long_chain.hy)
@@ -0,0 +1,214 @@
+// Checks IncrementalCompiler against full parses. Random edits, some of which
+// break the source for a while, are applied one at a time; after each one the
+// incremental program has to print the same as a fresh parse of the edited
+// source, or, when that source does not parse, the edit has to report an error
+// and leave the program as it was. Then a source of 100k lines gets one-line
+// edits, whose median has to stay under a millisecond.
+//
+//   incremental_test [seed]
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "incremental.hpp"
+#include "ast_printer.hpp"
+
+static std::string dump(const NodeProg& prog) {
+    std::stringstream out;
+    AstPrinter(out).program(prog);
+    return out.str();
+}
+
+// the printed program, empty when the source does not lex or parse
+static std::optional<std::string> full_parse(const std::string& src) {
+    try {
+        Tokenizer tokenizer(src);
+        tokenizer.throw_errors();
+        Parser parser(tokenizer.tokenize());
+        parser.throw_errors();
+        return dump(parser.parse_program().value());
+    } catch (const SyntaxError&) {
+        return {};
+    }
+}
+
+// `lines` lines of functions with if/elif chains, then a switch and a
+// top-level if for edits to attach an elif to
+static std::string make_source(const int lines) {
+    std::string src = "// header\n";
+    for (int i = 0; i < lines / 4; i++) {
+        const std::string n = std::to_string(i);
+        src += "int f" + n + "(int a) {\n"
+               "    if (a == 1) { return (a + " + n + "); } elif (a == 2) { return (3); }\n"
+               "    return (a * 2);\n"
+               "}\n";
+    }
+    src += "int x = f1(1);\nswitch (x) { case 1: { x = 2; } default: { x = 3; } }\n"
+           "int y = 2;\nif (x == 1) { y = 3; }\n/* tail */\nreturn (y);\n";
+    return src;
+}
+
+// the edit that undoes `edit` on `before`
+static TextEdit inverse(const std::string& before, const TextEdit& edit) {
+    return { edit.begin, edit.begin + edit.text.size(), before.substr(edit.begin, edit.end - edit.begin) };
+}
+
+static std::optional<TextEdit> random_edit(const std::string& src, std::mt19937& rng) {
+    size_t pos = rng() % src.size();
+    const auto after = [&](const std::string& what) {
+        pos = src.find(what, pos);
+        return pos != std::string::npos;
+    };
+    switch (rng() % 10) {
+        case 0: // a digit, never the first one of a number
+            while (pos < src.size() && (!std::isdigit(static_cast<unsigned char>(src[pos])) || std::isalnum(static_cast<unsigned char>(src[pos - 1])))) {
+                pos++;
+            }
+            if (pos == src.size()) {
+                return {};
+            }
+            return TextEdit { pos, pos + 1, std::to_string(rng() % 10) };
+        case 1: // a statement after a `;`
+            if (!after(";")) {
+                return {};
+            }
+            return TextEdit { pos + 1, pos + 1, " print(7);" };
+        case 2: // a line comment
+            if (!after("\n")) {
+                return {};
+            }
+            return TextEdit { pos + 1, pos + 1, "// c\n" };
+        case 3: { // a block comment around two whole lines that balance
+            if (!after("\n")) {
+                return {};
+            }
+            size_t end = src.find('\n', pos + 1);
+            end = end == std::string::npos ? end : src.find('\n', end + 1);
+            if (end == std::string::npos) {
+                return {};
+            }
+            const std::string inner = src.substr(pos + 1, end - pos);
+            if (inner.find("/*") != std::string::npos || inner.find("*/") != std::string::npos
+                    || std::ranges::count(inner, '{') != std::ranges::count(inner, '}')) {
+                return {};
+            }
+            return TextEdit { pos + 1, end + 1, "/*" + inner + "*/\n" };
+        }
+        case 4: // an elif onto the top-level if
+            if (!after("y = 3; }")) {
+                return {};
+            }
+            return TextEdit { pos + 8, pos + 8, " elif (x == 2) { y = 4; }" };
+        case 5: // a line break for a space
+            if (!after(" ")) {
+                return {};
+            }
+            return TextEdit { pos, pos + 1, "\n" };
+        case 6: // drop a print again
+            if (!after(" print(7);")) {
+                return {};
+            }
+            return TextEdit { pos, pos + 10, "" };
+        case 7: // one byte gone, usually a syntax error
+            return TextEdit { pos, pos + 1, "" };
+        case 8: // an open paren or an unterminated comment, half-typed code
+            return TextEdit { pos, pos, rng() % 2 == 0 ? "(" : "/* " };
+        default: // a statement turned into a scope
+            if (!after("return (a * 2);")) {
+                return {};
+            }
+            return TextEdit { pos, pos + 15, "{ return (a * 3); }" };
+    }
+}
+
+static bool check_edits(const unsigned seed) {
+    IncrementalCompiler inc(make_source(400));
+    std::mt19937 rng(seed);
+    std::vector<TextEdit> undo; // back to the last source that parsed
+    size_t errors = 0;
+    for (int i = 0; i < 1000; i++) {
+        std::optional<TextEdit> edit;
+        const bool undoing = !undo.empty() && rng() % 4 != 0;
+        if (undoing) {
+            edit = undo.back();
+            undo.pop_back();
+        }else {
+            edit = random_edit(inc.source(), rng);
+        }
+        if (!edit.has_value()) {
+            continue;
+        }
+        std::string expected = inc.source();
+        const TextEdit back = inverse(expected, edit.value());
+        expected.replace(edit->begin, edit->end - edit->begin, edit->text);
+        const std::string before = dump(inc.program());
+
+        const std::optional<EditError> error = inc.apply(edit.value());
+        if (inc.source() != expected) {
+            std::cerr << "edit " << i << ": source differs from the edited text" << std::endl;
+            return false;
+        }
+        const std::optional<std::string> full = full_parse(expected);
+        if (full.has_value()) {
+            if (error.has_value() || inc.damaged() || dump(inc.program()) != full.value()) {
+                std::cerr << "edit " << i << ": incremental program differs from a full parse"
+                          << (error.has_value() ? " (" + error->message + ")" : "") << std::endl;
+                return false;
+            }
+            undo.clear();
+            continue;
+        }
+        if (!error.has_value() || dump(inc.program()) != before) {
+            std::cerr << "edit " << i << ": a source that does not parse was accepted or changed the program" << std::endl;
+            return false;
+        }
+        errors++;
+        if (!undoing) {
+            undo.push_back(back);
+        }
+    }
+    std::cout << "random edits: ok, " << errors << " of them reported errors" << std::endl;
+    return true;
+}
+
+static bool check_latency() {
+    const std::string src = make_source(100000);
+    IncrementalCompiler inc(src);
+    std::mt19937 rng(1);
+    std::vector<double> times;
+    for (int i = 0; i < 200; i++) {
+        // the digit in `return (a + N);` of a random function, a one-line edit
+        const size_t pos = inc.source().find("(a + ", rng() % src.size());
+        if (pos == std::string::npos) {
+            continue;
+        }
+        const TextEdit edit { pos + 5, pos + 6, std::to_string(rng() % 10) };
+        const auto start = std::chrono::steady_clock::now();
+        const std::optional<EditError> error = inc.apply(edit);
+        times.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+        if (error.has_value()) {
+            std::cerr << "latency edit failed: " << error->message << std::endl;
+            return false;
+        }
+    }
+    std::ranges::sort(times);
+    const double median = times[times.size() / 2];
+    std::cout << "one-line edit in 100k lines: median " << median << " us, worst " << times.back() << " us" << std::endl;
+    if (median >= 1000) {
+        std::cerr << "median edit took 1 ms or more" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    const unsigned seed = argc > 1 ? static_cast<unsigned>(std::strtoul(argv[1], nullptr, 10)) : 1;
+    return check_edits(seed) && check_latency() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
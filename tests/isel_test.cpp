@@ -0,0 +1,107 @@
+// Checks the patterns InstructionSelector picks for small expressions over
+// the 64-bit variables `a` and `b` and the i32 `n`: immediates on either side,
+// both sides of the imm32 range, operand order of `-` and `==`, and with the
+// ALU and imul forms made expensive, addresses folded into one lea. That the
+// chosen code computes the right values at every -O level is covered by
+// tests/programs/isel.hy.
+//
+//   isel_test
+
+#include <cstdlib>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+#include "lexer.hpp"
+#include "isel.hpp"
+
+struct Expect {
+    std::string expr;
+    IselNt nt;
+    IselRule rule;
+    bool swap = false;
+};
+
+// the rule picked for `nt` at the root of `expr`, nothing when it is not covered
+static std::optional<IselChoice> choice(const std::string& expr, const IselCosts& costs, const IselNt nt) {
+    Tokenizer tokenizer("int a = 1;\nint b = 2;\ni32 n = 3;\nint x = " + expr + ";\n");
+    Parser parser(tokenizer.tokenize());
+    const NodeProg prog = parser.parse_program().value();
+    TypeChecker().check_program(prog);
+    const NodeExpr* root = std::get<NodeStmtInt*>(prog.stmts.back()->var)->expr;
+    if (!InstructionSelector::coverable(root)) {
+        return {};
+    }
+    InstructionSelector sel(costs, 9);
+    return sel.label(root).rule(nt);
+}
+
+static bool check(const std::string& what, const IselCosts& costs, const std::vector<Expect>& expects) {
+    bool ok = true;
+    for (const Expect& e : expects) {
+        const auto got = choice(e.expr, costs, e.nt);
+        if (!got.has_value() || got->rule != e.rule || got->swap != e.swap) {
+            std::cerr << what << ": `" << e.expr << "` got rule "
+                      << (got.has_value() ? static_cast<int>(got->rule) : -1) << (got.has_value() && got->swap ? " swapped" : "")
+                      << ", expected " << static_cast<int>(e.rule) << (e.swap ? " swapped" : "") << std::endl;
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+int main() {
+    bool ok = check("default costs", IselCosts {}, {
+        { "a + 5", IselNt::Reg, IselRule::AluRI },
+        { "5 + a", IselNt::Reg, IselRule::AluRM },
+        { "a - 5", IselNt::Reg, IselRule::AluRI },
+        { "5 - a", IselNt::Reg, IselRule::AluRM },
+        { "b - a", IselNt::Reg, IselRule::AluRM },
+        { "a * 3", IselNt::Reg, IselRule::ImulMI },
+        { "3 * a", IselNt::Reg, IselRule::ImulMI, true },
+        { "a * b", IselNt::Reg, IselRule::ImulRM },
+        { "a == 5", IselNt::Flags, IselRule::CmpMI },
+        { "5 == a", IselNt::Flags, IselRule::CmpMI, true },
+        { "a == b", IselNt::Flags, IselRule::CmpRM },
+        { "a == 5", IselNt::Reg, IselRule::SetCc },
+        // INT32_MAX is still an immediate, one more is moved into a register
+        // and the variable becomes the memory operand
+        { "a + 2147483647", IselNt::Reg, IselRule::AluRI },
+        { "a + 2147483648", IselNt::Reg, IselRule::AluRM, true },
+        { "2147483648 - a", IselNt::Reg, IselRule::AluRM },
+    });
+
+    // `/` and i32 arithmetic are left to the stack machine
+    for (const std::string expr : { "a / 2", "2 / a", "n * n" }) {
+        if (choice(expr, IselCosts {}, IselNt::Reg).has_value()) {
+            std::cerr << "`" << expr << "` is covered" << std::endl;
+            ok = false;
+        }
+    }
+
+    // with ALU and imul forms at 3 a lea is cheaper for any add of registers
+    IselCosts lea_costs;
+    lea_costs.alu = lea_costs.alu_imm = lea_costs.alu_mem = 3;
+    lea_costs.imul = lea_costs.imul_imm = lea_costs.imul_mem = lea_costs.shift = 3;
+    ok &= check("expensive ALU", lea_costs, {
+        { "a + b", IselNt::Reg, IselRule::Lea },
+        { "a + b", IselNt::Addr, IselRule::AddrSib },
+        { "a + b", IselNt::Sib, IselRule::BaseIndex },
+        { "a + b * 4", IselNt::Sib, IselRule::BaseScaled },
+        { "b * 4 + a", IselNt::Sib, IselRule::BaseScaled, true },
+        { "a + b * 4 + 12", IselNt::Reg, IselRule::Lea },
+        { "a + b * 4 + 12", IselNt::Addr, IselRule::AddrDisp },
+        { "a * 8 + 3", IselNt::Addr, IselRule::AddrScaled },
+        { "a * 8", IselNt::Index, IselRule::Scale },
+        // a subtraction never swaps and only folds as a displacement
+        { "a * 4 + b - 5", IselNt::Reg, IselRule::Lea },
+        { "a * 4 + b - 5", IselNt::Addr, IselRule::AddrDisp },
+        { "a - 7", IselNt::Reg, IselRule::AluRI },
+        { "a - b", IselNt::Reg, IselRule::AluRM },
+    });
+
+    if (ok) {
+        std::cout << "isel: ok" << std::endl;
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
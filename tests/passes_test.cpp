@@ -0,0 +1,140 @@
+// Checks what StandardPasses do to a program, through the same PassManager
+// output --print-after and --pass-stats show: folds that would not fit the
+// type a value is stored as stay unfolded, `x / 0` is left to trap at run
+// time, `x * 0` folds only when `x` has no side effects and cannot trap, and
+// dce drops dead code. That the programs behave the same at every -O level is
+// covered by tests/programs/passes.hy.
+//
+//   passes_test
+
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "lexer.hpp"
+#include "passes.hpp"
+
+static const std::string source =
+    "int f(int v) {\n"
+    "    print(v);\n"
+    "    return (v);\n"
+    "}\n"
+    "u8 s(u8 v) {\n"
+    "    return (v);\n"
+    "}\n"
+    "int x = 5;\n"
+    "u8 a = 200 + 100;\n"
+    "u8 b = 100 + 100;\n"
+    "u8 c = (200 + 100);\n"
+    "int d = 1 - 2;\n"
+    "int e = x / 0;\n"
+    "int g = 4 / 0;\n"
+    "int h = x * 0;\n"
+    "int k = 0 * (x + 1);\n"
+    "int m = f(x) * 0;\n"
+    "int n = (x / 2) * 0;\n"
+    "int p = x + 0;\n"
+    "print(f(200 + 100));\n"
+    "print(s(200 + 55));\n"
+    "print(s(200 + 56));\n"
+    "if (0) { print(1); } elif (1) { print(2); } else { print(3); }\n"
+    "return (x);\n"
+    "print(1);\n";
+
+struct Run {
+    std::string printed;          // --print-after output
+    std::string stats;            // --pass-stats output
+    std::vector<std::string> names;
+};
+
+static Run run(const std::string& print_after, const OptLevel level) {
+    Tokenizer tokenizer(source);
+    Parser parser(tokenizer.tokenize());
+    NodeProg prog = parser.parse_program().value();
+    StandardPasses standard;
+    PassManager passes;
+    standard.register_with(passes);
+    std::stringstream printed;
+    passes.set_print_after(print_after, printed);
+    const std::vector<PassStats> stats = passes.run(prog, level);
+    std::stringstream table;
+    PassManager::print_stats(stats, table);
+    Run result { .printed = printed.str(), .stats = table.str() };
+    for (const PassStats& s : stats) {
+        result.names.push_back(s.name);
+    }
+    return result;
+}
+
+static bool expect_line(const std::string& what, const std::string& text, const std::string& line, const bool present = true) {
+    const bool found = ("\n" + text).find("\n" + line + "\n") != std::string::npos;
+    if (found == present) {
+        return true;
+    }
+    std::cerr << what << ": `" << line << "` " << (present ? "missing from" : "found in") << "\n" << text << std::endl;
+    return false;
+}
+
+int main() {
+    bool ok = true;
+
+    const Run fold = run("fold", OptLevel::O1);
+    ok &= expect_line("print-after", fold.printed, "// *** after fold ***");
+    // folded results that do not fit the type they are stored as
+    ok &= expect_line("narrow", fold.printed, "u8 a = 200 + 100;");
+    ok &= expect_line("narrow", fold.printed, "u8 b = 200;");
+    ok &= expect_line("narrow", fold.printed, "u8 c = (200 + 100);");
+    ok &= expect_line("narrow", fold.printed, "print(f(300));");
+    ok &= expect_line("narrow", fold.printed, "print(s(255));");
+    ok &= expect_line("narrow", fold.printed, "print(s(200 + 56));");
+    ok &= expect_line("negative", fold.printed, "i64 d = 1 - 2;");
+    // division by zero traps at run time
+    ok &= expect_line("x / 0", fold.printed, "i64 e = x / 0;");
+    ok &= expect_line("x / 0", fold.printed, "i64 g = 4 / 0;");
+    // `x * 0` only without a call or a division in x
+    ok &= expect_line("x * 0", fold.printed, "i64 h = 0;");
+    ok &= expect_line("x * 0", fold.printed, "i64 k = 0;");
+    ok &= expect_line("x * 0", fold.printed, "i64 m = f(x) * 0;");
+    ok &= expect_line("x * 0", fold.printed, "i64 n = (x / 2) * 0;");
+    ok &= expect_line("x + 0", fold.printed, "i64 p = x;");
+    // fold leaves statements alone, dce drops them
+    ok &= expect_line("fold", fold.printed, "print(1);");
+
+    const Run dce = run("dce", OptLevel::O1);
+    ok &= expect_line("print-after", dce.printed, "// *** after dce ***");
+    ok &= expect_line("dce", dce.printed, "print(1);", false);
+    ok &= expect_line("dce", dce.printed, "    print(2);");
+    ok &= expect_line("dce", dce.printed, "    print(3);", false);
+
+    // -O0 runs no pass and prints nothing, -O1 and -O2 the same three
+    const Run none = run("fold", OptLevel::O0);
+    if (!none.printed.empty() || !none.names.empty()) {
+        std::cerr << "-O0 ran passes" << std::endl;
+        ok = false;
+    }
+    const std::vector<std::string> order { "types", "fold", "dce" };
+    if (fold.names != order || run("fold", OptLevel::O2).names != order) {
+        std::cerr << "-O1 and -O2 do not run types, fold and dce in order" << std::endl;
+        ok = false;
+    }
+
+    // --pass-stats: a header, then each pass with its change count last
+    std::stringstream table(fold.stats);
+    std::string line;
+    std::getline(table, line);
+    ok &= expect_line("pass-stats", line + "\n", "pass           time (us)   changes");
+    for (const auto& [name, changes] : std::vector<std::pair<std::string, std::string>> { { "types", "0" }, { "fold", "6" }, { "dce", "3" } }) {
+        std::getline(table, line);
+        if (!line.starts_with(name + " ") || !line.ends_with(" " + changes)) {
+            std::cerr << "pass-stats: `" << line << "`, expected " << name << " with " << changes << " changes" << std::endl;
+            ok = false;
+        }
+    }
+
+    if (ok) {
+        std::cout << "passes: ok" << std::endl;
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
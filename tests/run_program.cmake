@@ -0,0 +1,47 @@
+# Runs one tests/programs/*.hy file. Its `// exit: N` line gives the exit
+# status and the optional `// prints: a b ...` line the values printed, one per
+# line. `comp --interp` has to produce both at -O0, -O1 and -O2. With NATIVE
+# on, so does the executable built at each level and with --stream.
+#
+#   cmake -DCOMP=<comp> -DSOURCE=<file.hy> -DWORK_DIR=<dir> -DNATIVE=ON|OFF -P run_program.cmake
+
+file(STRINGS ${SOURCE} exit_line LIMIT_COUNT 1 REGEX "^// exit: ")
+if(NOT exit_line)
+    message(FATAL_ERROR "${SOURCE} has no `// exit: N` line")
+endif()
+string(REPLACE "// exit: " "" expect_exit "${exit_line}")
+file(STRINGS ${SOURCE} prints_line LIMIT_COUNT 1 REGEX "^// prints: ")
+set(expect_output "")
+if(prints_line)
+    string(REPLACE "// prints: " "" prints "${prints_line}")
+    string(REPLACE " " "\n" expect_output "${prints}\n")
+endif()
+
+function(check what code output)
+    if(NOT code STREQUAL expect_exit)
+        message(FATAL_ERROR "${what}: exit status ${code}, expected ${expect_exit}")
+    endif()
+    if(NOT output STREQUAL expect_output)
+        message(FATAL_ERROR "${what}: printed\n${output}expected\n${expect_output}")
+    endif()
+endfunction()
+
+foreach(level -O0 -O1 -O2)
+    execute_process(COMMAND ${COMP} --interp ${level} ${SOURCE} RESULT_VARIABLE code OUTPUT_VARIABLE output)
+    check("--interp ${level}" "${code}" "${output}")
+endforeach()
+
+if(NATIVE)
+    file(MAKE_DIRECTORY ${WORK_DIR})
+    foreach(flag -O0 -O1 -O2 --stream)
+        # comp writes out.asm and out into the working directory
+        file(REMOVE ${WORK_DIR}/out)
+        execute_process(COMMAND ${COMP} ${flag} ${SOURCE} WORKING_DIRECTORY ${WORK_DIR}
+                        RESULT_VARIABLE code OUTPUT_QUIET ERROR_VARIABLE errors)
+        if(NOT code EQUAL 0 OR NOT EXISTS ${WORK_DIR}/out)
+            message(FATAL_ERROR "comp ${flag} failed:\n${errors}")
+        endif()
+        execute_process(COMMAND ${WORK_DIR}/out WORKING_DIRECTORY ${WORK_DIR} RESULT_VARIABLE code OUTPUT_VARIABLE output)
+        check("native ${flag}" "${code}" "${output}")
+    endforeach()
+endif()
@@ -0,0 +1,76 @@
+// Checks plan_switch on each side of its thresholds: the case count, the
+// density of the cases in [min, max] and the table size. What the chosen
+// lowering does at run time, for values inside, between and just outside the
+// cases, is covered by tests/programs/switch_*.hy under both backends.
+//
+//   switch_lowering_test
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include "lexer.hpp"
+#include "switch_lowering.hpp"
+
+// the plan for `switch (x) { <cases> }`
+static SwitchPlan plan(const std::string& cases) {
+    Tokenizer tokenizer("int x = 0;\nswitch (x) { " + cases + " }\n");
+    Parser parser(tokenizer.tokenize());
+    const NodeProg prog = parser.parse_program().value();
+    return plan_switch(std::get<NodeStmtSwitch*>(prog.stmts.back()->var));
+}
+
+static std::string case_list(const std::initializer_list<int64_t> values) {
+    std::string text;
+    for (const int64_t v : values) {
+        text += "case " + std::to_string(v) + ": { x = 1; } ";
+    }
+    return text;
+}
+
+static bool check(const std::string& what, const SwitchPlan& got, const bool table, const int64_t min = 0, const uint64_t entries = 0) {
+    if (got.table == table && (!table || (got.min == min && got.entries == entries))) {
+        return true;
+    }
+    std::cerr << what << ": got a " << (got.table ? "table" : "tree") << " (min " << got.min << ", "
+              << got.entries << " entries), expected a " << (table ? "table" : "tree") << std::endl;
+    return false;
+}
+
+int main() {
+    bool ok = true;
+    // fewer than min_table_cases always compare, however dense
+    ok &= check("3 dense cases", plan(case_list({ 1, 2, 3 })), false);
+    ok &= check("4 dense cases", plan(case_list({ 1, 2, 3, 4 })), true, 1, 4);
+    ok &= check("4 dense cases and a default", plan(case_list({ 5, 6, 7, 8 }) + "default: { x = 2; }"), true, 5, 4);
+    // 4 cases need at most 10 entries for 40% density
+    ok &= check("4 cases over 10 values", plan(case_list({ 1, 4, 7, 10 })), true, 1, 10);
+    ok &= check("4 cases over 11 values", plan(case_list({ 1, 4, 7, 11 })), false);
+    ok &= check("sparse cases", plan(case_list({ 1, 200, 3000, 40000 })), false);
+    // a range starting at 0 and one far from it
+    ok &= check("cases from 0", plan(case_list({ 0, 1, 2, 3, 4 })), true, 0, 5);
+    ok &= check("cases near 2^62", plan(case_list({ 4611686018427387904, 4611686018427387905, 4611686018427387906, 4611686018427387907 })),
+                true, 4611686018427387904, 4);
+    // 0, 2, 4, ... dense enough either way, only max_table_entries decides
+    const auto evens = [](const int count) {
+        std::string text;
+        for (int v = 0; v < count; v++) {
+            text += "case " + std::to_string(v * 2) + ": { x = 1; } ";
+        }
+        return text;
+    };
+    ok &= check("2048 cases over 4095 values", plan(evens(2048)), true, 0, 4095);
+    ok &= check("2049 cases over 4097 values", plan(evens(2049)), false);
+
+    // the cases come out sorted whatever the source order
+    const SwitchPlan sorted = plan(case_list({ 9, 3, 7, 1 }));
+    for (size_t i = 1; i < sorted.cases.size(); i++) {
+        if (sorted.cases[i - 1]->value >= sorted.cases[i]->value) {
+            std::cerr << "cases are not sorted by value" << std::endl;
+            ok = false;
+        }
+    }
+    if (ok) {
+        std::cout << "switch lowering: ok" << std::endl;
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}